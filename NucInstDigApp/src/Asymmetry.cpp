@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <math.h>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <boost/algorithm/string.hpp>
+
+#include <epicsGuard.h>
+
+#include "Asymmetry.h"
+
+Asymmetry::Asymmetry() : m_alpha(1.0), m_bgFirst(0), m_bgLast(-1)
+{
+}
+
+// add "n" or "first-last" to group
+static void parseSpectra(const std::string& token, std::vector<size_t>& group)
+{
+    size_t dash = token.find('-');
+    char* end = NULL;
+    long first = strtol(token.c_str(), &end, 10);
+    long last = first;
+    if (dash != std::string::npos && end == token.c_str() + dash)
+    {
+        last = strtol(token.c_str() + dash + 1, &end, 10);
+    }
+    if (end == NULL || *end != '\0' || first < 0 || last < first)
+    {
+        throw std::runtime_error("Asymmetry: invalid spectrum \"" + token + "\"");
+    }
+    if (last >= Asymmetry::MaxSpectrum)
+    {
+        throw std::runtime_error("Asymmetry: spectrum \"" + token + "\" is not below " + std::to_string(Asymmetry::MaxSpectrum));
+    }
+    for(long i=first; i<=last; ++i)
+    {
+        group.push_back(static_cast<size_t>(i));
+    }
+}
+
+void Asymmetry::loadGrouping(const std::string& filename)
+{
+    std::fstream fs(filename.c_str(), std::ios::in);
+    if (!fs.good())
+    {
+        throw std::runtime_error("Asymmetry: grouping file \"" + filename + "\" does not exist");
+    }
+    std::vector<size_t> forward, backward;
+    double alpha = -1.0;
+    std::string line;
+    std::vector<std::string> tokens;
+    while(std::getline(fs, line))
+    {
+        size_t pos = line.find("#");
+        if (pos != std::string::npos)
+        {
+            line.erase(line.begin() + pos, line.end());
+        }
+        boost::trim(line);
+        if (line.size() == 0)
+        {
+            continue;
+        }
+        boost::split(tokens, line, boost::is_any_of("\t ,"), boost::token_compress_on);
+        std::string key = boost::to_lower_copy(tokens[0]);
+        if (key == "forward" || key == "backward")
+        {
+            for(size_t i=1; i<tokens.size(); ++i)
+            {
+                parseSpectra(tokens[i], (key == "forward" ? forward : backward));
+            }
+        }
+        else if (key == "alpha" && tokens.size() == 2)
+        {
+            alpha = atof(tokens[1].c_str());
+        }
+        else
+        {
+            throw std::runtime_error("Asymmetry: invalid grouping line \"" + line + "\"");
+        }
+    }
+    std::sort(forward.begin(), forward.end());
+    forward.erase(std::unique(forward.begin(), forward.end()), forward.end());
+    std::sort(backward.begin(), backward.end());
+    backward.erase(std::unique(backward.begin(), backward.end()), backward.end());
+    std::vector<size_t> both;
+    std::set_intersection(forward.begin(), forward.end(), backward.begin(), backward.end(), std::back_inserter(both));
+    if (!both.empty())
+    {
+        throw std::runtime_error("Asymmetry: spectrum " + std::to_string(both[0]) + " is in both forward and backward groups");
+    }
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_forward.swap(forward);
+    m_backward.swap(backward);
+    if (alpha > 0.0)
+    {
+        m_alpha = alpha;
+    }
+}
+
+void Asymmetry::setGrouping(const std::vector<double>& groups)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_forward.clear();
+    m_backward.clear();
+    for(size_t i=0; i<groups.size(); ++i)
+    {
+        if (groups[i] == GroupForward)
+        {
+            m_forward.push_back(i);
+        }
+        else if (groups[i] == GroupBackward)
+        {
+            m_backward.push_back(i);
+        }
+    }
+}
+
+void Asymmetry::getGrouping(std::vector<double>& groups)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    size_t n = std::max((m_forward.empty() ? 0 : m_forward.back() + 1), (m_backward.empty() ? 0 : m_backward.back() + 1));
+    groups.assign(n, GroupNone);
+    for(size_t i=0; i<m_forward.size(); ++i)
+    {
+        groups[m_forward[i]] = GroupForward;
+    }
+    for(size_t i=0; i<m_backward.size(); ++i)
+    {
+        groups[m_backward[i]] = GroupBackward;
+    }
+}
+
+void Asymmetry::groupSizes(size_t& nforward, size_t& nbackward)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    nforward = m_forward.size();
+    nbackward = m_backward.size();
+}
+
+void Asymmetry::setAlpha(double alpha)
+{
+    if (alpha <= 0.0)
+    {
+        throw std::runtime_error("Asymmetry: alpha must be positive");
+    }
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_alpha = alpha;
+}
+
+double Asymmetry::alpha()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    return m_alpha;
+}
+
+void Asymmetry::setBackground(int first, int last)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_bgFirst = first;
+    m_bgLast = last;
+}
+
+// sum the spectra of a group bin by bin, bg is the mean of the sum over the background bins and bg_var its variance
+void Asymmetry::sumGroup(const std::vector<size_t>& group, const epicsUInt32* data, size_t nspec, size_t npts, std::vector<double>& sum,
+                         double& bg, double& bg_var)
+{
+    sum.assign(npts, 0.0);
+    for(size_t i=0; i<group.size(); ++i)
+    {
+        if (group[i] >= nspec)
+        {
+            break; // group is sorted
+        }
+        const epicsUInt32* spec = data + group[i] * npts;
+        for(size_t k=0; k<npts; ++k)
+        {
+            sum[k] += spec[k];
+        }
+    }
+    bg = bg_var = 0.0;
+    int first = std::max(m_bgFirst, 0), last = std::min(m_bgLast, static_cast<int>(npts) - 1);
+    if (last >= first)
+    {
+        double nbg = last - first + 1;
+        for(int k=first; k<=last; ++k)
+        {
+            bg += sum[k];
+        }
+        bg_var = bg / (nbg * nbg);
+        bg /= nbg;
+    }
+}
+
+void Asymmetry::compute(const epicsUInt32* data, size_t nspec, size_t npts, Result& result)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    double alpha = m_alpha;
+    double bg_f = 0.0, bg_f_var = 0.0, bg_b = 0.0, bg_b_var = 0.0;
+    sumGroup(m_forward, data, nspec, npts, m_sum, bg_f, bg_f_var);
+    result.forward.resize(npts);
+    double var_f_total = 0.0;
+    for(size_t k=0; k<npts; ++k)
+    {
+        result.forward[k] = m_sum[k] - bg_f;
+        var_f_total += m_sum[k];
+    }
+    var_f_total += npts * npts * bg_f_var; // the background of every bin is the same estimate
+    sumGroup(m_backward, data, nspec, npts, m_sum, bg_b, bg_b_var);
+    result.backward.resize(npts);
+    result.asymmetry.resize(npts);
+    result.error.resize(npts);
+    double var_b_total = 0.0;
+    result.forward_total = result.backward_total = 0.0;
+    for(size_t k=0; k<npts; ++k)
+    {
+        double f = result.forward[k], b = m_sum[k] - bg_b;
+        double var_f = (f + bg_f) + bg_f_var, var_b = m_sum[k] + bg_b_var;
+        double d = f + alpha * b;
+        result.backward[k] = b;
+        result.asymmetry[k] = (d > 0.0 ? (f - alpha * b) / d : 0.0);
+        result.error[k] = (d > 0.0 ? 2.0 * alpha * sqrt(b * b * var_f + f * f * var_b) / (d * d) : 0.0);
+        result.forward_total += f;
+        result.backward_total += b;
+        var_b_total += m_sum[k];
+    }
+    var_b_total += npts * npts * bg_b_var;
+    double f = result.forward_total, b = result.backward_total, d = f + alpha * b;
+    result.integral = (d > 0.0 ? (f - alpha * b) / d : 0.0);
+    result.integral_error = (d > 0.0 ? 2.0 * alpha * sqrt(b * b * var_f_total + f * f * var_b_total) / (d * d) : 0.0);
+}
+
+void Asymmetry::report(FILE* fp)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    fprintf(fp, "  Asymmetry: %d forward %d backward spectra, alpha %g, background bins %d to %d\n", static_cast<int>(m_forward.size()),
+            static_cast<int>(m_backward.size()), m_alpha, m_bgFirst, m_bgLast);
+}
@@ -0,0 +1,75 @@
+#ifndef ASYMMETRY_H
+#define ASYMMETRY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+/// Muon decay asymmetry of TOF spectra grouped into forward and backward detectors.
+/// For each bin F and B are the sums of the spectra in each group less their background,
+/// the mean counts per bin over the background bins, and
+///
+///     A = (F - alpha B) / (F + alpha B)
+///
+/// with Poisson errors on the counts and on the background means carried through.
+/// The group lists are held as spectrum numbers so an update only adds the spectra in a group.
+///
+/// The grouping file is plain text, # starts a comment, each line is a keyword and values:
+///
+///     forward  0-15 32     # spectrum numbers or first-last ranges, from 0
+///     backward 16-31 33
+///     alpha    1.05        # optional
+class Asymmetry
+{
+public:
+    enum Group { GroupNone = 0, GroupForward = 1, GroupBackward = 2 };
+    /// spectrum numbers in a grouping file are below this
+    static const long MaxSpectrum = 1 << 20;
+
+    struct Result
+    {
+        std::vector<double> forward; ///< background subtracted group counts per bin
+        std::vector<double> backward;
+        std::vector<double> asymmetry;
+        std::vector<double> error;
+        double forward_total;
+        double backward_total;
+        double integral; ///< asymmetry of the totals over all bins
+        double integral_error;
+        Result() : forward_total(0.0), backward_total(0.0), integral(0.0), integral_error(0.0) { }
+    };
+
+    Asymmetry();
+    /// replaces the grouping, and alpha if the file gives it, throws if the file cannot be read, has a
+    /// spectrum number at or above MaxSpectrum or puts a spectrum in both groups
+    void loadGrouping(const std::string& filename);
+    /// a Group for each spectrum from 0, other values are taken as GroupNone
+    void setGrouping(const std::vector<double>& groups);
+    void getGrouping(std::vector<double>& groups);
+    void groupSizes(size_t& nforward, size_t& nbackward);
+    void setAlpha(double alpha);
+    double alpha();
+    /// bins first to last are background, none if last < first
+    void setBackground(int first, int last);
+    /// spectra missing from data (spectrum >= nspec) are left out of their group
+    void compute(const epicsUInt32* data, size_t nspec, size_t npts, Result& result);
+    void report(FILE* fp);
+
+private:
+    epicsMutex m_lock; // protects all members
+    std::vector<size_t> m_forward;
+    std::vector<size_t> m_backward;
+    double m_alpha;
+    int m_bgFirst;
+    int m_bgLast;
+    std::vector<double> m_sum; // scratch for the group sums
+
+    void sumGroup(const std::vector<size_t>& group, const epicsUInt32* data, size_t nspec, size_t npts, std::vector<double>& sum,
+                  double& bg, double& bg_var);
+};
+
+#endif /* ASYMMETRY_H */
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdexcept>
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <epicsGuard.h>
+
+#include "CoincidenceDetector.h"
+
+CoincidenceDetector::CoincidenceDetector(const std::string& name, int nthreads, size_t max_queued) : m_name(name),
+                     m_enabled(false), m_merged(false), m_output(OutputNone), m_workers(name + " coincidence", max_queued, processC, this),
+                     m_nFrames(0), m_nEvents(0), m_nCoincidences(0), m_republisher(name + " coincidence events")
+{
+    epicsTimeGetCurrent(&m_lastMerge);
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        m_settings.reset(new Settings);
+        configure(8, 10.0, true);
+    }
+    m_workers.start(m_name + "Coinc", nthreads);
+}
+
+// called with m_lock held, clear starts new counts and partial counts of the old settings are discarded
+void CoincidenceDetector::configure(size_t nchan, double window, bool clear)
+{
+    Settings* s = new Settings;
+    s->generation = m_settings->generation + (clear ? 1 : 0);
+    s->nchan = nchan;
+    s->window = static_cast<uint32_t>(std::max(0.0, std::min(window, 4294967295.0)));
+    s->pairs.assign(nchan * nchan, 0);
+    if (m_pairList.empty())
+    {
+        for(size_t i=0; i<nchan; ++i)
+        {
+            for(size_t j=0; j<nchan; ++j)
+            {
+                s->pairs[i * nchan + j] = (i != j ? 1 : 0);
+            }
+        }
+    }
+    for(size_t k=0; k+1<m_pairList.size(); k += 2)
+    {
+        size_t a = static_cast<size_t>(m_pairList[k]), b = static_cast<size_t>(m_pairList[k + 1]);
+        if (a < nchan && b < nchan)
+        {
+            s->pairs[a * nchan + b] = s->pairs[b * nchan + a] = 1;
+        }
+    }
+    m_settings.reset(s);
+    if (clear)
+    {
+        m_total.assign(nchan * nchan, 0);
+        m_totalSingles.assign(nchan, 0);
+        m_last = m_total;
+        m_lastSingles = m_totalSingles;
+    }
+}
+
+void CoincidenceDetector::setChannels(size_t nchan)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    configure(nchan, m_settings->window, true);
+}
+
+void CoincidenceDetector::setWindow(double window)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    configure(m_settings->nchan, window, false);
+}
+
+void CoincidenceDetector::setPairs(const std::vector<double>& pairs)
+{
+    if (pairs.size() % 2 != 0)
+    {
+        throw std::runtime_error("CoincidenceDetector: channel pairs need an even number of values");
+    }
+    for(size_t k=0; k<pairs.size(); ++k)
+    {
+        if (pairs[k] < 0.0 || pairs[k] != floor(pairs[k]))
+        {
+            throw std::runtime_error("CoincidenceDetector: channel pairs must be channel numbers");
+        }
+    }
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_pairList = pairs;
+    configure(m_settings->nchan, m_settings->window, true);
+}
+
+void CoincidenceDetector::reset()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    configure(m_settings->nchan, m_settings->window, true);
+    m_nFrames = m_nEvents = m_nCoincidences = 0;
+    m_workers.resetDropped();
+}
+
+void CoincidenceDetector::consumeEvents(const EventMessagePtr& msg)
+{
+    if (!m_enabled || m_merged)
+    {
+        return;
+    }
+    Frame frame;
+    frame.owner = msg;
+    frame.metadata = msg->events()->metadata();
+    frame.frame_number = (frame.metadata != NULL ? frame.metadata->frame_number() : 0);
+    frame.digitizer_id = msg->events()->digitizer_id();
+    frame.events = msg->eventList();
+    submit(frame);
+}
+
+void CoincidenceDetector::consumeFrame(const MergedFramePtr& merged)
+{
+    if (!m_enabled || !m_merged)
+    {
+        return;
+    }
+    Frame frame;
+    frame.owner = merged;
+    frame.metadata = merged->metadata();
+    frame.frame_number = merged->frame_number;
+    frame.digitizer_id = FrameMerger::MERGED_DIGITIZER_ID;
+    frame.events.time = merged->time.data();
+    frame.events.voltage = merged->voltage.data();
+    frame.events.channel = merged->channel.data();
+    frame.events.n = merged->time.size();
+    submit(frame);
+}
+
+void CoincidenceDetector::submit(const Frame& frame)
+{
+    if (frame.events.n == 0 || frame.metadata == NULL)
+    {
+        return;
+    }
+    m_workers.submit(frame);
+}
+
+void CoincidenceDetector::processC(void* owner, const Frame& frame, Partial* partial)
+{
+    static_cast<CoincidenceDetector*>(owner)->process(frame, partial);
+}
+
+// sweep a frame with the current settings, partial counts of older settings are cleared first
+void CoincidenceDetector::process(const Frame& frame, Partial* partial)
+{
+    std::shared_ptr<const Settings> settings;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        settings = m_settings;
+        epicsGuard<epicsMutex> _plock(partial->lock);
+        if (partial->generation != settings->generation || partial->singles.size() != settings->nchan)
+        {
+            partial->generation = settings->generation;
+            partial->counts.assign(settings->nchan * settings->nchan, 0);
+            partial->singles.assign(settings->nchan, 0);
+        }
+    }
+    sweep(frame, *settings, partial);
+    Output output = m_output;
+    if (output != OutputNone && m_republisher.enabled())
+    {
+        publish(frame, partial, output == OutputCoincident);
+    }
+}
+
+/// Put the events of the frame in time order and, for each event, look at the later events
+/// within the window. Sort keys are time << 32 | index so a sort of plain integers gives the
+/// time order and the index of each event, frames already in time order are not sorted.
+void CoincidenceDetector::sweep(const Frame& frame, const Settings& s, Partial* partial)
+{
+    const EventList& ev = frame.events;
+    const size_t n = ev.n;
+    const size_t nchan = s.nchan;
+    const uint64_t window = s.window;
+    std::vector<uint64_t>& order = partial->order;
+    std::vector<uint8_t>& coincident = partial->coincident;
+    order.resize(n);
+    for(size_t i=0; i<n; ++i)
+    {
+        order[i] = (static_cast<uint64_t>(ev.time[i]) << 32) | i;
+    }
+    if (!std::is_sorted(ev.time, ev.time + n))
+    {
+        std::sort(order.begin(), order.end());
+    }
+    coincident.assign(n, 0);
+    uint64_t ncoinc = 0;
+    {
+        epicsGuard<epicsMutex> _lock(partial->lock);
+        if (partial->generation != s.generation)
+        {
+            return; // reset while waiting for the lock
+        }
+        uint64_t* counts = partial->counts.data();
+        uint64_t* singles = partial->singles.data();
+        for(size_t a=0; a<n; ++a)
+        {
+            uint32_t ia = static_cast<uint32_t>(order[a]);
+            uint32_t ca = ev.channel[ia];
+            if (ca >= nchan)
+            {
+                continue;
+            }
+            ++singles[ca];
+            uint64_t tmax = (order[a] >> 32) + window;
+            const uint8_t* pairs = &s.pairs[ca * nchan];
+            for(size_t b=a+1; b<n && (order[b] >> 32) <= tmax; ++b)
+            {
+                uint32_t ib = static_cast<uint32_t>(order[b]);
+                uint32_t cb = ev.channel[ib];
+                if (cb < nchan && pairs[cb] != 0)
+                {
+                    ++counts[ca * nchan + cb];
+                    if (ca != cb)
+                    {
+                        ++counts[cb * nchan + ca];
+                    }
+                    coincident[ia] = coincident[ib] = 1;
+                    ++ncoinc;
+                }
+            }
+        }
+    }
+    ++m_nFrames;
+    m_nEvents += n;
+    m_nCoincidences += ncoinc;
+}
+
+// republish the events of the frame that are, or are not, in a coincidence as a dev2 message
+void CoincidenceDetector::publish(const Frame& frame, const Partial* partial, bool coincident)
+{
+    const EventList& ev = frame.events;
+    std::vector<uint32_t> time, channel;
+    std::vector<uint16_t> voltage;
+    time.reserve(ev.n);
+    voltage.reserve(ev.n);
+    channel.reserve(ev.n);
+    uint32_t chan_min = UINT32_MAX, chan_max = 0;
+    for(size_t i=0; i<ev.n; ++i)
+    {
+        if ((partial->coincident[i] != 0) == coincident)
+        {
+            time.push_back(ev.time[i]);
+            voltage.push_back(ev.voltage[i]);
+            channel.push_back(ev.channel[i]);
+            chan_min = std::min(chan_min, ev.channel[i]);
+            chan_max = std::max(chan_max, ev.channel[i]);
+        }
+    }
+    if (channel.empty())
+    {
+        chan_min = 0;
+        chan_max = UINT32_MAX;
+    }
+    zmq::message_t msg = encodeEventList(static_cast<uint8_t>(frame.digitizer_id), frame.metadata, frame.frame_number, time, voltage, channel);
+    // the mutex also gives the memory barrier zmq needs for a socket to be used from another thread
+    epicsGuard<epicsMutex> _lock(m_publishLock);
+    m_republisher.publish(msg, frame.digitizer_id, chan_min, chan_max);
+}
+
+void CoincidenceDetector::merge(std::vector<double>& counts, std::vector<double>& rates, std::vector<double>& singles_rates, size_t& nchan)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    const std::vector<Partial*>& partials = m_workers.partials();
+    for(size_t i=0; i<partials.size(); ++i)
+    {
+        Partial* partial = partials[i];
+        epicsGuard<epicsMutex> _plock(partial->lock);
+        if (partial->generation != m_settings->generation || partial->counts.size() != m_total.size())
+        {
+            continue; // cleared by the worker on its next frame
+        }
+        for(size_t j=0; j<m_total.size(); ++j)
+        {
+            m_total[j] += partial->counts[j];
+        }
+        for(size_t j=0; j<m_totalSingles.size(); ++j)
+        {
+            m_totalSingles[j] += partial->singles[j];
+        }
+        std::fill(partial->counts.begin(), partial->counts.end(), 0);
+        std::fill(partial->singles.begin(), partial->singles.end(), 0);
+    }
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    double dt = epicsTimeDiffInSeconds(&now, &m_lastMerge);
+    m_lastMerge = now;
+    counts.assign(m_total.begin(), m_total.end());
+    rates.resize(m_total.size());
+    singles_rates.resize(m_totalSingles.size());
+    for(size_t j=0; j<m_total.size(); ++j)
+    {
+        rates[j] = (dt > 0.0 ? (m_total[j] - m_last[j]) / dt : 0.0);
+    }
+    for(size_t j=0; j<m_totalSingles.size(); ++j)
+    {
+        singles_rates[j] = (dt > 0.0 ? (m_totalSingles[j] - m_lastSingles[j]) / dt : 0.0);
+    }
+    m_last = m_total;
+    m_lastSingles = m_totalSingles;
+    nchan = m_settings->nchan;
+}
+
+CoincidenceDetector::Stats CoincidenceDetector::stats() const
+{
+    Stats s;
+    s.frames = m_nFrames;
+    s.events = m_nEvents;
+    s.coincidences = m_nCoincidences;
+    s.dropped = m_workers.nDropped();
+    return s;
+}
+
+void CoincidenceDetector::report(FILE* fp)
+{
+    std::shared_ptr<const Settings> settings;
+    size_t npairs;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        settings = m_settings;
+        npairs = m_pairList.size() / 2;
+    }
+    static const char* outputs[] = { "none", "coincident", "anticoincident" };
+    Stats s = stats();
+    fprintf(fp, "  Coincidences: %s%s, %d channels, window %u ns, %s, output %s, %d threads\n", (m_enabled ? "enabled" : "disabled"),
+            (m_merged ? " (merged frames)" : ""), static_cast<int>(settings->nchan), static_cast<unsigned>(settings->window),
+            (npairs > 0 ? (std::to_string(npairs) + " channel pairs").c_str() : "all channel pairs"), outputs[m_output],
+            static_cast<int>(m_workers.partials().size()));
+    fprintf(fp, "    frames %llu events %llu coincidences %llu dropped %llu\n", (unsigned long long)s.frames,
+            (unsigned long long)s.events, (unsigned long long)s.coincidences, (unsigned long long)s.dropped);
+    m_republisher.report(fp);
+}
@@ -0,0 +1,122 @@
+#ifndef COINCIDENCEDETECTOR_H
+#define COINCIDENCEDETECTOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "EventMessage.h"
+#include "FrameMerger.h"
+#include "Republisher.h"
+#include "WorkerPool.h"
+
+/// Finds events on different channels within a time window of each other, frame by frame.
+/// The events of each frame are put in time order and swept with the window, a pair of events
+/// is a coincidence if the pair table allows their two channels (by default any two different
+/// channels). Counts are kept as an nchan x nchan matrix, symmetric, with the singles of
+/// each channel alongside, and merge() turns them into rates.
+///
+/// Frames are queued by consumeEvents()/consumeFrame() and swept on the threads of a WorkerPool,
+/// each worker has its own partial counts like EventHistogram. Optionally the events in coincidence, or
+/// those not in coincidence, of each frame are republished as a dev2 message, frames are then
+/// not necessarily in frame_number order.
+class CoincidenceDetector : public EventConsumer, public MergedFrameConsumer
+{
+public:
+    enum Output { OutputNone = 0, OutputCoincident, OutputAnticoincident };
+
+    struct Stats
+    {
+        uint64_t frames;
+        uint64_t events;
+        uint64_t coincidences;
+        uint64_t dropped; ///< frames not swept as the queue was full
+    };
+
+    CoincidenceDetector(const std::string& name, int nthreads, size_t max_queued = 1000);
+    void enable(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    /// use merged frames rather than the event messages of one digitiser
+    void setMerged(bool merged) { m_merged = merged; }
+    /// channels 0 to nchan-1 are counted, the pair table is kept for channels still in range, clears the counts
+    void setChannels(size_t nchan);
+    /// window in ns
+    void setWindow(double window);
+    /// flattened list of channel pairs a0, b0, a1, b1, ... an empty list allows any two different channels, clears the counts
+    void setPairs(const std::vector<double>& pairs);
+    void setOutput(Output output) { m_output = output; }
+    Output output() const { return m_output; }
+    /// events passing the output selection are republished by this
+    Republisher& republisher() { return m_republisher; }
+    void consumeEvents(const EventMessagePtr& msg);
+    void consumeFrame(const MergedFramePtr& frame);
+    /// counts since the last reset and rates since the previous merge, the matrices are nchan * nchan
+    void merge(std::vector<double>& counts, std::vector<double>& rates, std::vector<double>& singles_rates, size_t& nchan);
+    void reset();
+    Stats stats() const;
+    void report(FILE* fp);
+
+private:
+    struct Settings
+    {
+        uint64_t generation; // changes on every reconfigure or reset
+        size_t nchan;
+        uint32_t window;
+        std::vector<uint8_t> pairs; // nchan * nchan, 1 if the two channels form a coincidence
+        Settings() : generation(0), nchan(0), window(0) { }
+    };
+
+    struct Frame
+    {
+        std::shared_ptr<const void> owner;
+        const FrameMetadataV2* metadata;
+        uint32_t frame_number; // of the merged frame, which may differ from metadata for a renumbered digitiser
+        int digitizer_id;
+        EventList events;
+    };
+
+    struct Partial
+    {
+        epicsMutex lock;
+        uint64_t generation;
+        std::vector<uint64_t> counts; // nchan * nchan, both halves
+        std::vector<uint64_t> singles; // nchan
+        std::vector<uint64_t> order; // scratch, time << 32 | index
+        std::vector<uint8_t> coincident; // scratch, event is in a coincidence
+        Partial() : generation(0) { }
+    };
+
+    std::string m_name;
+    std::atomic<bool> m_enabled;
+    std::atomic<bool> m_merged;
+    std::atomic<Output> m_output;
+    epicsMutex m_lock; // protects m_pairList, m_settings, m_total and m_last
+    std::vector<double> m_pairList; // as given to setPairs()
+    std::shared_ptr<const Settings> m_settings; // replaced, never modified
+    std::vector<uint64_t> m_total;
+    std::vector<uint64_t> m_totalSingles;
+    std::vector<uint64_t> m_last; // m_total at the previous merge
+    std::vector<uint64_t> m_lastSingles;
+    epicsTimeStamp m_lastMerge;
+    WorkerPool<Frame, Partial> m_workers;
+    std::atomic<uint64_t> m_nFrames;
+    std::atomic<uint64_t> m_nEvents;
+    std::atomic<uint64_t> m_nCoincidences;
+    epicsMutex m_publishLock; // publish() is called from every worker, one at a time
+    Republisher m_republisher;
+
+    static void processC(void* owner, const Frame& frame, Partial* partial);
+    void process(const Frame& frame, Partial* partial);
+    void submit(const Frame& frame);
+    void sweep(const Frame& frame, const Settings& s, Partial* partial);
+    void publish(const Frame& frame, const Partial* partial, bool coincident);
+    void configure(size_t nchan, double window, bool clear);
+};
+
+#endif /* COINCIDENCEDETECTOR_H */
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <epicsGuard.h>
+
+#include "EventFilter.h"
+
+const uint32_t EventFilter::MAX_CHANNELS;
+
+EventFilter::EventFilter() : m_enabled(false), m_passed(0)
+{
+    Settings* s = new Settings;
+    for(uint32_t i=0; i<=MAX_CHANNELS; ++i)
+    {
+        s->keep[i] = -1;
+        s->vmin[i] = 0;
+        s->vmax[i] = UINT16_MAX;
+        m_rejected[i] = 0;
+    }
+    s->tmin = 0;
+    s->twidth = UINT32_MAX;
+    m_settings.reset(s);
+}
+
+void EventFilter::setChannelMask(uint32_t mask)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    Settings* s = new Settings(*m_settings);
+    for(uint32_t i=0; i<MAX_CHANNELS; ++i)
+    {
+        s->keep[i] = ((mask >> i) & 1u) ? -1 : 0;
+    }
+    m_settings.reset(s);
+}
+
+// voltages are 16 bit ADC values, limits are clamped to that range
+static void setLimits(int32_t* limits, const std::vector<double>& values, uint32_t nchan)
+{
+    for(uint32_t i=0; i<nchan && !values.empty(); ++i)
+    {
+        double v = (values.size() == 1 ? values[0] : (i < values.size() ? values[i] : values.back()));
+        limits[i] = static_cast<int32_t>(std::max(-1.0, std::min(v, static_cast<double>(UINT16_MAX) + 1.0)));
+    }
+}
+
+void EventFilter::setVoltageMin(const std::vector<double>& vmin)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    Settings* s = new Settings(*m_settings);
+    setLimits(s->vmin, vmin, MAX_CHANNELS);
+    m_settings.reset(s);
+}
+
+void EventFilter::setVoltageMax(const std::vector<double>& vmax)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    Settings* s = new Settings(*m_settings);
+    setLimits(s->vmax, vmax, MAX_CHANNELS);
+    m_settings.reset(s);
+}
+
+void EventFilter::setTimeWindow(double tmin, double tmax)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    Settings* s = new Settings(*m_settings);
+    if (tmax > tmin)
+    {
+        s->tmin = static_cast<uint32_t>(std::max(0.0, std::min(tmin, static_cast<double>(UINT32_MAX))));
+        s->twidth = static_cast<uint32_t>(std::min(tmax, static_cast<double>(UINT32_MAX))) - s->tmin;
+    }
+    else
+    {
+        s->tmin = 0;
+        s->twidth = UINT32_MAX;
+    }
+    m_settings.reset(s);
+}
+
+#if defined(__AVX2__)
+// for each 8 bit keep mask, the positions of the kept lanes in order, used to pack them to the front
+struct CompactTable
+{
+    int32_t perm[256][8];
+    uint8_t count[256];
+    CompactTable()
+    {
+        for(int m=0; m<256; ++m)
+        {
+            int n = 0;
+            for(int b=0; b<8; ++b)
+            {
+                if (m & (1 << b))
+                {
+                    perm[m][n++] = b;
+                }
+            }
+            count[m] = static_cast<uint8_t>(n);
+            for(int b=n; b<8; ++b)
+            {
+                perm[m][b] = 0;
+            }
+        }
+    }
+};
+
+static const CompactTable g_compactTable;
+#endif
+
+// copy events passing s to the output arrays, which have room for in.n + 8 events, returns the number kept
+size_t EventFilter::compact(const Settings& s, const EventList& in, uint32_t* time, uint16_t* voltage, uint32_t* channel,
+                            uint64_t* rejected)
+{
+    size_t i = 0, j = 0;
+#if defined(__AVX2__)
+    const __m256i max_chan = _mm256_set1_epi32(MAX_CHANNELS);
+    const __m256i tmin = _mm256_set1_epi32(static_cast<int>(s.tmin));
+    const __m256i twidth = _mm256_set1_epi32(static_cast<int>(s.twidth));
+    for(; i + 8 <= in.n; i += 8)
+    {
+        __m256i ch = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.channel + i));
+        __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in.time + i));
+        __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in.voltage + i)));
+        __m256i idx = _mm256_min_epu32(ch, max_chan);
+        __m256i ok = _mm256_i32gather_epi32(s.keep, idx, 4);
+        ok = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_i32gather_epi32(s.vmin, idx, 4), v), ok);
+        ok = _mm256_andnot_si256(_mm256_cmpgt_epi32(v, _mm256_i32gather_epi32(s.vmax, idx, 4)), ok);
+        __m256i dt = _mm256_sub_epi32(t, tmin);
+        ok = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_max_epu32(dt, twidth), twidth), ok);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+        __m256i perm = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g_compactTable.perm[mask]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(time + j), _mm256_permutevar8x32_epi32(t, perm));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(channel + j), _mm256_permutevar8x32_epi32(ch, perm));
+        __m256i vp = _mm256_permutevar8x32_epi32(v, perm);
+        vp = _mm256_permute4x64_epi64(_mm256_packus_epi32(vp, vp), 0x08); // 16 bit values of both lanes in the low 128 bits
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(voltage + j), _mm256_castsi256_si128(vp));
+        j += g_compactTable.count[mask];
+        for(int rej = ~mask & 0xff, b = 0; rej != 0; rej >>= 1, ++b)
+        {
+            if (rej & 1)
+            {
+                ++rejected[std::min(in.channel[i + b], MAX_CHANNELS)];
+            }
+        }
+    }
+#endif
+    for(; i < in.n; ++i)
+    {
+        uint32_t ch = in.channel[i];
+        uint32_t idx = std::min(ch, MAX_CHANNELS);
+        int32_t v = in.voltage[i];
+        uint32_t t = in.time[i];
+        bool keep = (s.keep[idx] != 0) & (v >= s.vmin[idx]) & (v <= s.vmax[idx]) & (t - s.tmin <= s.twidth);
+        time[j] = t;
+        voltage[j] = static_cast<uint16_t>(v);
+        channel[j] = ch;
+        j += keep;
+        rejected[idx] += !keep;
+    }
+    return j;
+}
+
+void EventFilter::apply(EventMessage& msg)
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+    std::shared_ptr<const Settings> settings;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        settings = m_settings;
+    }
+    // events already filtered are moved out so the output arrays do not overlap them
+    std::vector<uint32_t> prev_time, prev_channel;
+    std::vector<uint16_t> prev_voltage;
+    prev_time.swap(msg.filtered_time);
+    prev_voltage.swap(msg.filtered_voltage);
+    prev_channel.swap(msg.filtered_channel);
+    EventList in = { prev_time.data(), prev_voltage.data(), prev_channel.data(), prev_time.size() };
+    if (!msg.filtered)
+    {
+        in = msg.eventList();
+    }
+    msg.filtered_time.resize(in.n + 8);
+    msg.filtered_voltage.resize(in.n + 8);
+    msg.filtered_channel.resize(in.n + 8);
+    uint64_t rejected[MAX_CHANNELS + 1];
+    memset(rejected, 0, sizeof(rejected));
+    size_t n = 0;
+    if (in.n > 0)
+    {
+        n = compact(*settings, in, msg.filtered_time.data(), msg.filtered_voltage.data(), msg.filtered_channel.data(), rejected);
+    }
+    msg.filtered_time.resize(n);
+    msg.filtered_voltage.resize(n);
+    msg.filtered_channel.resize(n);
+    msg.filtered = true;
+    m_passed += n;
+    for(uint32_t i=0; i<=MAX_CHANNELS; ++i)
+    {
+        if (rejected[i] != 0)
+        {
+            m_rejected[i] += rejected[i];
+        }
+    }
+}
+
+void EventFilter::getRejected(std::vector<double>& rejected, uint64_t& total_rejected, uint64_t& total_passed)
+{
+    rejected.resize(MAX_CHANNELS + 1);
+    total_rejected = 0;
+    for(uint32_t i=0; i<=MAX_CHANNELS; ++i)
+    {
+        uint64_t n = m_rejected[i];
+        rejected[i] = static_cast<double>(n);
+        total_rejected += n;
+    }
+    total_passed = m_passed;
+}
+
+void EventFilter::resetCounts()
+{
+    for(uint32_t i=0; i<=MAX_CHANNELS; ++i)
+    {
+        m_rejected[i] = 0;
+    }
+    m_passed = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef EVENTFILTER_H
+#define EVENTFILTER_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include <epicsMutex.h>
+
+#include "EventMessage.h"
+
+/// Selects events as they are ingested, before histogramming, merging and other consumers see them.
+/// An event is kept if its channel bit is set in the channel mask, its voltage is within the
+/// lower and upper thresholds of its channel and its time is within the time window.
+/// Channels from MAX_CHANNELS up are not channel-filtered, they have no mask bit or voltage limits
+/// but the time window still applies, and they share the last rejected counter.
+/// The selection is a branch free compaction of the event arrays, eight events at a time
+/// with AVX2 when the compiler targets it (e.g. -mavx2 or /arch:AVX2).
+class EventFilter
+{
+public:
+    static const uint32_t MAX_CHANNELS = 32; ///< bits in the channel mask
+
+    EventFilter();
+    void enable(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    void setChannelMask(uint32_t mask);
+    /// one value per channel from channel 0, a single value applies to all channels
+    void setVoltageMin(const std::vector<double>& vmin);
+    void setVoltageMax(const std::vector<double>& vmax);
+    /// times in ns, no time selection if tmax <= tmin
+    void setTimeWindow(double tmin, double tmax);
+    /// replace the events of msg by those passing the filter, does nothing if not enabled
+    void apply(EventMessage& msg);
+    /// rejected events of channels 0 to MAX_CHANNELS - 1, and all higher channels last
+    void getRejected(std::vector<double>& rejected, uint64_t& total_rejected, uint64_t& total_passed);
+    void resetCounts();
+
+private:
+    // lookup tables indexed by min(channel, MAX_CHANNELS)
+    struct Settings
+    {
+        int32_t keep[MAX_CHANNELS + 1]; // -1 if channel is in the mask, else 0
+        int32_t vmin[MAX_CHANNELS + 1];
+        int32_t vmax[MAX_CHANNELS + 1];
+        uint32_t tmin;
+        uint32_t twidth; // kept if time - tmin <= twidth, unsigned
+    };
+
+    std::atomic<bool> m_enabled;
+    epicsMutex m_lock; // protects m_settings
+    std::shared_ptr<const Settings> m_settings; // replaced, never modified, so apply() can use it without the lock
+    std::atomic<uint64_t> m_rejected[MAX_CHANNELS + 1];
+    std::atomic<uint64_t> m_passed;
+
+    static size_t compact(const Settings& s, const EventList& in, uint32_t* time, uint16_t* voltage, uint32_t* channel,
+                          uint64_t* rejected);
+};
+
+#endif /* EVENTFILTER_H */
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+
+#include <epicsGuard.h>
+
+#include "EventHistogram.h"
+
+EventHistogram::EventHistogram(const std::string& name, Axis axis, int nthreads, int lanes, size_t max_queued) :
+    m_name(name), m_axis(axis), m_lanes(lanes == 4 ? 4 : 1), m_workers(name + " histogram", max_queued, processC, this),
+    m_nOutside(0), m_nBinned(0)
+{
+    m_workers.start(m_name + "Hist", nthreads);
+}
+
+void EventHistogram::checkSize(size_t nchan, size_t nbins, size_t nperiods)
+{
+    if (nchan == 0 || nbins == 0 || nperiods == 0)
+    {
+        throw std::runtime_error("EventHistogram: channels, bins and periods must be at least 1");
+    }
+    if (nchan > MaxSize || nbins > MaxSize / nchan || nperiods > MaxSize / (nchan * nbins))
+    {
+        throw std::runtime_error("EventHistogram: " + std::to_string(nchan) + " channels x " + std::to_string(nbins) + " bins x " +
+                                 std::to_string(nperiods) + " periods is more than " + std::to_string(MaxSize));
+    }
+}
+
+void EventHistogram::setBinning(size_t nchan, double xmin, double xmax, size_t nbins)
+{
+    Binning b;
+    b.nchan = nchan;
+    b.nbins = nbins;
+    b.xmin = xmin;
+    b.xmax = xmax;
+    b.scale = (xmax > xmin ? nbins / (xmax - xmin) : 0.0);
+    if (xmax <= xmin)
+    {
+        b.nbins = 0;
+    }
+    configure(b);
+}
+
+void EventHistogram::setBinEdges(size_t nchan, const std::vector<double>& edges)
+{
+    if (edges.size() < 2)
+    {
+        throw std::runtime_error("EventHistogram: need at least two bin edges");
+    }
+    for(size_t i=1; i<edges.size(); ++i)
+    {
+        if (edges[i] <= edges[i-1])
+        {
+            throw std::runtime_error("EventHistogram: bin edges must be increasing");
+        }
+    }
+    Binning b;
+    b.nchan = nchan;
+    b.nbins = edges.size() - 1;
+    b.xmin = edges.front();
+    b.xmax = edges.back();
+    b.edges = edges;
+    configure(b);
+}
+
+void EventHistogram::setPeriods(size_t nperiods)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    nperiods = std::max(nperiods, static_cast<size_t>(1));
+    if (m_binning.nbins > 0)
+    {
+        checkSize(m_binning.nchan, m_binning.nbins, nperiods);
+    }
+    std::vector<uint32_t> total(m_binning.nchan * m_binning.nbins * nperiods, 0); // may throw, leaving the old periods
+    ++m_binning.generation;
+    m_binning.nperiods = nperiods;
+    m_total.swap(total);
+}
+
+void EventHistogram::configure(const Binning& binning)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    size_t nperiods = m_binning.nperiods;
+    if (binning.nbins > 0) // 0 for an empty range, nothing is binned
+    {
+        checkSize(binning.nchan, binning.nbins, nperiods);
+    }
+    std::vector<uint32_t> total(binning.nchan * binning.nbins * nperiods, 0); // may throw, leaving the old binning
+    uint64_t generation = m_binning.generation + 1;
+    m_binning = binning;
+    m_binning.generation = generation;
+    m_binning.nperiods = nperiods;
+    m_total.swap(total);
+}
+
+void EventHistogram::reset()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    ++m_binning.generation; // workers clear their partial histograms when they see this
+    std::fill(m_total.begin(), m_total.end(), 0);
+}
+
+void EventHistogram::submit(const EventBlock& block)
+{
+    m_workers.submit(block);
+}
+
+void EventHistogram::merge(std::vector<epicsUInt32>& data, size_t& nspec, size_t& npts)
+{
+    size_t nperiods = 0;
+    merge(data, nspec, npts, nperiods);
+    nspec *= nperiods;
+}
+
+void EventHistogram::merge(std::vector<epicsUInt32>& data, size_t& nchan, size_t& nbins, size_t& nperiods)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    const std::vector<Partial*>& partials = m_workers.partials();
+    for(size_t i=0; i<partials.size(); ++i)
+    {
+        Partial* partial = partials[i];
+        epicsGuard<epicsMutex> _plock(partial->lock);
+        if (partial->binning.generation != m_binning.generation || partial->counts.empty())
+        {
+            continue; // binned with an old configuration, the worker will clear it
+        }
+        const uint32_t* counts = partial->counts.data();
+        for(size_t j=0; j<m_total.size(); ++j, counts += m_lanes)
+        {
+            for(size_t k=0; k<m_lanes; ++k)
+            {
+                m_total[j] += counts[k];
+            }
+        }
+        for(size_t k=0; k<m_lanes; ++k)
+        {
+            m_nOutside += counts[k];
+        }
+        std::fill(partial->counts.begin(), partial->counts.end(), 0);
+    }
+    data.assign(m_total.begin(), m_total.end());
+    nchan = m_binning.nchan;
+    nbins = m_binning.nbins;
+    nperiods = m_binning.nperiods;
+}
+
+void EventHistogram::processC(void* owner, const EventBlock& block, Partial* partial)
+{
+    EventHistogram* hist = static_cast<EventHistogram*>(owner);
+    hist->reconfigure(partial);
+    hist->binBlock(block, partial);
+}
+
+// bring a partial histogram up to date with m_binning, if the allocation fails
+// it keeps its old binning and counts and is retried with the next block
+void EventHistogram::reconfigure(Partial* partial)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    epicsGuard<epicsMutex> _plock(partial->lock);
+    if (partial->binning.generation != m_binning.generation)
+    {
+        std::vector<uint32_t> counts((totalSize() + 1) * m_lanes, 0);
+        partial->counts.swap(counts);
+        partial->binning = m_binning;
+    }
+}
+
+/// Compute the flattened bin index of each event, offset by the start of its period, or
+/// nchan * nbins * nperiods for events outside the histogram.
+/// For equal width bins there are no branches so the compiler can vectorise the loop.
+template <typename X>
+void EventHistogram::binIndex(const X* x, const uint32_t* channel, size_t n, const Binning& b, uint32_t offset, uint32_t* index)
+{
+    const uint32_t outside = static_cast<uint32_t>(b.nchan * b.nbins * b.nperiods);
+    const uint32_t nchan = static_cast<uint32_t>(b.nchan);
+    const uint32_t nbins = static_cast<uint32_t>(b.nbins);
+    if (b.edges.empty())
+    {
+        const double xmin = b.xmin, xmax = b.xmax, scale = b.scale;
+        const int32_t last_bin = static_cast<int32_t>(nbins) - 1;
+        for(size_t i=0; i<n; ++i)
+        {
+            double xi = static_cast<double>(x[i]);
+            int32_t bin = static_cast<int32_t>((xi - xmin) * scale);
+            bin = (bin > last_bin ? last_bin : bin); // rounding at xmax
+            bool ok = (xi >= xmin) & (xi < xmax) & (channel[i] < nchan);
+            index[i] = (ok ? offset + channel[i] * nbins + static_cast<uint32_t>(bin) : outside);
+        }
+    }
+    else
+    {
+        for(size_t i=0; i<n; ++i)
+        {
+            double xi = static_cast<double>(x[i]);
+            if (channel[i] >= nchan || xi < b.xmin || xi >= b.xmax)
+            {
+                index[i] = outside;
+                continue;
+            }
+            size_t bin = std::upper_bound(b.edges.begin(), b.edges.end(), xi) - b.edges.begin() - 1;
+            index[i] = static_cast<uint32_t>(offset + channel[i] * nbins + bin);
+        }
+    }
+}
+
+void EventHistogram::binBlock(const EventBlock& block, Partial* partial)
+{
+    epicsGuard<epicsMutex> _lock(partial->lock);
+    const Binning& b = partial->binning;
+    if (b.nbins == 0 || b.nchan == 0 || block.n == 0)
+    {
+        return;
+    }
+    if (block.period >= b.nperiods)
+    {
+        partial->counts[b.nchan * b.nbins * b.nperiods * m_lanes] += static_cast<uint32_t>(block.n);
+        m_nBinned += block.n;
+        return;
+    }
+    const uint32_t offset = static_cast<uint32_t>(block.period * b.nchan * b.nbins);
+    partial->index.resize(block.n);
+    uint32_t* index = partial->index.data();
+    if (m_axis == AxisTime)
+    {
+        binIndex(block.time, block.channel, block.n, b, offset, index);
+    }
+    else
+    {
+        binIndex(block.voltage, block.channel, block.n, b, offset, index);
+    }
+    if (m_lanes == 4)
+    {
+        increment<4>(index, block.n, partial->counts.data());
+    }
+    else
+    {
+        increment<1>(index, block.n, partial->counts.data());
+    }
+    m_nBinned += block.n;
+}
+
+/// Scatter increment, event i goes to lane i % L of its bin. Unrolled by L so each lane
+/// is a fixed offset and successive increments to the same bin are independent.
+template <size_t L>
+void EventHistogram::increment(const uint32_t* index, size_t n, uint32_t* counts)
+{
+    size_t i = 0;
+    for(; i + L <= n; i += L)
+    {
+        for(size_t k=0; k<L; ++k)
+        {
+            ++counts[index[i + k] * L + k];
+        }
+    }
+    for(; i<n; ++i)
+    {
+        ++counts[index[i] * L];
+    }
+}
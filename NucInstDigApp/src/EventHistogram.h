@@ -0,0 +1,108 @@
+#ifndef EVENTHISTOGRAM_H
+#define EVENTHISTOGRAM_H
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+#include "WorkerPool.h"
+
+/// Histograms event lists into one spectrum per channel, binning either event time or voltage.
+/// Blocks of events are queued by submit() and binned on the threads of a WorkerPool, each worker has
+/// its own partial histogram so no locking is needed per event. merge() adds the partial
+/// histograms into the running total and returns a copy of it.
+///
+/// Histograms can be split into periods, each EventBlock says which period it belongs to and
+/// the total is nperiods blocks of nchan spectra. Blocks for periods >= nperiods are counted as outside.
+///
+/// Histograms are stored channel by channel, a row of nbins per channel. With lanes > 1 each bin
+/// has lanes adjacent counters and consecutive events increment different lanes, so runs of events
+/// in the same bin (e.g. a pulse height peak) do not wait on each other's stores. The lanes of a bin
+/// share a cache line and are summed by merge().
+class EventHistogram
+{
+public:
+    enum Axis { AxisTime = 0, AxisVoltage };
+    /// largest nchan * nbins * nperiods, bin indices are uint32 and every worker has a copy
+    static const size_t MaxSize = 1 << 26;
+
+    /// events from one message, the arrays stay valid as long as owner is held
+    struct EventBlock
+    {
+        std::shared_ptr<const void> owner;
+        const uint32_t* channel;
+        const uint32_t* time;
+        const uint16_t* voltage;
+        size_t n;
+        size_t period; ///< 0 to nperiods-1
+    };
+
+    /// lanes is 1 or 4, anything else is taken as 1
+    EventHistogram(const std::string& name, Axis axis, int nthreads, int lanes = 1, size_t max_queued = 1000);
+    /// throws if a histogram of nchan * nbins * nperiods is empty or larger than MaxSize
+    static void checkSize(size_t nchan, size_t nbins, size_t nperiods);
+    /// nbins equal width bins from xmin to xmax for channels 0 to nchan-1, clears the histogram
+    void setBinning(size_t nchan, double xmin, double xmax, size_t nbins);
+    /// bins given by increasing edges, nbins = edges.size() - 1, clears the histogram
+    void setBinEdges(size_t nchan, const std::vector<double>& edges);
+    /// number of periods (default 1), clears the histogram
+    void setPeriods(size_t nperiods);
+    void submit(const EventBlock& block);
+    /// spectra of all periods, nspec is nchan * nperiods
+    void merge(std::vector<epicsUInt32>& data, size_t& nspec, size_t& npts);
+    /// data is nbins * nchan * nperiods, period by period
+    void merge(std::vector<epicsUInt32>& data, size_t& nchan, size_t& nbins, size_t& nperiods);
+    void reset();
+    uint64_t nDropped() const { return m_workers.nDropped(); } ///< blocks not binned as the queue was full
+    uint64_t nOutside() const { return m_nOutside; } ///< events outside the binning or channel range
+    uint64_t nBinned() const { return m_nBinned; }
+
+private:
+    struct Binning
+    {
+        uint64_t generation; // changes on every reconfigure or reset
+        size_t nchan;
+        size_t nbins;
+        size_t nperiods;
+        double xmin;
+        double xmax;
+        double scale; // nbins / (xmax - xmin)
+        std::vector<double> edges; // empty for equal width bins
+        Binning() : generation(0), nchan(0), nbins(0), nperiods(1), xmin(0.0), xmax(0.0), scale(0.0) { }
+    };
+
+    struct Partial
+    {
+        epicsMutex lock;
+        Binning binning; // copy of m_binning this partial histogram was made with
+        std::vector<uint32_t> counts; // (nchan * nbins * nperiods plus one last entry for events outside the histogram) * lanes
+        std::vector<uint32_t> index; // scratch for bin indices of a block
+    };
+
+    std::string m_name;
+    Axis m_axis;
+    size_t m_lanes;
+    epicsMutex m_lock; // protects m_binning and m_total
+    Binning m_binning;
+    std::vector<uint32_t> m_total; // same layout as Partial::counts without the outside entry
+    WorkerPool<EventBlock, Partial> m_workers;
+    std::atomic<uint64_t> m_nOutside;
+    std::atomic<uint64_t> m_nBinned;
+
+    static void processC(void* owner, const EventBlock& block, Partial* partial);
+    void reconfigure(Partial* partial);
+    void binBlock(const EventBlock& block, Partial* partial);
+    template <size_t L>
+        static void increment(const uint32_t* index, size_t n, uint32_t* counts);
+    template <typename X>
+        static void binIndex(const X* x, const uint32_t* channel, size_t n, const Binning& b, uint32_t offset, uint32_t* index);
+    void configure(const Binning& binning);
+    size_t totalSize() const { return m_binning.nchan * m_binning.nbins * m_binning.nperiods; }
+};
+
+#endif /* EVENTHISTOGRAM_H */
@@ -0,0 +1,90 @@
+#ifndef EVENTMESSAGE_H
+#define EVENTMESSAGE_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <zmq.hpp>
+#include <flatbuffers/flatbuffers.h>
+#include "dev2_digitizer_event_v2_generated.h"
+
+/// the events of a message as n values in each of three arrays
+struct EventList
+{
+    const uint32_t* time;
+    const uint16_t* voltage;
+    const uint32_t* channel;
+    size_t n;
+};
+
+/// a received dev2 event list, shared between event consumers without copying the zmq message.
+/// If an EventFilter has been applied the events passing it are held separately, consumers
+/// should use eventList() for events and events() only for the digitiser and frame metadata
+struct EventMessage
+{
+    zmq::message_t msg;
+    bool filtered;
+    std::vector<uint32_t> filtered_time;
+    std::vector<uint16_t> filtered_voltage;
+    std::vector<uint32_t> filtered_channel;
+
+    EventMessage() : filtered(false) { }
+    const DigitizerEventListMessage* events() const { return GetDigitizerEventListMessage(msg.data()); }
+    EventList eventList() const
+    {
+        EventList list = { NULL, NULL, NULL, 0 };
+        if (filtered)
+        {
+            list.time = filtered_time.data();
+            list.voltage = filtered_voltage.data();
+            list.channel = filtered_channel.data();
+            list.n = filtered_time.size();
+            return list;
+        }
+        const DigitizerEventListMessage* ev = events();
+        if (ev->time() != NULL && ev->voltage() != NULL && ev->channel() != NULL)
+        {
+            list.time = ev->time()->data();
+            list.voltage = ev->voltage()->data();
+            list.channel = ev->channel()->data();
+            list.n = std::min(ev->time()->size(), std::min(ev->voltage()->size(), ev->channel()->size()));
+        }
+        return list;
+    }
+};
+
+typedef std::shared_ptr<const EventMessage> EventMessagePtr;
+
+/// encode events as a dev2 message with a copy of the metadata of the frame they came from, but frame_number
+inline zmq::message_t encodeEventList(uint8_t digitizer_id, const FrameMetadataV2* metadata, uint32_t frame_number,
+                                      const std::vector<uint32_t>& time, const std::vector<uint16_t>& voltage,
+                                      const std::vector<uint32_t>& channel)
+{
+    flatbuffers::FlatBufferBuilder fbb(1024 + time.size() * 10);
+    GpsTime timestamp;
+    if (metadata->timestamp() != NULL)
+    {
+        timestamp = *(metadata->timestamp());
+    }
+    flatbuffers::Offset<FrameMetadataV2> fb_metadata = CreateFrameMetadataV2(fbb, (metadata->timestamp() != NULL ? &timestamp : NULL),
+                             metadata->period_number(), metadata->protons_per_pulse(), metadata->running(), frame_number,
+                             metadata->veto_flags());
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t> > fb_time = fbb.CreateVector(time);
+    flatbuffers::Offset<flatbuffers::Vector<uint16_t> > fb_voltage = fbb.CreateVector(voltage);
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t> > fb_channel = fbb.CreateVector(channel);
+    FinishDigitizerEventListMessageBuffer(fbb, CreateDigitizerEventListMessage(fbb, digitizer_id, fb_metadata, fb_time, fb_voltage, fb_channel));
+    return zmq::message_t(fbb.GetBufferPointer(), fbb.GetSize());
+}
+
+/// something that processes event lists, called from the event ingest thread for every message so
+/// must be quick, a consumer may keep a reference to the message for later processing
+class EventConsumer
+{
+public:
+    virtual void consumeEvents(const EventMessagePtr& msg) = 0;
+    virtual ~EventConsumer() { }
+};
+
+#endif /* EVENTMESSAGE_H */
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <math.h>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <functional>
+
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsGuard.h>
+
+#include "FrameTracker.h"
+#include "FrameMerger.h"
+
+// a frame_number this far below the last emitted one is a restart of numbering rather than late
+static const uint32_t RESTART_GAP = 1024;
+
+// digitisers share GPS time, so the timestamps of one frame agree far better than this
+static const double TIME_MATCH = 0.001;
+
+static double timeNow()
+{
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    return static_cast<double>(now.secPastEpoch) + now.nsec / 1.0e9;
+}
+
+FrameMerger::FrameMerger(size_t window, double timeout, uint32_t channel_stride) : m_enabled(false), m_channelStride(channel_stride),
+                         m_window(std::max(window, static_cast<size_t>(1))), m_timeout(timeout), m_emitted(false), m_lastEmitted(0),
+                         m_republisher("merged events")
+{
+    if (epicsThreadCreate("FrameMerger",
+                          epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)mergeThreadC, this) == 0)
+    {
+        throw std::runtime_error("FrameMerger: epicsThreadCreate failure");
+    }
+}
+
+void FrameMerger::mergeThreadC(void* arg)
+{
+    FrameMerger* merger = (FrameMerger*)arg;
+    merger->mergeThread();
+}
+
+// disabling drops anything pending, so a later enable starts from whatever frame arrives next
+void FrameMerger::enable(bool enabled)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_enabled = enabled;
+    if (!enabled)
+    {
+        m_pending.clear();
+        m_flush.clear();
+        m_emitted = false;
+    }
+}
+
+void FrameMerger::setWindow(size_t window)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_window = std::max(window, static_cast<size_t>(1));
+}
+
+void FrameMerger::setTimeout(double timeout)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_timeout = timeout;
+}
+
+void FrameMerger::addConsumer(MergedFrameConsumer* consumer)
+{
+    epicsGuard<epicsMutex> _lock(m_consumersLock);
+    m_consumers.push_back(consumer);
+}
+
+void FrameMerger::consumeEvents(const EventMessagePtr& msg)
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+    const DigitizerEventListMessage* events = msg->events();
+    if (events->metadata() == NULL)
+    {
+        return;
+    }
+    uint32_t frame = events->metadata()->frame_number();
+    int dig = events->digitizer_id();
+    const GpsTime* timestamp = events->metadata()->timestamp();
+    double time = (timestamp != NULL ? FrameTracker::gpsTimeToPosix(*timestamp) : 0.0);
+    double now = timeNow();
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        m_lastSeen[dig] = now;
+        std::map<uint32_t, Pending>::iterator same_time = (timestamp != NULL ? findByTime(time) : m_pending.end());
+        if (same_time != m_pending.end())
+        {
+            if (same_time->first != frame)
+            {
+                ++m_stats.renumbered;
+                frame = same_time->first;
+            }
+        }
+        else if (m_emitted && frame <= m_lastEmitted)
+        {
+            if (m_lastEmitted - frame <= RESTART_GAP)
+            {
+                ++m_stats.late;
+                return;
+            }
+            // new run, emit what is left of the old one first
+            ++m_stats.restarts;
+            for(std::map<uint32_t, Pending>::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+            {
+                m_flush.push_back(it->second);
+            }
+            m_pending.clear();
+            m_emitted = false;
+        }
+        Pending& pending = m_pending[frame];
+        if (pending.parts.empty())
+        {
+            pending.frame_number = frame;
+            pending.arrived = now;
+        }
+        if (timestamp != NULL && !pending.has_time)
+        {
+            pending.has_time = true;
+            pending.time = time;
+        }
+        else if (timestamp != NULL && fabs(time - pending.time) > TIME_MATCH)
+        {
+            ++m_stats.mismatched;
+            return;
+        }
+        if (!pending.digitisers.insert(dig).second)
+        {
+            ++m_stats.duplicate;
+            return;
+        }
+        pending.parts.push_back(msg);
+    }
+    m_wakeup.signal();
+}
+
+// the pending frame with a GPS timestamp matching time, called with m_lock held
+std::map<uint32_t, FrameMerger::Pending>::iterator FrameMerger::findByTime(double time)
+{
+    for(std::map<uint32_t, Pending>::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+    {
+        if (it->second.has_time && fabs(time - it->second.time) <= TIME_MATCH)
+        {
+            return it;
+        }
+    }
+    return m_pending.end();
+}
+
+// digitisers that have sent a message recently, called with m_lock held
+size_t FrameMerger::activeDigitisers(double now)
+{
+    size_t n = 0;
+    for(std::map<int, double>::const_iterator it = m_lastSeen.begin(); it != m_lastSeen.end(); ++it)
+    {
+        if (now - it->second < 10.0 * m_timeout)
+        {
+            ++n;
+        }
+    }
+    return std::max(n, static_cast<size_t>(1));
+}
+
+// move frames that can be emitted to ready, in frame order
+void FrameMerger::collectReady(std::vector<Pending>& ready)
+{
+    double now = timeNow();
+    epicsGuard<epicsMutex> _lock(m_lock);
+    size_t ndig = activeDigitisers(now);
+    m_stats.ndigitisers = ndig;
+    for(size_t i=0; i<m_flush.size(); ++i)
+    {
+        m_flush[i].complete = (m_flush[i].digitisers.size() >= ndig);
+        ready.push_back(m_flush[i]);
+    }
+    m_flush.clear();
+    while(!m_pending.empty())
+    {
+        std::map<uint32_t, Pending>::iterator it = m_pending.begin();
+        Pending& pending = it->second;
+        pending.complete = (pending.digitisers.size() >= ndig);
+        if (!pending.complete && now - pending.arrived < m_timeout && m_pending.size() <= m_window)
+        {
+            break;
+        }
+        m_lastEmitted = it->first;
+        m_emitted = true;
+        ready.push_back(pending);
+        m_pending.erase(it);
+    }
+    for(size_t i=0; i<ready.size(); ++i)
+    {
+        ++(ready[i].complete ? m_stats.complete : m_stats.incomplete);
+    }
+    m_stats.pending = m_pending.size();
+}
+
+// k-way merge of the digitiser event lists by time
+MergedFramePtr FrameMerger::merge(Pending& pending)
+{
+    struct Cursor
+    {
+        const uint32_t* time;
+        const uint16_t* voltage;
+        const uint32_t* channel;
+        std::vector<uint32_t> order; // index of events in time order if the message is not sorted
+        size_t n;
+        size_t pos;
+        uint8_t digitizer_id;
+        size_t index() const { return (order.empty() ? pos : order[pos]); }
+        uint32_t nextTime() const { return time[index()]; }
+    };
+    std::shared_ptr<MergedFrame> frame = std::make_shared<MergedFrame>();
+    frame->frame_number = pending.frame_number;
+    frame->complete = pending.complete;
+    frame->parts.swap(pending.parts);
+    std::vector<Cursor> cursors;
+    size_t total = 0;
+    for(size_t i=0; i<frame->parts.size(); ++i)
+    {
+        EventList events = frame->parts[i]->eventList();
+        Cursor c;
+        c.time = events.time;
+        c.voltage = events.voltage;
+        c.channel = events.channel;
+        c.n = events.n;
+        c.pos = 0;
+        c.digitizer_id = frame->parts[i]->events()->digitizer_id();
+        if (c.n == 0)
+        {
+            continue;
+        }
+        if (!std::is_sorted(c.time, c.time + c.n))
+        {
+            const uint32_t* time = c.time;
+            c.order.resize(c.n);
+            std::iota(c.order.begin(), c.order.end(), 0);
+            std::stable_sort(c.order.begin(), c.order.end(), [time](uint32_t a, uint32_t b) { return time[a] < time[b]; });
+        }
+        total += c.n;
+        cursors.push_back(c);
+    }
+    frame->time.reserve(total);
+    frame->voltage.reserve(total);
+    frame->channel.reserve(total);
+    frame->digitizer_id.reserve(total);
+    uint32_t stride = m_channelStride;
+    uint64_t bad_channel = 0;
+    typedef std::pair<uint32_t, size_t> HeapEntry; // (time, cursor)
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+    for(size_t i=0; i<cursors.size(); ++i)
+    {
+        heap.push(HeapEntry(cursors[i].nextTime(), i));
+    }
+    while(!heap.empty())
+    {
+        Cursor& c = cursors[heap.top().second];
+        heap.pop();
+        size_t j = c.index();
+        if (stride == 0 || c.channel[j] < stride)
+        {
+            frame->time.push_back(c.time[j]);
+            frame->voltage.push_back(c.voltage[j]);
+            frame->channel.push_back(stride > 0 ? c.digitizer_id * stride + c.channel[j] : c.channel[j]);
+            frame->digitizer_id.push_back(c.digitizer_id);
+        }
+        else
+        {
+            ++bad_channel;
+        }
+        if (++c.pos < c.n)
+        {
+            heap.push(HeapEntry(c.nextTime(), &c - &cursors[0]));
+        }
+    }
+    if (bad_channel > 0)
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        m_stats.bad_channel += bad_channel;
+    }
+    return frame;
+}
+
+// republish a merged frame as a dev2 message for file writing and other clients
+void FrameMerger::publish(const MergedFrame& frame)
+{
+    zmq::message_t msg = encodeEventList(MERGED_DIGITIZER_ID, frame.metadata(), frame.frame_number, frame.time, frame.voltage, frame.channel);
+    uint32_t chan_min = 0, chan_max = UINT32_MAX;
+    if (m_republisher.filtersChannels() && !frame.channel.empty())
+    {
+        std::pair<std::vector<uint32_t>::const_iterator, std::vector<uint32_t>::const_iterator> range =
+                                           std::minmax_element(frame.channel.begin(), frame.channel.end());
+        chan_min = *range.first;
+        chan_max = *range.second;
+    }
+    m_republisher.publish(msg, MERGED_DIGITIZER_ID, chan_min, chan_max);
+}
+
+void FrameMerger::mergeThread()
+{
+    std::vector<Pending> ready;
+    while(true)
+    {
+        try
+        {
+            double timeout;
+            {
+                epicsGuard<epicsMutex> _lock(m_lock);
+                timeout = m_timeout;
+            }
+            // wake at least a few times per timeout so incomplete frames are not held much longer than it
+            m_wakeup.wait(std::max(std::min(timeout / 4.0, 0.1), 0.001));
+            ready.clear();
+            collectReady(ready);
+            for(size_t i=0; i<ready.size(); ++i)
+            {
+                MergedFramePtr frame = merge(ready[i]);
+                {
+                    epicsGuard<epicsMutex> _lock(m_lock);
+                    m_stats.events += frame->time.size();
+                }
+                {
+                    epicsGuard<epicsMutex> _lock(m_consumersLock);
+                    for(size_t j=0; j<m_consumers.size(); ++j)
+                    {
+                        m_consumers[j]->consumeFrame(frame);
+                    }
+                }
+                if (m_republisher.enabled())
+                {
+                    publish(*frame);
+                }
+            }
+        }
+        catch(const std::exception& ex)
+        {
+            std::cerr << "FrameMerger: " << ex.what() << std::endl;
+            epicsThreadSleep(1.0);
+        }
+    }
+}
+
+FrameMerger::Stats FrameMerger::stats()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    return m_stats;
+}
+
+void FrameMerger::resetStats()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    size_t pending = m_stats.pending, ndigitisers = m_stats.ndigitisers;
+    m_stats = Stats();
+    m_stats.pending = pending;
+    m_stats.ndigitisers = ndigitisers;
+}
+
+void FrameMerger::report(FILE* fp)
+{
+    Stats s = stats();
+    size_t window;
+    double timeout;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        window = m_window;
+        timeout = m_timeout;
+    }
+    fprintf(fp, "  Frame merger: %s, window %d frames, timeout %.3f s, channel stride %u, %d active digitisers\n",
+            (m_enabled ? "enabled" : "disabled"), static_cast<int>(window), timeout, static_cast<unsigned>(m_channelStride),
+            static_cast<int>(s.ndigitisers));
+    fprintf(fp, "    complete %llu incomplete %llu late %llu duplicate %llu restarts %llu renumbered %llu mismatched %llu events %llu "
+            "bad channel %llu pending %d\n", (unsigned long long)s.complete, (unsigned long long)s.incomplete, (unsigned long long)s.late,
+            (unsigned long long)s.duplicate, (unsigned long long)s.restarts, (unsigned long long)s.renumbered,
+            (unsigned long long)s.mismatched, (unsigned long long)s.events, (unsigned long long)s.bad_channel, static_cast<int>(s.pending));
+    m_republisher.report(fp);
+}
@@ -0,0 +1,133 @@
+#ifndef FRAMEMERGER_H
+#define FRAMEMERGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+
+#include "EventMessage.h"
+#include "Republisher.h"
+
+/// the events of one frame from all digitisers, in time order
+struct MergedFrame
+{
+    uint32_t frame_number;
+    bool complete; ///< false if a digitiser had not sent the frame before it was emitted
+    std::vector<EventMessagePtr> parts; ///< the digitiser messages, these own the frame metadata
+    std::vector<uint32_t> time;
+    std::vector<uint16_t> voltage;
+    std::vector<uint32_t> channel; ///< digitiser channel, or digitizer_id * channel stride + channel with a stride
+    std::vector<uint8_t> digitizer_id;
+    const FrameMetadataV2* metadata() const { return parts[0]->events()->metadata(); }
+};
+
+typedef std::shared_ptr<const MergedFrame> MergedFramePtr;
+
+/// something that processes merged frames, called from the FrameMerger thread for every frame
+class MergedFrameConsumer
+{
+public:
+    virtual void consumeFrame(const MergedFramePtr& frame) = 0;
+    virtual ~MergedFrameConsumer() { }
+};
+
+/// Combines the event lists sent by each digitiser for a frame into one time ordered frame.
+/// Messages are added from the event ingest thread of each digitiser and held by frame_number, with the
+/// GPS timestamp of the frame confirming that messages with the same frame_number are the same frame. A
+/// message whose timestamp matches a pending frame of another frame_number joins that frame, so one digitiser
+/// restarting its numbering does not split frames, and a message whose frame_number matches but timestamp
+/// does not is counted as mismatched and dropped.
+/// the merger thread emits frames in frame_number order once every active digitiser has sent
+/// the frame, the oldest pending frame has waited longer than the timeout, or more than the
+/// reorder window of frames are pending. The last two emit an incomplete frame. A message arriving
+/// for a frame already emitted is late and dropped, a frame_number far below the last emitted
+/// is taken as a restart of numbering. A digitiser is active if it has sent a message within
+/// the last ten timeouts, so a stopped digitiser only delays frames for a short while.
+/// Events of each message are expected to be in time order, a message that is not is sorted
+/// before the k-way merge. Channel numbers are passed through, as dev2 channels are numbers rather
+/// than indices, unless a channel stride is set: channels then become digitizer_id * stride + channel
+/// and events of channels at or above the stride are dropped and counted rather than overlapping the
+/// next digitiser.
+class FrameMerger : public EventConsumer
+{
+public:
+    struct Stats
+    {
+        uint64_t complete;
+        uint64_t incomplete;
+        uint64_t late;
+        uint64_t duplicate;
+        uint64_t restarts;
+        uint64_t renumbered; ///< messages added to a frame of another frame_number by timestamp
+        uint64_t mismatched; ///< messages dropped as their timestamp differs from the frame of that frame_number
+        uint64_t events;
+        uint64_t bad_channel; ///< events dropped as their channel is not below the channel stride
+        size_t pending;
+        size_t ndigitisers; ///< active digitisers
+        Stats() : complete(0), incomplete(0), late(0), duplicate(0), restarts(0), renumbered(0), mismatched(0), events(0),
+                  bad_channel(0), pending(0), ndigitisers(0) { }
+    };
+
+    FrameMerger(size_t window = 16, double timeout = 0.5, uint32_t channel_stride = 0);
+    void enable(bool enabled);
+    bool enabled() const { return m_enabled; }
+    void setWindow(size_t window);
+    void setTimeout(double timeout);
+    /// 0 to pass digitiser channel numbers through
+    void setChannelStride(uint32_t stride) { m_channelStride = stride; }
+    void addConsumer(MergedFrameConsumer* consumer);
+    /// merged frames are also republished as dev2 messages with this digitizer_id
+    Republisher& republisher() { return m_republisher; }
+    void consumeEvents(const EventMessagePtr& msg);
+    Stats stats();
+    void resetStats();
+    void report(FILE* fp);
+
+    static const uint8_t MERGED_DIGITIZER_ID = 255;
+
+private:
+    struct Pending
+    {
+        uint32_t frame_number;
+        double arrived; // when the first message for the frame was added
+        bool has_time;
+        double time; // GPS timestamp of the first message with one, seconds since the POSIX epoch
+        bool complete; // set when the frame is emitted
+        std::set<int> digitisers;
+        std::vector<EventMessagePtr> parts;
+        Pending() : frame_number(0), arrived(0.0), has_time(false), time(0.0), complete(false) { }
+    };
+
+    std::atomic<bool> m_enabled;
+    std::atomic<uint32_t> m_channelStride;
+    epicsMutex m_lock; // protects members below
+    epicsEvent m_wakeup;
+    size_t m_window;
+    double m_timeout;
+    std::map<uint32_t, Pending> m_pending;
+    std::vector<Pending> m_flush; // frames pending at a restart, emitted before anything else
+    std::map<int, double> m_lastSeen; // time each digitiser last sent a message
+    bool m_emitted; // m_lastEmitted is valid
+    uint32_t m_lastEmitted;
+    Stats m_stats;
+    epicsMutex m_consumersLock;
+    std::vector<MergedFrameConsumer*> m_consumers;
+    Republisher m_republisher;
+
+    static void mergeThreadC(void* arg);
+    void mergeThread();
+    size_t activeDigitisers(double now);
+    std::map<uint32_t, Pending>::iterator findByTime(double time);
+    void collectReady(std::vector<Pending>& ready);
+    MergedFramePtr merge(Pending& pending);
+    void publish(const MergedFrame& frame);
+};
+
+#endif /* FRAMEMERGER_H */
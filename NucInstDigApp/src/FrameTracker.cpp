@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include <epicsTime.h>
+#include <epicsGuard.h>
+
+#include "FrameTracker.h"
+
+FrameTracker::FrameTracker(size_t window, size_t nlatency) : m_window(window), m_nlatency(nlatency), m_latencyNext(0)
+{
+}
+
+double FrameTracker::gpsTimeToPosix(const GpsTime& gps)
+{
+    // days from 1970 to 1st January of year, counting leap days in the years before it
+    long year = 2000 + gps.year();
+    long days = 365 * (year - 1970) + (year - 1969) / 4 - (year - 1901) / 100 + (year - 1601) / 400;
+    days += gps.day() - 1;
+    return days * 86400.0 + gps.hour() * 3600.0 + gps.minute() * 60.0 + gps.second() +
+           gps.millisecond() / 1.0e3 + gps.microsecond() / 1.0e6 + gps.nanosecond() / 1.0e9;
+}
+
+void FrameTracker::frame(int digitizer_id, const FrameMetadataV2* metadata)
+{
+    epicsTimeStamp now_ts;
+    epicsTimeGetCurrent(&now_ts);
+    double now = static_cast<double>(now_ts.secPastEpoch) + POSIX_TIME_AT_EPICS_EPOCH + now_ts.nsec / 1.0e9;
+    uint32_t frame = metadata->frame_number();
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (metadata->timestamp() != NULL)
+    {
+        double latency = now - gpsTimeToPosix(*(metadata->timestamp()));
+        if (m_latency.size() < m_nlatency)
+        {
+            m_latency.push_back(latency);
+        }
+        else
+        {
+            m_latency[m_latencyNext] = latency;
+        }
+        m_latencyNext = (m_latencyNext + 1) % m_nlatency;
+    }
+    std::map<int, Digitiser>::iterator it = m_digitisers.find(digitizer_id);
+    if (it == m_digitisers.end())
+    {
+        Digitiser& d = m_digitisers[digitizer_id];
+        ++d.stats.frames;
+        d.highest = frame;
+        d.seen.insert(frame);
+        return;
+    }
+    Digitiser& d = it->second;
+    ++d.stats.frames;
+    if (frame > d.highest)
+    {
+        d.stats.missing += frame - d.highest - 1;
+        d.highest = frame;
+        d.seen.insert(frame);
+        while(!d.seen.empty() && *(d.seen.begin()) + m_window < d.highest)
+        {
+            d.seen.erase(d.seen.begin());
+        }
+    }
+    else if (d.highest - frame > m_window)
+    {
+        ++d.stats.restarts;
+        d.highest = frame;
+        d.seen.clear();
+        d.seen.insert(frame);
+    }
+    else if (!d.seen.insert(frame).second)
+    {
+        ++d.stats.duplicate;
+    }
+    else
+    {
+        ++d.stats.out_of_order;
+        if (d.stats.missing > 0)
+        {
+            --d.stats.missing; // counted as missing when a later frame arrived
+        }
+    }
+}
+
+FrameTracker::Stats FrameTracker::totals()
+{
+    Stats totals;
+    epicsGuard<epicsMutex> _lock(m_lock);
+    for(std::map<int, Digitiser>::const_iterator it = m_digitisers.begin(); it != m_digitisers.end(); ++it)
+    {
+        const Stats& s = it->second.stats;
+        totals.frames += s.frames;
+        totals.missing += s.missing;
+        totals.duplicate += s.duplicate;
+        totals.out_of_order += s.out_of_order;
+        totals.restarts += s.restarts;
+    }
+    return totals;
+}
+
+FrameTracker::Latency FrameTracker::latency()
+{
+    Latency l;
+    std::vector<double> latency;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        latency = m_latency;
+    }
+    if (latency.empty())
+    {
+        return l;
+    }
+    std::sort(latency.begin(), latency.end());
+    l.n = latency.size();
+    l.p50 = latency[(l.n - 1) * 50 / 100];
+    l.p90 = latency[(l.n - 1) * 90 / 100];
+    l.p99 = latency[(l.n - 1) * 99 / 100];
+    l.max = latency.back();
+    return l;
+}
+
+void FrameTracker::reset()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_digitisers.clear();
+    m_latency.clear();
+    m_latencyNext = 0;
+}
+
+void FrameTracker::report(FILE* fp, const char* name)
+{
+    Latency l = latency();
+    epicsGuard<epicsMutex> _lock(m_lock);
+    fprintf(fp, "  %s frames: latency (s) p50 %.4f p90 %.4f p99 %.4f max %.4f over %d frames\n",
+            name, l.p50, l.p90, l.p99, l.max, static_cast<int>(l.n));
+    fprintf(fp, "    %5s %12s %10s %10s %12s %8s %10s\n", "dig", "frames", "missing", "duplicate", "out_of_order", "restarts", "last");
+    for(std::map<int, Digitiser>::const_iterator it = m_digitisers.begin(); it != m_digitisers.end(); ++it)
+    {
+        const Stats& s = it->second.stats;
+        fprintf(fp, "    %5d %12llu %10llu %10llu %12llu %8llu %10u\n", it->first, (unsigned long long)s.frames,
+                (unsigned long long)s.missing, (unsigned long long)s.duplicate, (unsigned long long)s.out_of_order,
+                (unsigned long long)s.restarts, it->second.highest);
+    }
+}
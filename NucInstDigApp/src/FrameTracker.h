@@ -0,0 +1,71 @@
+#ifndef FRAMETRACKER_H
+#define FRAMETRACKER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <epicsMutex.h>
+
+#include <flatbuffers/flatbuffers.h>
+#include "frame_metadata_v2_generated.h"
+
+/// Tracks frame_number continuity and end to end latency of a stream of messages, each
+/// digitiser is tracked separately. A frame is missing if a later frame has arrived but it has not,
+/// it stops being missing (and becomes out of order) if it arrives within the window of recent frames.
+/// Every frame skipped by a forward jump is missing, however long the gap (e.g. a network outage).
+/// A frame_number more than the window below the highest seen is taken as a restart of numbering,
+/// e.g. a new run, rather than as out of order.
+/// Latency is the host clock when frame() is called minus the frame's GPS timestamp.
+class FrameTracker
+{
+public:
+    struct Stats
+    {
+        uint64_t frames;
+        uint64_t missing;
+        uint64_t duplicate;
+        uint64_t out_of_order;
+        uint64_t restarts;
+        Stats() : frames(0), missing(0), duplicate(0), out_of_order(0), restarts(0) { }
+    };
+
+    /// percentiles in seconds of the last nlatency frames
+    struct Latency
+    {
+        double p50;
+        double p90;
+        double p99;
+        double max;
+        size_t n;
+        Latency() : p50(0.0), p90(0.0), p99(0.0), max(0.0), n(0) { }
+    };
+
+    FrameTracker(size_t window = 1024, size_t nlatency = 1000);
+    void frame(int digitizer_id, const FrameMetadataV2* metadata);
+    Stats totals();
+    Latency latency();
+    void reset();
+    void report(FILE* fp, const char* name);
+    /// GPS timestamp as seconds since the POSIX epoch
+    static double gpsTimeToPosix(const GpsTime& gps);
+
+private:
+    struct Digitiser
+    {
+        Stats stats;
+        uint32_t highest; // highest frame number seen
+        std::set<uint32_t> seen; // recent frame numbers, up to window below highest
+    };
+
+    size_t m_window;
+    size_t m_nlatency;
+    epicsMutex m_lock; // protects members below
+    std::map<int, Digitiser> m_digitisers;
+    std::vector<double> m_latency; // ring buffer of latencies
+    size_t m_latencyNext;
+};
+
+#endif /* FRAMETRACKER_H */
@@ -10,15 +10,25 @@
 #include <sstream>
 #include <fstream>
 #include <map>
+#include <set>
+#include <queue>
+#include <deque>
 #include <vector>
+#include <future>
 #include <iomanip>
 #include <sys/timeb.h>
 #include <numeric>
+#include <algorithm>
 #include <atomic>
+#include <memory>
+#include <limits>
 #include <boost/algorithm/string.hpp>
 
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
+#include <rapidjson/reader.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/error/en.h>
 
 #include <zmq.hpp>
 #include <flatbuffers/flatbuffers.h>
@@ -44,6 +54,21 @@
 #include "utilities.h"
 #include "pugixml.hpp"
 
+#include "NucInstDigBinary.h"
+#include "EventHistogram.h"
+#include "FrameTracker.h"
+#include "Republisher.h"
+#include "EventMessage.h"
+#include "EventFilter.h"
+#include "FrameMerger.h"
+#include "CoincidenceDetector.h"
+#include "Asymmetry.h"
+#include "TraceEnvelope.h"
+#include "TraceAverager.h"
+#include "TraceHistory.h"
+#include "PulseFinder.h"
+#include "PulseMatcher.h"
+#include "SPSCRing.h"
 #include "NucInstDig.h"
 #include <epicsExport.h>
 
@@ -165,6 +190,57 @@ asynStatus NucInstDig::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
         {
             return ADDriver::writeFloat64(pasynUser, value);
         }
+        else if (function == P_DCSpectraPeriod) {
+            m_DCSpectraTimer.setPeriod(value);
+        }
+        else if (function == P_TOFSpectraPeriod) {
+            m_TOFSpectraTimer.setPeriod(value);
+        }
+        else if (function == P_tracesPeriod) {
+            m_tracesTimer.setPeriod(value);
+        }
+        else if (function == P_TOFHistTMin) {
+            m_TOFHistTMin = value;
+            configureTOFHistogram();
+        }
+        else if (function == P_TOFHistTMax) {
+            m_TOFHistTMax = value;
+            configureTOFHistogram();
+        }
+        else if (function == P_pulseHeightVMin) {
+            m_pulseHeightVMin = value;
+            configurePulseHeight();
+        }
+        else if (function == P_pulseHeightVMax) {
+            m_pulseHeightVMax = value;
+            configurePulseHeight();
+        }
+        else if (function == P_mergeTimeout) {
+            frameMerger().setTimeout(value);
+        }
+        else if (function == P_eventsFilterTMin || function == P_eventsFilterTMax) {
+            double tmin = 0.0, tmax = 0.0;
+            getDoubleParam(P_eventsFilterTMin, &tmin);
+            getDoubleParam(P_eventsFilterTMax, &tmax);
+            (function == P_eventsFilterTMin ? tmin : tmax) = value;
+            m_eventFilter.setTimeWindow(tmin, tmax);
+        }
+        else if (function == P_pulseFindFraction) {
+            m_pulseFinder.setFraction(value);
+        }
+        else if (function == P_pulseMatchWindow) {
+            m_pulseMatchWindow = value;
+            configurePulseMatcher();
+        }
+        else if (function == P_coincWindow) {
+            m_coincidence.setWindow(value);
+        }
+        else if (function == P_asymAlpha) {
+            m_asymmetry.setAlpha(value);
+        }
+        else if (function == P_traceStreamRate) {
+            m_traceStreamRate = value;
+        }
         else
         {
             auto it = m_param_data.find(function);
@@ -208,6 +284,7 @@ asynStatus NucInstDig::writeInt32(asynUser *pasynUser, epicsInt32 value)
         if (function == ADAcquire)
         {
             setADAcquire(addr, value);
+            m_updateADEvent.signal();
             // fall through to next line to call base class
         }
         if (function < FIRST_NUCINSTDIG_PARAM)
@@ -227,7 +304,103 @@ asynStatus NucInstDig::writeInt32(asynUser *pasynUser, epicsInt32 value)
             executeCmd("reset_darkcount_spectra", "");
         }
         else if (function == P_resetTOFSpectra) {
-            executeCmd("reset_tof_spectra", "");
+            m_TOFHistogram.reset();
+            m_TOFHistogramConsumer.resetCounts();
+            if (!m_TOFHistogramConsumer.enabled()) {
+                executeCmd("reset_tof_spectra", "");
+            }
+        }
+        else if (function == P_TOFSource) {
+            m_TOFHistogramConsumer.setMerged(value == 2);
+            m_TOFHistogramConsumer.enable(value != 0);
+            m_readTOFSpectraEvent.signal();
+        }
+        else if (function == P_TOFHistNSpec || function == P_TOFHistNBins) {
+            int nspec = m_TOFHistNSpec, nbins = m_TOFHistNBins;
+            (function == P_TOFHistNSpec ? nspec : nbins) = value;
+            checkHistogramSize(nspec, (m_TOFHistEdges.size() > 1 ? static_cast<int>(m_TOFHistEdges.size()) - 1 : nbins),
+                               m_numPeriods + 1); // + 1 for VETO_MODE SEPARATE
+            (function == P_TOFHistNSpec ? m_TOFHistNSpec : m_TOFHistNBins) = value;
+            configureTOFHistogram();
+        }
+        else if (function == P_resetFrameStats) {
+            m_frameTracker[0].reset();
+            m_frameTracker[1].reset();
+            if (m_mergeOwner) {
+                frameMerger().resetStats();
+            }
+            m_eventsRing.resetStats();
+            m_eventFilter.resetCounts();
+        }
+        else if (function == P_eventsFilter) {
+            m_eventFilter.enable(value != 0);
+        }
+        else if (function == P_eventsFilterChanMask) {
+            m_eventFilter.setChannelMask(static_cast<uint32_t>(value));
+        }
+        else if (function == P_eventsRingPolicy) {
+            m_eventsRing.setPolicy(value == EventRing::DropOldest ? EventRing::DropOldest : EventRing::Block);
+        }
+        else if (function == P_mergeEvents) {
+            frameMerger().enable(value != 0);
+        }
+        else if (function == P_mergeWindow) {
+            frameMerger().setWindow(value > 0 ? value : 1);
+        }
+        else if (function == P_mergeNChan) {
+            frameMerger().setChannelStride(value > 0 ? value : 0);
+        }
+        else if (function == P_numPeriods) {
+            checkHistogramSize(m_TOFHistNSpec, (m_TOFHistEdges.size() > 1 ? static_cast<int>(m_TOFHistEdges.size()) - 1 : m_TOFHistNBins),
+                               value + 1); // + 1 for VETO_MODE SEPARATE
+            m_numPeriods = value;
+            configurePeriods();
+        }
+        else if (function == P_vetoMask) {
+            m_vetoMask = value;
+            configurePeriods();
+        }
+        else if (function == P_vetoMode) {
+            m_vetoMode = value;
+            configurePeriods();
+        }
+        else if (function == P_coinc) {
+            m_coincidence.enable(value != 0);
+        }
+        else if (function == P_coincSource) {
+            m_coincidence.setMerged(value == 1);
+        }
+        else if (function == P_coincNChan) {
+            m_coincidence.setChannels(value > 0 ? value : 1);
+        }
+        else if (function == P_coincOutput) {
+            m_coincidence.setOutput(value == CoincidenceDetector::OutputCoincident ? CoincidenceDetector::OutputCoincident :
+                          (value == CoincidenceDetector::OutputAnticoincident ? CoincidenceDetector::OutputAnticoincident :
+                           CoincidenceDetector::OutputNone));
+        }
+        else if (function == P_coincReset) {
+            m_coincidence.reset();
+        }
+        else if (function == P_asymBgFirst || function == P_asymBgLast) {
+            int first = 0, last = -1;
+            getIntegerParam(P_asymBgFirst, &first);
+            getIntegerParam(P_asymBgLast, &last);
+            (function == P_asymBgFirst ? first : last) = value;
+            m_asymmetry.setBackground(first, last);
+        }
+        else if (function == P_pulseHeight) {
+            m_pulseHeightConsumer.enable(value != 0);
+            m_updateADEvent.signal();
+        }
+        else if (function == P_resetPulseHeight) {
+            m_pulseHeight.reset();
+        }
+        else if (function == P_pulseHeightNChan || function == P_pulseHeightNBins) {
+            int nchan = m_pulseHeightNChan, nbins = m_pulseHeightNBins;
+            (function == P_pulseHeightNChan ? nchan : nbins) = value;
+            checkHistogramSize(nchan, nbins, 1);
+            (function == P_pulseHeightNChan ? m_pulseHeightNChan : m_pulseHeightNBins) = value;
+            configurePulseHeight();
         }
         else if (function == P_configDGTZ) {
             executeCmd("configure_dgtz", "");
@@ -244,6 +417,108 @@ asynStatus NucInstDig::writeInt32(asynUser *pasynUser, epicsInt32 value)
         else if (function == P_setup) {
             setup();
         }
+        else if (function == P_paramBatchSize) {
+            m_paramBatchSize = value;
+            m_paramBatchSupported = true; // try again, digitiser firmware may have been updated
+        }
+        else if (function == P_readDCSpectra) {
+            m_readDCSpectraEvent.signal();
+            m_updateADEvent.signal();
+        }
+        else if (function == P_readTOFSpectra) {
+            m_readTOFSpectraEvent.signal();
+            m_updateADEvent.signal();
+        }
+        else if (function == P_readTraces) {
+            m_readTracesEvent.signal();
+        }
+        else if (function == P_traceStream) {
+            m_traceStream = (value != 0);
+            m_traceStreamEvent.signal();
+        }
+        else if (function == P_traceStreamNPts) {
+            m_traceStreamNPts = std::max(value, 0);
+        }
+        else if (function == P_traceAvg || function == P_traceAvgNFrames) {
+            int mode = value, nframes = value;
+            getIntegerParam(function == P_traceAvg ? P_traceAvgNFrames : P_traceAvg, (function == P_traceAvg ? &nframes : &mode));
+            m_traceAverager.setMode(mode, nframes);
+            m_traceStreamReconfigure = true;
+        }
+        else if (function == P_traceAvgReset) {
+            m_traceAverager.reset();
+        }
+        else if (function == P_traceHist) {
+            m_traceHistory.setEnabled(value != 0);
+        }
+        else if (function == P_traceHistNFrames || function == P_traceHistNChan || function == P_traceHistNPts ||
+                 function == P_traceHistNPre || function == P_traceHistNPost) {
+            value = std::max(value, (function == P_traceHistNPre || function == P_traceHistNPost ? 0 : 1));
+            int nframes = m_traceHistNFrames, nchan = m_traceHistNChan, npts = m_traceHistNPts, npre = m_traceHistNPre, npost = m_traceHistNPost;
+            (function == P_traceHistNFrames ? nframes : function == P_traceHistNChan ? nchan :
+             function == P_traceHistNPts ? npts : function == P_traceHistNPre ? npre : npost) = value;
+            TraceHistory::checkSize(nframes, nchan, npts, npre, npost); // throws, keeping the current history
+            (function == P_traceHistNFrames ? m_traceHistNFrames : function == P_traceHistNChan ? m_traceHistNChan :
+             function == P_traceHistNPts ? m_traceHistNPts : function == P_traceHistNPre ? m_traceHistNPre : m_traceHistNPost) = value;
+            configureTraceHistory();
+        }
+        else if (function == P_traceHistTrig || function == P_traceHistTrigChan || function == P_traceHistTrigLevel) {
+            int trigger = TraceHistory::TriggerNone, chan = -1, level = 0;
+            getIntegerParam(P_traceHistTrig, &trigger);
+            getIntegerParam(P_traceHistTrigChan, &chan);
+            getIntegerParam(P_traceHistTrigLevel, &level);
+            (function == P_traceHistTrig ? trigger : function == P_traceHistTrigChan ? chan : level) = value;
+            m_traceHistory.setAmplitudeTrigger(trigger, chan, level);
+        }
+        else if (function == P_pulseFind) {
+            m_pulseFinder.enable(value != 0);
+            m_pulseMatcher.enable(value != 0);
+            m_traceStreamReconfigure = true;
+        }
+        else if (function == P_pulseFindMode) {
+            m_pulseFinder.setMode(value);
+        }
+        else if (function == P_pulseFindPolarity) {
+            m_pulseFinder.setPolarity(value);
+        }
+        else if (function == P_pulseFindThreshold) {
+            m_pulseFinder.setThreshold(value);
+        }
+        else if (function == P_pulseFindBaseline) {
+            m_pulseFinder.setBaselineSamples(value);
+        }
+        else if (function == P_pulseMatchNChan || function == P_pulseMatchNBins) {
+            value = std::max(value, 1);
+            PulseMatcher::checkSize((function == P_pulseMatchNChan ? value : m_pulseMatchNChan),
+                                    (function == P_pulseMatchNBins ? value : m_pulseMatchNBins));
+            (function == P_pulseMatchNChan ? m_pulseMatchNChan : m_pulseMatchNBins) = value;
+            configurePulseMatcher();
+        }
+        else if (function == P_pulseMatchReset) {
+            m_pulseMatcher.reset();
+        }
+        else if (function == P_traceHistArm) {
+            m_traceHistory.arm(value != 0);
+        }
+        else if (function == P_traceHistTrigger) {
+            m_traceHistory.trigger();
+        }
+        else if (function == P_readEvents) {
+            m_readEventsEvent.signal();
+        }
+        else if (function == P_eventsHWM) {
+            m_eventsHWM = value;
+            m_eventsReconfigure = true;
+        }
+        else if (function == P_eventsLossless) {
+            m_eventsLossless = (value != 0);
+            m_eventsReconfigure = true;
+        }
+        else if (function == P_readBinary) {
+            m_readBinary = (value != 0);
+            m_readBinarySupported = true;
+            m_readBinaryConfirmed = false;
+        }
         else if (function >= P_DCSpecIdx[0] && function <= P_DCSpecIdx[3]) {
             int idx = function - P_DCSpecIdx[0];
             m_DCSpecIdx[idx] = value;
@@ -299,6 +574,149 @@ asynStatus NucInstDig::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value
     return stat;
 }
 
+asynStatus NucInstDig::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements)
+{
+    const char* functionName = "writeFloat64Array";
+    const char *paramName = NULL;
+	int function = pasynUser->reason;
+	if (function < FIRST_NUCINSTDIG_PARAM)
+	{
+		return ADDriver::writeFloat64Array(pasynUser, value, nElements);
+	}
+	getParamName(function, &paramName);
+    try {
+        if (function == P_TOFHistEdges) {
+            m_TOFHistEdges.assign(value, value + nElements);
+            configureTOFHistogram();
+        }
+        else if (function == P_eventsFilterVMin) {
+            m_eventFilter.setVoltageMin(std::vector<double>(value, value + nElements));
+        }
+        else if (function == P_eventsFilterVMax) {
+            m_eventFilter.setVoltageMax(std::vector<double>(value, value + nElements));
+        }
+        else if (function == P_coincPairs) {
+            m_coincidence.setPairs(std::vector<double>(value, value + nElements));
+        }
+        else if (function == P_asymGrouping) {
+            m_asymmetry.setGrouping(std::vector<double>(value, value + nElements));
+            updateAsymmetryGrouping();
+        }
+        setStringParam(P_error, "");
+        callParamCallbacks();
+        doCallbacksFloat64Array(value, nElements, function, 0);
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
+              "%s:%s: function=%d, name=%s, nElements=%d\n", 
+              driverName, functionName, function, paramName, (int)nElements);
+        return asynSuccess;
+    }
+    catch(const std::exception& ex)
+    {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
+                  "%s:%s: function=%d, name=%s, nElements=%d, error=%s", 
+                  driverName, functionName, function, paramName, (int)nElements, ex.what());
+        setStringParam(P_error, ex.what());
+        callParamCallbacks();
+        return asynError;
+    }
+}
+
+// throws if an event histogram would be empty or too large, so a rejected setting leaves the histogram as it was
+void NucInstDig::checkHistogramSize(int nchan, int nbins, int nperiods)
+{
+    if (nchan < 1 || nbins < 1 || nperiods < 1) {
+        throw std::runtime_error("histogram channels, bins and periods must be at least 1");
+    }
+    EventHistogram::checkSize(nchan, nbins, nperiods);
+}
+
+// set up m_TOFHistogram from the TOF_HIST_* parameters, events are in ns
+void NucInstDig::configureTOFHistogram()
+{
+    if (m_TOFHistEdges.size() > 1) {
+        m_TOFHistogram.setBinEdges(m_TOFHistNSpec, m_TOFHistEdges);
+    } else {
+        m_TOFHistogram.setBinning(m_TOFHistNSpec, m_TOFHistTMin, m_TOFHistTMax, m_TOFHistNBins);
+    }
+}
+
+// split the event TOF histogram into NUM_PERIODS periods, clears it
+void NucInstDig::configurePeriods()
+{
+    m_TOFHistogramConsumer.setPeriods(m_numPeriods, static_cast<uint16_t>(m_vetoMask),
+                                      static_cast<HistogramEventConsumer::VetoMode>(m_vetoMode));
+}
+
+// publish the frame and proton counts of the event TOF histogram
+void NucInstDig::updatePeriodCounts()
+{
+    std::vector<double> good_frames, protons;
+    uint64_t raw_frames = 0, vetoed_frames = 0, current_period = 0;
+    m_TOFHistogramConsumer.getCounts(good_frames, protons, raw_frames, vetoed_frames, current_period);
+    epicsGuard<NucInstDig> _lock(*this);
+    m_periodGoodFrames.swap(good_frames);
+    m_periodProtonCharge.swap(protons);
+    setIntegerParam(P_currentPeriod, static_cast<int>(current_period));
+    setIntegerParam(P_rawFrames, static_cast<int>(raw_frames));
+    setIntegerParam(P_vetoedFrames, static_cast<int>(vetoed_frames));
+    setIntegerParam(P_goodFrames, static_cast<int>(std::accumulate(m_periodGoodFrames.begin(), m_periodGoodFrames.end(), 0.0)));
+    setDoubleParam(P_protonCharge, std::accumulate(m_periodProtonCharge.begin(), m_periodProtonCharge.end(), 0.0));
+    callParamCallbacks();
+    doCallbacksFloat64Array(m_periodGoodFrames.data(), m_periodGoodFrames.size(), P_periodGoodFrames, 0);
+    doCallbacksFloat64Array(m_periodProtonCharge.data(), m_periodProtonCharge.size(), P_periodProtonCharge, 0);
+}
+
+// publish the forward and backward group sizes, called with the driver locked
+void NucInstDig::updateAsymmetryGrouping()
+{
+    size_t nforward = 0, nbackward = 0;
+    m_asymmetry.groupSizes(nforward, nbackward);
+    setIntegerParam(P_asymNFwd, static_cast<int>(nforward));
+    setIntegerParam(P_asymNBwd, static_cast<int>(nbackward));
+    m_asymmetry.getGrouping(m_asymGrouping);
+    doCallbacksFloat64Array(m_asymGrouping.data(), m_asymGrouping.size(), P_asymGrouping, 0);
+}
+
+// asymmetry of the latest TOF spectra, x is the bin number as for TOFSPEC%dX
+void NucInstDig::updateAsymmetry(const Data2d<epicsUInt32>& spectra)
+{
+    m_asymmetry.compute(spectra.data.data(), spectra.nspec, spectra.npts, m_asymResult);
+    epicsGuard<NucInstDig> _lock(*this);
+    if (m_asymX.size() != spectra.npts) {
+        m_asymX.resize(spectra.npts);
+        std::iota(m_asymX.begin(), m_asymX.end(), 0.0);
+    }
+    setDoubleParam(P_asymFwdTotal, m_asymResult.forward_total);
+    setDoubleParam(P_asymBwdTotal, m_asymResult.backward_total);
+    setDoubleParam(P_asymIntegral, m_asymResult.integral);
+    setDoubleParam(P_asymIntegralErr, m_asymResult.integral_error);
+    callParamCallbacks();
+    doCallbacksFloat64Array(m_asymX.data(), m_asymX.size(), P_asymX, 0);
+    doCallbacksFloat64Array(m_asymResult.asymmetry.data(), m_asymResult.asymmetry.size(), P_asymY, 0);
+    doCallbacksFloat64Array(m_asymResult.error.data(), m_asymResult.error.size(), P_asymE, 0);
+    doCallbacksFloat64Array(m_asymResult.forward.data(), m_asymResult.forward.size(), P_asymFwd, 0);
+    doCallbacksFloat64Array(m_asymResult.backward.data(), m_asymResult.backward.size(), P_asymBwd, 0);
+}
+
+// set up m_pulseHeight from the PULSE_HEIGHT_* parameters, voltages are in ADC units
+void NucInstDig::configurePulseHeight()
+{
+    m_pulseHeight.setBinning(m_pulseHeightNChan, m_pulseHeightVMin, m_pulseHeightVMax, m_pulseHeightNBins);
+}
+
+// reallocates the trace history, so any capture is lost
+void NucInstDig::configureTraceHistory()
+{
+    m_traceHistory.configure(m_traceHistNFrames, m_traceHistNChan, m_traceHistNPts, m_traceHistNPre, m_traceHistNPost);
+    m_traceHistPublished = 0;
+}
+
+// clears the comparison
+void NucInstDig::configurePulseMatcher()
+{
+    m_pulseMatcher.configure(m_pulseMatchNChan, m_pulseMatchWindow, m_pulseMatchNBins);
+}
+
 asynStatus NucInstDig::readInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements, size_t *nIn)
 {
 	int function = pasynUser->reason;
@@ -425,6 +843,15 @@ asynStatus NucInstDig::writeOctet(asynUser *pasynUser, const char *value, size_t
         {
             ; // fall through to just update asyn parameter
         }
+        else if (function == P_asymGroupingFile)
+        {
+            if (!value_s.empty())
+            {
+                m_asymmetry.loadGrouping(value_s);
+                setDoubleParam(P_asymAlpha, m_asymmetry.alpha());
+                updateAsymmetryGrouping();
+            }
+        }
         else
         {
             auto it = m_param_data.find(function);
@@ -466,58 +893,157 @@ asynStatus NucInstDig::writeOctet(asynUser *pasynUser, const char *value, size_t
 }
 
 
+// streamed traces, receives dat2 messages while TRACE_STREAM is 1. The traces chosen by TRACE%dIDX are
+// published as min/max envelopes of at most TRACE_STREAM_NPTS buckets, no more than TRACE_STREAM_RATE
+// times a second (every message if 0). Full resolution traces (m_traces and the traces NDArray) are only updated from the
+// next message after READ_TRACES or its refresh timer asks for them.
+// With TRACE_AVG set every message is added to m_traceAverager, and the averages are published in place
+// of the latest traces. With PULSE_FIND set the pulses of every message are found and compared with the
+// events of the frame. For either the socket is no longer conflated so no frame is missed.
 void NucInstDig::updateTraces()
 {
-    static const double TRACE_UPDATE_TIME = atof(getenv("TRACE_UPDATE_TIME") != NULL ? getenv("TRACE_UPDATE_TIME") : "1.0");
-#ifdef PULL_TRACES
+    epicsTimeStamp last_publish, now;
+    epicsTimeGetCurrent(&last_publish);
+    std::vector<double> trace_x[4], trace_y[4]; // own copies, updateTracesOnRequest() may be publishing while TRACE_STREAM changes
+    bool average_pending = false; // an average is ready but not yet published
     while(true)
     {
-        epicsThreadSleep(TRACE_UPDATE_TIME);
+        if (!m_traceStream) {
+            m_traceStreamEvent.wait(1.0);
+            continue;
+        }
         try {
+            if (m_traceStreamReconfigure.exchange(false)) {
+                m_zmq_stream.setOptions(0, !(m_traceAverager.enabled() || m_pulseFinder.enabled()));
+                average_pending = false;
+            }
             zmq::message_t reply{};
             zmq::recv_result_t nbytes = m_zmq_stream.recv(reply, zmq::recv_flags::none);
             if (!nbytes || *nbytes == 0)
             {
-                epicsThreadSleep(0.5);
+                continue; // receive timeout
+            }
+            flatbuffers::Verifier verifier(static_cast<const uint8_t*>(reply.data()), reply.size());
+            if (!VerifyDigitizerAnalogTraceMessageBuffer(verifier)) {
+                ++m_traceStreamNDropped;
                 continue;
             }
             auto msg = GetDigitizerAnalogTraceMessage(reply.data());
+            ++m_traceStreamNMsgs;
+            m_frameTracker[1].frame(msg->digitizer_id(), msg->metadata());
             auto channels = msg->channels();
-            for(int i=0; i<channels->size(); ++i) {
-                int chan = channels->Get(i)->channel();
-                auto voltages = channels->Get(i)->voltage();
-                {
-                    epicsGuard<epicsMutex> _lock(m_tracesLock);
-                    m_nVoltage = voltages->size();
-                    m_traces.resize(m_NTRACE * m_nVoltage);
-                    if (chan < m_NTRACE) {
-                        for(int k=0; k<m_nVoltage; ++k) {
-                            m_traces[chan * m_nVoltage + k] = voltages->Get(k);
-                        }
+            if (channels == NULL) {
+                continue;
+            }
+            if (m_tracesRepublisher.enabled()) {
+                uint32_t chan_min = 0, chan_max = UINT32_MAX;
+                if (m_tracesRepublisher.filtersChannels() && channels->size() > 0) {
+                    chan_min = UINT32_MAX;
+                    chan_max = 0;
+                    for(int i=0; i<channels->size(); ++i) {
+                        chan_min = std::min(chan_min, channels->Get(i)->channel());
+                        chan_max = std::max(chan_max, channels->Get(i)->channel());
                     }
                 }
-                for(size_t j=0; j<4; ++j) {
-                    if (chan == m_traceIdx[j]) {
-                        m_traceX[j].resize(m_nVoltage);
-                        m_traceY[j].resize(m_nVoltage);
-                        for(int k=0; k<m_nVoltage; ++k) {
-                           m_traceX[j][k] = k;
-                           m_traceY[j][k] = m_traces[chan * m_nVoltage + k];
-                        }
+                m_tracesRepublisher.publish(reply, msg->digitizer_id(), chan_min, chan_max);
+            }
+            if (m_traceHistory.enabled()) {
+                m_traceHistory.beginFrame(msg->metadata() != NULL ? msg->metadata()->frame_number() : 0);
+                for(int i=0; i<channels->size(); ++i) {
+                    auto voltages = channels->Get(i)->voltage();
+                    if (voltages != NULL) {
+                        m_traceHistory.add(channels->Get(i)->channel(), voltages->data(), voltages->size());
                     }
                 }
+                if (m_traceHistory.endFrame()) {
+                    m_updateADEvent.signal();
+                }
             }
-            {
-                epicsGuard<NucInstDig> _lock(*this);
+            if (m_pulseFinder.enabled() && msg->metadata() != NULL) {
+                double sample_ns = (msg->sample_rate() > 0 ? 1.0e9 / msg->sample_rate() : 1.0);
+                for(int i=0; i<channels->size(); ++i) {
+                    auto voltages = channels->Get(i)->voltage();
+                    if (voltages != NULL) {
+                        m_pulseFinder.find(channels->Get(i)->channel(), voltages->data(), voltages->size(), sample_ns, m_tracePulses);
+                    }
+                }
+                m_pulseMatcher.addPulses(msg->digitizer_id(), msg->metadata()->frame_number(), m_tracePulses);
+                m_tracePulses.clear();
+            }
+            bool averaging = m_traceAverager.enabled();
+            if (averaging) {
+                m_traceFullRequest = false; // the averages are published to m_traces instead
+                for(int i=0; i<channels->size(); ++i) {
+                    auto voltages = channels->Get(i)->voltage();
+                    if (voltages != NULL) {
+                        m_traceAverager.add(channels->Get(i)->channel(), voltages->data(), voltages->size());
+                    }
+                }
+                if (m_traceAverager.endFrame()) {
+                    average_pending = true;
+                }
+            }
+            else if (m_traceFullRequest.exchange(false)) {
+                // a message may not contain all channels, so start from the current traces
+                TracesBuffer::Writer traces(m_traces, true);
+                for(int i=0; i<channels->size(); ++i) {
+                    int chan = channels->Get(i)->channel();
+                    auto voltages = channels->Get(i)->voltage();
+                    if (voltages == NULL) {
+                        continue;
+                    }
+                    size_t nVoltage = voltages->size();
+                    if (traces->npts != nVoltage) {
+                        traces->npts = nVoltage;
+                        traces->data.assign(traces->nspec * nVoltage, 0);
+                    }
+                    if (chan < traces->nspec) {
+                        std::copy(voltages->data(), voltages->data() + nVoltage, traces->data.begin() + chan * nVoltage);
+                    }
+                }
+                traces.publish();
+                m_updateADEvent.signal();
+            }
+            double rate = m_traceStreamRate;
+            epicsTimeGetCurrent(&now);
+            if ((averaging && !average_pending) || (rate > 0.0 && epicsTimeDiffInSeconds(&now, &last_publish) < 1.0 / rate)) {
+                continue;
+            }
+            last_publish = now;
+            bool published[4] = { false, false, false, false };
+            if (averaging) {
+                average_pending = false;
+                {
+                    TracesBuffer::Writer traces(m_traces);
+                    m_traceAverager.averages(traces->data, traces->nspec, traces->npts);
+                    traces.publish();
+                }
+                m_updateADEvent.signal();
+                for(size_t j=0; j<4; ++j) {
+                    published[j] = (m_traceIdx[j] >= 0 && m_traceAverager.average(m_traceIdx[j], m_traceStreamNPts, trace_x[j], trace_y[j]));
+                }
+            }
+            for(int i=0; i<channels->size() && !averaging; ++i) {
+                int chan = channels->Get(i)->channel();
+                auto voltages = channels->Get(i)->voltage();
                 for(size_t j=0; j<4; ++j) {
-                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_traceX[j].data()), m_traceX[j].size(), P_traceX[j], 0);
-                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_traceY[j].data()), m_traceY[j].size(), P_traceY[j], 0);
+                    if (m_traceIdx[j] == chan && voltages != NULL) {
+                        traceEnvelope(voltages->data(), voltages->size(), m_traceStreamNPts, trace_x[j], trace_y[j]);
+                        published[j] = true;
+                    }
+                }
+            }
+            epicsGuard<NucInstDig> _lock(*this);
+            for(size_t j=0; j<4; ++j) {
+                if (published[j]) {
+                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(trace_x[j].data()), trace_x[j].size(), P_traceX[j], 0);
+                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(trace_y[j].data()), trace_y[j].size(), P_traceY[j], 0);
                 }
             }
         }
         catch(const std::exception& ex)
         {
-            std::cerr << "updaetTraces " << ex.what() << std::endl;
+            std::cerr << "updateTraces " << ex.what() << std::endl;
             epicsThreadSleep(3.0);
         }
         catch(...)
@@ -526,39 +1052,63 @@ void NucInstDig::updateTraces()
             epicsThreadSleep(3.0);
         }
     }
-#endif
 }
 
 void NucInstDig::updateTracesOnRequest()
 {
+    std::vector<double> trace_x[4], trace_y[4];
     while(true)
     {
         int read_traces = 0;
-        epicsThreadSleep(1.0);
+        m_readTracesEvent.wait(); // signalled by READ_TRACES or READ_TRACES_PERIOD timer
         lock();
         getIntegerParam(P_readTraces, &read_traces);
         setIntegerParam(P_readTraces, 0);
         unlock();
-        if (read_traces == 0) {
+        if (read_traces == 0 && m_tracesTimer.period() <= 0.0) {
+            continue;
+        }
+        if (m_traceStream) {
+            m_traceFullRequest = true; // taken from the next streamed message by updateTraces()
             continue;
         }
         try {
+            bool averaging = m_traceAverager.enabled();
             {
-                epicsGuard<epicsMutex> _lock(m_tracesLock);
-                readData2d("get_waveforms", "", m_traces, m_NTRACE, m_nVoltage);
+                TracesBuffer::Writer traces(m_traces);
+                readData2d("get_waveforms", "", traces->data, traces->nspec, traces->npts, 1);
+                if (averaging) {
+                    for(size_t i=0; i<traces->nspec; ++i) {
+                        m_traceAverager.add(i, traces->data.data() + i * traces->npts, traces->npts);
+                    }
+                    if (!m_traceAverager.endFrame()) {
+                        continue; // nothing is published until a block is complete
+                    }
+                    m_traceAverager.averages(traces->data, traces->nspec, traces->npts);
+                }
+                traces.publish();
             }
+            m_updateADEvent.signal();
+            TracesBuffer::Snapshot traces = m_traces.read();
             for(size_t j=0; j<4; ++j) {
                 int idx = m_traceIdx[j];
-                if (idx >= 0 && idx < m_NTRACE) {
-                    m_traceX[j].resize(m_nVoltage);
-                    m_traceY[j].resize(m_nVoltage);
-                    for(int k=0; k<m_nVoltage; ++k) {
-                       m_traceX[j][k] = k;
-                       m_traceY[j][k] = m_traces[idx * m_nVoltage + k];
+                if (averaging) {
+                    if (idx >= 0 && m_traceAverager.average(idx, 0, trace_x[j], trace_y[j])) {
+                        epicsGuard<NucInstDig> _lock2(*this);
+                        doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(trace_x[j].data()), trace_x[j].size(), P_traceX[j], 0);
+                        doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(trace_y[j].data()), trace_y[j].size(), P_traceY[j], 0);
+                    }
+                }
+                else if (idx >= 0 && idx < traces->nspec) {
+                    trace_x[j].resize(traces->npts);
+                    trace_y[j].resize(traces->npts);
+                    for(int k=0; k<traces->npts; ++k) {
+                       trace_x[j][k] = k;
+                       trace_y[j][k] = traces->data[idx * traces->npts + k];
                     }
                     epicsGuard<NucInstDig> _lock2(*this);
-                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_traceX[j].data()), m_traceX[j].size(), P_traceX[j], 0);
-                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_traceY[j].data()), m_traceY[j].size(), P_traceY[j], 0);
+                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(trace_x[j].data()), trace_x[j].size(), P_traceX[j], 0);
+                    doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(trace_y[j].data()), trace_y[j].size(), P_traceY[j], 0);
                 }
             }
         }
@@ -576,7 +1126,8 @@ void NucInstDig::updateTracesOnRequest()
 }
 
 // assumes data is a histogram with boundaries specified and equially spaces
-int NucInstDig::rebin(const double* data_in, double xmin_in, double xmax_in, int nin,
+template <typename T>
+int NucInstDig::rebin(const T* data_in, double xmin_in, double xmax_in, int nin,
                       double* data_out, double xmin_out, double xmax_out, int nout)
 {
     std::fill(data_out, data_out + nout, 0.0);
@@ -642,7 +1193,7 @@ void NucInstDig::updateAD()
 	while(true)
 	{
 		all_acquiring = all_enable = 0;
-		for(int i=0; i<maxAddr; ++i) // we use maxAddr but upper 3 just forward combined spectra NDarrays and are not enabled here
+		for(int i=0; i<maxAddr; ++i) // addr 3,4,5 just forward combined spectra NDarrays and are not enabled here
 		{
 		    epicsGuard<NucInstDig> _lock(*this);
 			try 
@@ -654,6 +1205,16 @@ void NucInstDig::updateAD()
                     enable = 1; // traces always enabled
                 } else if (i == 2) {
                     getIntegerParam(P_readTOFSpectra, &enable);
+                } else if (i == 6) {
+                    getIntegerParam(P_pulseHeight, &enable);
+                } else if (i == 7) {
+                    getIntegerParam(P_readTOFSpectra, &enable);
+                    enable = (enable != 0 && m_TOFHistogramConsumer.enabled() ? 1 : 0);
+                } else if (i == 8) {
+                    uint64_t ncaptures = 0;
+                    uint32_t trigger_frame = 0;
+                    m_traceHistory.captureStats(ncaptures, trigger_frame);
+                    enable = (ncaptures != m_traceHistPublished ? 1 : 0); // each capture is published once
                 }
                 // addr 3,4,5 should always be disabled 
 				getIntegerParam(i, ADAcquire, &acquiring);
@@ -673,7 +1234,7 @@ void NucInstDig::updateAD()
 					old_acquiring[i] = acquiring;
 				}
 				setIntegerParam(i, ADStatus, ADStatusAcquire); 
-                if (m_dig_id == 0) {
+                if (m_dig_id == 0 && i < 3) {
 				    setIntegerParam(i + 3, ADStatus, ADStatusAcquire); 
                 }
 				epicsTimeGetCurrent(&startTime);
@@ -684,23 +1245,36 @@ void NucInstDig::updateAD()
 
 				setShutter(i, ADShutterOpen);
 				callParamCallbacks(i, i);
-                if (m_dig_id == 0) {
+                if (m_dig_id == 0 && i < 3) {
 				    setShutter(i + 3, ADShutterOpen);
 				    callParamCallbacks(i + 3, i + 3);
                 }
 				
 				/* Update the image */
+                // snapshots are the latest complete data, we never wait for a read from the digitiser
                 if (i == 0) {
-                    epicsGuard<epicsMutex> _lock(m_dcLock);
-				    status = computeImage(i, m_dcSpectra, m_nDCPts, m_nDCSpec);
+                    SpectraBuffer::Snapshot spectra = m_dcSpectra.read();
+				    status = computeImage(i, spectra->data, spectra->npts, spectra->nspec);
                 }
                 else if (i == 1) {
-                    epicsGuard<epicsMutex> _lock(m_tracesLock);
-				    status = computeImage(i, m_traces, m_nVoltage, m_NTRACE);
+                    TracesBuffer::Snapshot traces = m_traces.read();
+				    status = computeImage(i, traces->data, traces->npts, traces->nspec);
                 }
                 else if (i == 2) {
-                    epicsGuard<epicsMutex> _lock(m_TOFSpectraLock);
-				    status = computeImage(i, m_TOFSpectra, m_nTOFPts, m_nTOFSpec);
+                    SpectraBuffer::Snapshot spectra = m_TOFSpectra.read();
+				    status = computeImage(i, spectra->data, spectra->npts, spectra->nspec);
+                }
+                else if (i == 6) {
+                    size_t nchan = 0, nbins = 0;
+                    m_pulseHeight.merge(m_pulseHeightData, nchan, nbins);
+				    status = computeImage(i, m_pulseHeightData, static_cast<int>(nbins), static_cast<int>(nchan));
+                }
+                else if (i == 7) {
+                    SpectraBuffer::Snapshot cube = m_TOFPeriods.read();
+                    status = computeCube(i, cube->data, static_cast<int>(cube->npts), static_cast<int>(cube->nspec / cube->nperiods), static_cast<int>(cube->nperiods));
+                }
+                else if (i == 8) {
+                    status = computeTraceCapture(i);
                 }
 
 	//            if (status) continue;
@@ -713,7 +1287,7 @@ void NucInstDig::updateAD()
 				setIntegerParam(i, ADStatus, ADStatusReadout);
 				/* Call the callbacks to update any changes */
 				callParamCallbacks(i, i);
-                if (m_dig_id == 0) {
+                if (m_dig_id == 0 && i < 3) {
 				    setShutter(i + 3, ADShutterClosed);
 				    setIntegerParam(i + 3, ADStatus, ADStatusReadout);
 				    callParamCallbacks(i + 3, i + 3);
@@ -734,7 +1308,7 @@ void NucInstDig::updateAD()
 				++numImagesCounter;
 				setIntegerParam(i, NDArrayCounter, imageCounter);
 				setIntegerParam(i, ADNumImagesCounter, numImagesCounter);
-                if (m_dig_id == 0) {
+                if (m_dig_id == 0 && i < 3) {
 				    setIntegerParam(i + 3, NDArrayCounter, imageCounter);
 				    setIntegerParam(i + 3, ADNumImagesCounter, numImagesCounter);
                 }
@@ -754,7 +1328,7 @@ void NucInstDig::updateAD()
 				  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
 						"%s:%s: calling imageData callback addr %d\n", driverName, functionName, i);
 				  doCallbacksGenericPointer(pImage, NDArrayData, i);
-                  NDArray* pRawComb = g_rawCombined[i];
+                  NDArray* pRawComb = (i < 3 ? g_rawCombined[i] : NULL);
                   if (m_dig_id == 0 && pRawComb != NULL) {
                       epicsGuard<epicsMutex> _lock(g_digCombinedLock);
 				      /* Put the frame number and time stamp into the buffer */
@@ -771,7 +1345,7 @@ void NucInstDig::updateAD()
 				last_update[i] = endTime;
 				/* Call the callbacks to update any changes */
 				callParamCallbacks(i, i);
-                if (m_dig_id == 0) {
+                if (m_dig_id == 0 && i < 3) {
                     callParamCallbacks(i + 3, i + 3);
                 }
 				/* sleep for the acquire period minus elapsed time. */
@@ -798,17 +1372,24 @@ void NucInstDig::updateAD()
         }
 		if (all_enable == 0 || all_acquiring == 0)
 		{
-			epicsThreadSleep(1.0);
+			m_updateADEvent.wait(); // wait for acquire to be started
 		}
 		else
 		{
-			epicsThreadSleep(1.0);
+			m_updateADEvent.wait(1.0); // wait for new data, but republish at least every second
 		}
 	}
 }
 
+/// NDArray data type holding T without conversion, -1 if there is none
+template <typename T> struct NativeNDDataType { static const int value = -1; };
+template <> struct NativeNDDataType<epicsUInt16> { static const int value = NDUInt16; };
+template <> struct NativeNDDataType<epicsUInt32> { static const int value = NDUInt32; };
+template <> struct NativeNDDataType<epicsFloat64> { static const int value = NDFloat64; };
+
 /** Computes the new image data */
-int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int nx, int ny)
+template <typename T>
+int NucInstDig::computeImage(int addr, const std::vector<T>& data_in, int nx, int ny)
 {
     int status = asynSuccess;
     NDDataType_t dataType, dataTypeComb;
@@ -817,6 +1398,7 @@ int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int n
     int xDim=0, yDim=1, colorDim=-1;
     int maxSizeX, maxSizeY;
     int colorMode;
+    double gain;
     int ndims=0;
     NDDimension_t dimsOut[3];
     size_t dims[3];
@@ -838,6 +1420,7 @@ int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int n
     status |= getIntegerParam(addr, ADMaxSizeY,     &maxSizeY);
     status |= getIntegerParam(addr, NDColorMode,    &colorMode);
     status |= getIntegerParam(addr, NDDataType,     &itemp); 
+    status |= getDoubleParam(ADGain,                &gain); // as computeArray()
 	dataType = (NDDataType_t)itemp;
 	if (status)
 	{
@@ -941,9 +1524,29 @@ int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int n
             break;
     }
 
-// we could be more efficient
-//    if (resetImage) {
-    /* Free the previous raw buffer */
+    if (static_cast<int>(dataType) == NativeNDDataType<T>::value && colorMode == NDColorModeMono && gain == 1.0 &&
+        binX == 1 && binY == 1 && minX == 0 && minY == 0 && sizeX == nx && sizeY == ny && reverseX == 0 && reverseY == 0 &&
+        data_in.size() >= static_cast<size_t>(nx) * ny)
+    {
+        // the data is already the image, e.g. uint16 traces, so copy it straight into a pooled array
+        // rather than through m_pRaw, computeArray() and convert()
+        dims[0] = nx;
+        dims[1] = ny;
+        pImage = this->pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
+        if (!pImage) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s: error allocating buffer\n",
+                      driverName, functionName);
+            return asynError;
+        }
+        memcpy(pImage->pData, data_in.data(), static_cast<size_t>(nx) * ny * sizeof(T));
+        pImage->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        if (this->pArrays[addr]) this->pArrays[addr]->release();
+        this->pArrays[addr] = pImage;
+    }
+    else
+    {
+        /* Free the previous raw buffer */
         if (m_pRaw) m_pRaw->release();
         /* Allocate the raw buffer we use to compute images. */
         dims[xDim] = maxSizeX;
@@ -957,35 +1560,35 @@ int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int n
                       driverName, functionName);
             return(status);
         }
-//    }
-
-    status |= callComputeArray(dataType, addr, data_in, maxSizeX, maxSizeY);
-
-    /* Extract the region of interest with binning.
-     * If the entire image is being used (no ROI or binning) that's OK because
-     * convertImage detects that case and is very efficient */
-    m_pRaw->initDimension(&dimsOut[xDim], sizeX);
-    m_pRaw->initDimension(&dimsOut[yDim], sizeY);
-    if (ndims > 2) m_pRaw->initDimension(&dimsOut[colorDim], 3);
-    dimsOut[xDim].binning = binX;
-    dimsOut[xDim].offset  = minX;
-    dimsOut[xDim].reverse = reverseX;
-    dimsOut[yDim].binning = binY;
-    dimsOut[yDim].offset  = minY;
-    dimsOut[yDim].reverse = reverseY;
-
-    /* We save the most recent image buffer so it can be used in the read() function.
-     * Now release it before getting a new version. */	 
-    if (this->pArrays[addr]) this->pArrays[addr]->release();
-    status = this->pNDArrayPool->convert(m_pRaw,
-                                         &this->pArrays[addr],
-                                         dataType,
-                                         dimsOut);
-    if (status) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s:%s: error allocating buffer in convert()\n",
-                    driverName, functionName);
-        return(status);
+
+        status |= callComputeArray(dataType, addr, data_in, maxSizeX, maxSizeY);
+
+        /* Extract the region of interest with binning.
+         * If the entire image is being used (no ROI or binning) that's OK because
+         * convertImage detects that case and is very efficient */
+        m_pRaw->initDimension(&dimsOut[xDim], sizeX);
+        m_pRaw->initDimension(&dimsOut[yDim], sizeY);
+        if (ndims > 2) m_pRaw->initDimension(&dimsOut[colorDim], 3);
+        dimsOut[xDim].binning = binX;
+        dimsOut[xDim].offset  = minX;
+        dimsOut[xDim].reverse = reverseX;
+        dimsOut[yDim].binning = binY;
+        dimsOut[yDim].offset  = minY;
+        dimsOut[yDim].reverse = reverseY;
+
+        /* We save the most recent image buffer so it can be used in the read() function.
+         * Now release it before getting a new version. */
+        if (this->pArrays[addr]) this->pArrays[addr]->release();
+        status = this->pNDArrayPool->convert(m_pRaw,
+                                             &this->pArrays[addr],
+                                             dataType,
+                                             dimsOut);
+        if (status) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s: error allocating buffer in convert()\n",
+                      driverName, functionName);
+            return(status);
+        }
     }
     bool freepImage = false;
     pImage = this->pArrays[addr];
@@ -998,6 +1601,9 @@ int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int n
                     "%s:%s: error setting parameters\n",
                     driverName, functionName);
 
+    if (addr > 2) { // only DC, traces and TOF have a combined array
+        return status;
+    }
     // create combined accross digitisers array
     dataTypeComb = dataType;
     if (addr == 2) { // TOF spectra 
@@ -1090,48 +1696,138 @@ int NucInstDig::computeImage(int addr, const std::vector<double>& data_in, int n
     return(status);
 }
 
+/** Publishes the last trace history capture as a 3d uint16 array of samples x channel x frame, copied
+ *  straight from the TraceHistory into a pooled array */
+int NucInstDig::computeTraceCapture(int addr)
+{
+    int status = asynSuccess;
+    size_t dims[3];
+    NDArrayInfo_t arrayInfo;
+    const char* functionName = "computeTraceCapture";
+    uint64_t ncaptures = 0;
+    uint32_t trigger_frame = 0;
+    size_t npts = 0, nchan = 0, nframes = 0;
+
+    /* NOTE: The caller of this function must have taken the mutex */
+
+    m_traceHistory.captureStats(ncaptures, trigger_frame);
+    m_traceHistory.captureSize(npts, nchan, nframes);
+    m_traceHistPublished = ncaptures;
+    if (npts * nchan * nframes == 0)
+    {
+        return asynSuccess;
+    }
+    dims[0] = npts;
+    dims[1] = nchan;
+    dims[2] = nframes;
+    NDArray* pCapture = this->pNDArrayPool->alloc(3, dims, NDUInt16, 0, NULL);
+    if (!pCapture) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: error allocating buffer\n",
+                  driverName, functionName);
+        return asynError;
+    }
+    m_traceHistory.copyCapture(static_cast<epicsUInt16*>(pCapture->pData), npts * nchan * nframes);
+    epicsInt32 frame = static_cast<epicsInt32>(trigger_frame);
+    pCapture->pAttributeList->add("TriggerFrame", "frame_number of the triggering frame", NDAttrInt32, &frame);
+    pCapture->getInfo(&arrayInfo);
+    if (this->pArrays[addr]) this->pArrays[addr]->release();
+    this->pArrays[addr] = pCapture;
+    status |= setIntegerParam(addr, NDArraySize,  (int)arrayInfo.totalBytes);
+    status |= setIntegerParam(addr, NDArraySizeX, static_cast<int>(npts));
+    status |= setIntegerParam(addr, NDArraySizeY, static_cast<int>(nchan));
+    status |= setIntegerParam(addr, NDArraySizeZ, static_cast<int>(nframes));
+    status |= setIntegerParam(addr, NDDataType, NDUInt16);
+    status |= setIntegerParam(addr, ADMaxSizeX, static_cast<int>(npts));
+    status |= setIntegerParam(addr, ADMaxSizeY, static_cast<int>(nchan));
+    status |= setIntegerParam(addr, ADSizeX, static_cast<int>(npts));
+    status |= setIntegerParam(addr, ADSizeY, static_cast<int>(nchan));
+    return status;
+}
+
+/** Publishes a 3d array of nx * ny * nz unsigned counts, such as TOF x spectrum x period, without ROI or binning */
+int NucInstDig::computeCube(int addr, const std::vector<epicsUInt32>& data, int nx, int ny, int nz)
+{
+    int status = asynSuccess;
+    size_t dims[3];
+    NDArrayInfo_t arrayInfo;
+    const char* functionName = "computeCube";
+
+    /* NOTE: The caller of this function must have taken the mutex */
+
+    if (nx * ny * nz == 0 || data.size() < static_cast<size_t>(nx) * ny * nz)
+    {
+        return asynSuccess;
+    }
+    dims[0] = nx;
+    dims[1] = ny;
+    dims[2] = nz;
+    NDArray* pCube = this->pNDArrayPool->alloc(3, dims, NDUInt32, 0, NULL);
+    if (!pCube) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: error allocating buffer\n",
+                  driverName, functionName);
+        return asynError;
+    }
+    pCube->getInfo(&arrayInfo);
+    memcpy(pCube->pData, data.data(), arrayInfo.totalBytes);
+    if (this->pArrays[addr]) this->pArrays[addr]->release();
+    this->pArrays[addr] = pCube;
+    status |= setIntegerParam(addr, NDArraySize,  (int)arrayInfo.totalBytes);
+    status |= setIntegerParam(addr, NDArraySizeX, nx);
+    status |= setIntegerParam(addr, NDArraySizeY, ny);
+    status |= setIntegerParam(addr, NDArraySizeZ, nz);
+    status |= setIntegerParam(addr, NDDataType, NDUInt32);
+    status |= setIntegerParam(addr, ADMaxSizeX, nx);
+    status |= setIntegerParam(addr, ADMaxSizeY, ny);
+    status |= setIntegerParam(addr, ADSizeX, nx);
+    status |= setIntegerParam(addr, ADSizeY, ny);
+    return status;
+}
+
+template <typename T>
 int NucInstDig::callComputeArray(NDDataType_t dataType, int addr,
-      const std::vector<double>& data, int sizeX, int sizeY)
+      const std::vector<T>& data, int sizeX, int sizeY)
 {
     int status = asynSuccess;
     switch (dataType) {
         case NDInt8:
-            status |= computeArray<epicsInt8>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsInt8, T>(addr, data, sizeX, sizeY);
             break;
         case NDUInt8:
-            status |= computeArray<epicsUInt8>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsUInt8, T>(addr, data, sizeX, sizeY);
             break;
         case NDInt16:
-            status |= computeArray<epicsInt16>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsInt16, T>(addr, data, sizeX, sizeY);
             break;
         case NDUInt16:
-            status |= computeArray<epicsUInt16>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsUInt16, T>(addr, data, sizeX, sizeY);
             break;
         case NDInt32:
-            status |= computeArray<epicsInt32>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsInt32, T>(addr, data, sizeX, sizeY);
             break;
         case NDUInt32:
-            status |= computeArray<epicsUInt32>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsUInt32, T>(addr, data, sizeX, sizeY);
             break;
         case NDInt64:
-            status |= computeArray<epicsInt64>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsInt64, T>(addr, data, sizeX, sizeY);
             break;
         case NDUInt64:
-            status |= computeArray<epicsUInt64>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsUInt64, T>(addr, data, sizeX, sizeY);
             break;
         case NDFloat32:
-            status |= computeArray<epicsFloat32>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsFloat32, T>(addr, data, sizeX, sizeY);
             break;
         case NDFloat64:
-            status |= computeArray<epicsFloat64>(addr, data, sizeX, sizeY);
+            status |= computeArray<epicsFloat64, T>(addr, data, sizeX, sizeY);
             break;
     }
     return status;
 }
 
 // supplied array of x,y,t
-template <typename epicsType> 
-int NucInstDig::computeArray(int addr, const std::vector<double>& data, int sizeX, int sizeY)
+template <typename epicsType, typename T> 
+int NucInstDig::computeArray(int addr, const std::vector<T>& data, int sizeX, int sizeY)
 {
     epicsType *pMono=NULL, *pRed=NULL, *pGreen=NULL, *pBlue=NULL;
     int columnStep=0, rowStep=0, colorMode;
@@ -1175,9 +1871,16 @@ int NucInstDig::computeArray(int addr, const std::vector<double>& data, int size
 	for (i=0; i<sizeY; i++) {
 		switch (colorMode) {
 			case NDColorModeMono:
-				for (j=0; j<sizeX; j++) {
-					pMono[k] = static_cast<epicsType>(gain * data[k]);
-					++k;
+				if (gain == 1.0) { // avoid going via double when we do not need to
+					for (j=0; j<sizeX; j++) {
+						pMono[k] = static_cast<epicsType>(data[k]);
+						++k;
+					}
+				} else {
+					for (j=0; j<sizeX; j++) {
+						pMono[k] = static_cast<epicsType>(gain * data[k]);
+						++k;
+					}
 				}
 				break;
 			case NDColorModeRGB1:
@@ -1204,7 +1907,7 @@ void NucInstDig::updateDCSpectra()
     while(true)
     {
         int read_spectra = 0;
-        epicsThreadSleep(1.0);
+        m_readDCSpectraEvent.wait(); // signalled by READ_DC_SPECTRA or READ_DC_SPECTRA_PERIOD timer
         lock();
         getIntegerParam(P_readDCSpectra, &read_spectra);
         unlock();
@@ -1213,17 +1916,20 @@ void NucInstDig::updateDCSpectra()
         }
         try {
             {
-                epicsGuard<epicsMutex> _lock(m_dcLock);
-                readData2d("get_darkcount_spectra", "", m_dcSpectra, m_nDCSpec, m_nDCPts);
+                SpectraBuffer::Writer spectra(m_dcSpectra);
+                readData2d("get_darkcount_spectra", "", spectra->data, spectra->nspec, spectra->npts, 0);
+                spectra.publish();
             }
+            m_updateADEvent.signal();
+            SpectraBuffer::Snapshot spectra = m_dcSpectra.read();
             for(size_t j=0; j<4; ++j) {
                 int idx = m_DCSpecIdx[j];
-                if (idx >= 0 && idx < m_nDCSpec) {
-                    m_DCSpecX[j].resize(m_nDCPts);
-                    m_DCSpecY[j].resize(m_nDCPts);
-                    for(int k=0; k<m_nDCPts; ++k) {
+                if (idx >= 0 && idx < spectra->nspec) {
+                    m_DCSpecX[j].resize(spectra->npts);
+                    m_DCSpecY[j].resize(spectra->npts);
+                    for(int k=0; k<spectra->npts; ++k) {
                         m_DCSpecX[j][k] = k;
-                        m_DCSpecY[j][k] = m_dcSpectra[idx * m_nDCPts + k];
+                        m_DCSpecY[j][k] = spectra->data[idx * spectra->npts + k];
                     }
                     epicsGuard<NucInstDig> _lock2(*this);
                     doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_DCSpecX[j].data()), m_DCSpecX[j].size(), P_DCSpecX[j], 0);
@@ -1248,33 +1954,63 @@ void NucInstDig::updateTOFSpectra()
 {
     while(true)
     {
-        int read_spectra = 0;
-        epicsThreadSleep(1.0);
+        int read_spectra = 0, asym = 0;
+        m_readTOFSpectraEvent.wait(); // signalled by READ_TOF_SPECTRA or READ_TOF_SPECTRA_PERIOD timer
         lock();
         getIntegerParam(P_readTOFSpectra, &read_spectra);
+        getIntegerParam(P_asym, &asym);
         unlock();
         if (read_spectra == 0) {
             continue;
         }
         try {
-            {
-                epicsGuard<epicsMutex> _lock(m_TOFSpectraLock);
-                readData2d("get_tof_spectra", "", m_TOFSpectra, m_nTOFSpec, m_nTOFPts);
+            if (m_TOFHistogramConsumer.enabled()) {
+                SpectraBuffer::Writer cube(m_TOFPeriods);
+                size_t nchan = 0, nbins = 0, nslots = 0;
+                m_TOFHistogram.merge(cube->data, nchan, nbins, nslots);
+                cube->nspec = nchan * nslots;
+                cube->npts = nbins;
+                cube->nperiods = nslots;
+                // TOF spectra are the sum of all periods, excluding vetoed frames histogrammed separately
+                size_t nperiods = std::min(nslots, static_cast<size_t>(std::max(m_numPeriods, 1)));
+                size_t period_size = nchan * nbins;
+                SpectraBuffer::Writer spectra(m_TOFSpectra);
+                spectra->data.assign(cube->data.begin(), cube->data.begin() + period_size);
+                for(size_t p=1; p<nperiods; ++p) {
+                    const epicsUInt32* src = &(cube->data[p * period_size]);
+                    for(size_t k=0; k<period_size; ++k) {
+                        spectra->data[k] += src[k];
+                    }
+                }
+                spectra->nspec = nchan;
+                spectra->npts = nbins;
+                cube.publish();
+                spectra.publish();
+                updatePeriodCounts();
+            } else {
+                SpectraBuffer::Writer spectra(m_TOFSpectra);
+                readData2d("get_tof_spectra", "", spectra->data, spectra->nspec, spectra->npts, 2);
+                spectra.publish();
             }
+            m_updateADEvent.signal();
+            SpectraBuffer::Snapshot spectra = m_TOFSpectra.read();
             for(size_t j=0; j<4; ++j) {
                 int idx = m_TOFSpecIdx[j];
-                if (idx >= 0 && idx < m_nTOFSpec) {
-                    m_TOFSpecX[j].resize(m_nTOFPts);
-                    m_TOFSpecY[j].resize(m_nTOFPts);
-                    for(int k=0; k<m_nTOFPts; ++k) {
+                if (idx >= 0 && idx < spectra->nspec) {
+                    m_TOFSpecX[j].resize(spectra->npts);
+                    m_TOFSpecY[j].resize(spectra->npts);
+                    for(int k=0; k<spectra->npts; ++k) {
                         m_TOFSpecX[j][k] = k;
-                        m_TOFSpecY[j][k] = m_TOFSpectra[idx * m_nTOFPts + k];
+                        m_TOFSpecY[j][k] = spectra->data[idx * spectra->npts + k];
                     }
                     epicsGuard<NucInstDig> _lock2(*this);
                     doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_TOFSpecX[j].data()), m_TOFSpecX[j].size(), P_TOFSpecX[j], 0);
                     doCallbacksFloat64Array(reinterpret_cast<epicsFloat64*>(m_TOFSpecY[j].data()), m_TOFSpecY[j].size(), P_TOFSpecY[j], 0);
                 }
             }
+            if (asym != 0) {
+                updateAsymmetry(*spectra);
+            }
         }
         catch(const std::exception& ex)
         {
@@ -1291,38 +2027,36 @@ void NucInstDig::updateTOFSpectra()
 
 
 
+// event receive thread, drains the dev2 event list socket into m_eventsRing for processEvents()
+// so the socket is emptied at network rate however long the event consumers take
 void NucInstDig::updateEvents()
 {
     while(true)
     {
         int read_events = 0;
-        epicsThreadSleep(1.0);
         lock();
         getIntegerParam(P_readEvents, &read_events);
         unlock();
         if (read_events == 0) {
+            m_readEventsEvent.wait(); // wait for READ_EVENTS to be set
             continue;
         }
         try {
-        zmq::message_t reply{};
-        zmq::recv_result_t nbytes = m_zmq_events.recv(reply, zmq::recv_flags::none);
-        if (!nbytes || *nbytes == 0)
-        {
-            epicsThreadSleep(1.0);
-            continue;
-        }
-        auto msg = GetDigitizerEventListMessage(reply.data());
-        auto channels = msg->channel();
-        auto times = msg->time();
-        auto voltages = msg->voltage();
-        size_t nevents = channels->size();
-        std::cerr << "nevents " << nevents << std::endl;
-        if (nevents > 5) {
-            nevents = 5;
-        }
-        for(size_t i=0; i<nevents; ++i) {
-            std::cerr << channels->Get(i) << " " << times->Get(i) << " " << voltages->Get(i) << std::endl;
-        }
+            if (m_eventsReconfigure.exchange(false)) {
+                m_zmq_events.setOptions(m_eventsHWM, !m_eventsLossless);
+            }
+            // short timeout so we notice READ_EVENTS and option changes
+            if (!m_zmq_events.poll(100)) {
+                continue;
+            }
+            while(true) {
+                std::shared_ptr<EventMessage> msg = std::make_shared<EventMessage>();
+                zmq::recv_result_t nbytes = m_zmq_events.recv(msg->msg, zmq::recv_flags::dontwait);
+                if (!nbytes) {
+                    break; // nothing more queued
+                }
+                m_eventsRing.push(msg);
+            }
         }
         catch(const std::exception& ex)
         {
@@ -1337,41 +2071,422 @@ void NucInstDig::updateEvents()
     }
 }
 
+// event processing thread, passes messages received by updateEvents() to ingestEvents()
+void NucInstDig::processEvents()
+{
+    std::shared_ptr<EventMessage> msg;
+    while(true)
+    {
+        try {
+            if (m_eventsRing.pop(msg, 0.1)) {
+                ingestEvents(msg);
+                msg.reset();
+            }
+        }
+        catch(const std::exception& ex)
+        {
+            std::cerr << "process events " << ex.what() << std::endl;
+            epicsThreadSleep(3.0);            
+        }
+    }
+}
+
+void NucInstDig::ingestEvents(const std::shared_ptr<EventMessage>& msg)
+{
+    flatbuffers::Verifier verifier(static_cast<const uint8_t*>(msg->msg.data()), msg->msg.size());
+    if (!VerifyDigitizerEventListMessageBuffer(verifier)) {
+        ++m_eventsNDropped;
+        return;
+    }
+    const DigitizerEventListMessage* events = msg->events();
+    ++m_eventsNMsgs;
+    m_eventsNBytes += msg->msg.size();
+    if (events->channel() != NULL) {
+        m_eventsNEvents += events->channel()->size();
+    }
+    // missing frame numbers are frames dropped by conflation or the sender's high water mark
+    m_frameTracker[0].frame(events->digitizer_id(), events->metadata());
+    if (m_eventsRepublisher.enabled()) {
+        uint32_t chan_min = 0, chan_max = UINT32_MAX;
+        if (m_eventsRepublisher.filtersChannels() && events->channel() != NULL && events->channel()->size() > 0) {
+            std::pair<const uint32_t*, const uint32_t*> range = std::minmax_element(events->channel()->data(),
+                                                         events->channel()->data() + events->channel()->size());
+            chan_min = *range.first;
+            chan_max = *range.second;
+        }
+        m_eventsRepublisher.publish(msg->msg, events->digitizer_id(), chan_min, chan_max);
+    }
+    m_eventFilter.apply(*msg);
+    EventMessagePtr cmsg(msg);
+    epicsGuard<epicsMutex> _lock(m_eventConsumersLock);
+    for(size_t i=0; i<m_eventConsumers.size(); ++i) {
+        m_eventConsumers[i]->consumeEvents(cmsg);
+    }
+}
+
+void NucInstDig::addEventConsumer(EventConsumer* consumer)
+{
+    epicsGuard<epicsMutex> _lock(m_eventConsumersLock);
+    m_eventConsumers.push_back(consumer);
+}
+
+HistogramEventConsumer::HistogramEventConsumer(EventHistogram& hist) : m_hist(hist), m_enabled(false), m_merged(false), m_nperiods(1),
+                       m_vetoMask(0), m_vetoMode(VetoIgnore), m_goodFrames(1, 0.0), m_protons(1, 0.0), m_rawFrames(0),
+                       m_vetoedFrames(0), m_currentPeriod(0)
+{
+}
+
+void HistogramEventConsumer::setPeriods(size_t nperiods, uint16_t veto_mask, VetoMode veto_mode)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_nperiods = std::max(nperiods, static_cast<size_t>(1));
+    m_vetoMask = veto_mask;
+    m_vetoMode = veto_mode;
+    m_hist.setPeriods(m_nperiods + (m_vetoMode == VetoSeparate ? 1 : 0));
+    m_goodFrames.assign(m_nperiods, 0.0);
+    m_protons.assign(m_nperiods, 0.0);
+    m_rawFrames = m_vetoedFrames = 0;
+    m_recentFrames.clear();
+    m_recentOrder.clear();
+}
+
+void HistogramEventConsumer::resetCounts()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    std::fill(m_goodFrames.begin(), m_goodFrames.end(), 0.0);
+    std::fill(m_protons.begin(), m_protons.end(), 0.0);
+    m_rawFrames = m_vetoedFrames = 0;
+    m_recentFrames.clear();
+    m_recentOrder.clear();
+}
+
+void HistogramEventConsumer::getCounts(std::vector<double>& good_frames, std::vector<double>& protons, uint64_t& raw_frames,
+                                       uint64_t& vetoed_frames, uint64_t& current_period)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    good_frames = m_goodFrames;
+    protons = m_protons;
+    raw_frames = m_rawFrames;
+    vetoed_frames = m_vetoedFrames;
+    current_period = m_currentPeriod;
+}
+
+// count the frame and find the histogram period of its events, returns false if the events are rejected
+bool HistogramEventConsumer::countFrame(const FrameMetadataV2* metadata, size_t& period_out)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    bool vetoed = ((metadata->veto_flags() & m_vetoMask) != 0);
+    bool good = (!vetoed || m_vetoMode == VetoIgnore);
+    uint64_t period = (m_nperiods > 1 ? metadata->period_number() : 0);
+    m_currentPeriod = metadata->period_number();
+    // count each frame once, however many messages it arrives in, frame numbers restart with a run
+    if (m_recentFrames.insert(metadata->frame_number()).second)
+    {
+        m_recentOrder.push_back(metadata->frame_number());
+        if (m_recentOrder.size() > 1024)
+        {
+            m_recentFrames.erase(m_recentOrder.front());
+            m_recentOrder.pop_front();
+        }
+        ++m_rawFrames;
+        if (vetoed)
+        {
+            ++m_vetoedFrames;
+        }
+        if (good && period < m_nperiods)
+        {
+            m_goodFrames[period] += 1.0;
+            m_protons[period] += metadata->protons_per_pulse();
+        }
+    }
+    if (!good && m_vetoMode == VetoReject)
+    {
+        return false;
+    }
+    if (!good && m_vetoMode == VetoSeparate)
+    {
+        period = m_nperiods;
+    }
+    else if (period >= m_nperiods)
+    {
+        period = m_nperiods + 1; // outside the histogram
+    }
+    period_out = static_cast<size_t>(period);
+    return true;
+}
+
+void HistogramEventConsumer::consumeEvents(const EventMessagePtr& msg)
+{
+    if (!m_enabled || m_merged)
+    {
+        return;
+    }
+    EventList events = msg->eventList();
+    if (events.channel == NULL)
+    {
+        return;
+    }
+    EventHistogram::EventBlock block;
+    if (!countFrame(msg->events()->metadata(), block.period))
+    {
+        return;
+    }
+    block.owner = msg;
+    block.channel = events.channel;
+    block.time = events.time;
+    block.voltage = events.voltage;
+    block.n = events.n;
+    m_hist.submit(block);
+}
+
+void HistogramEventConsumer::consumeFrame(const MergedFramePtr& frame)
+{
+    if (!m_enabled || !m_merged)
+    {
+        return;
+    }
+    EventHistogram::EventBlock block;
+    if (!countFrame(frame->metadata(), block.period))
+    {
+        return;
+    }
+    block.owner = frame;
+    block.channel = frame->channel.data();
+    block.time = frame->time.data();
+    block.voltage = frame->voltage.data();
+    block.n = frame->time.size();
+    m_hist.submit(block);
+}
+
 void NucInstDig::executeCmd(const std::string& name, const std::string& args)
 {
     rapidjson::Document doc_recv;
-    execute("execute_cmd", name, args, "", doc_recv);    
+    execute("execute_cmd", name, args, "", doc_recv, CmdRunControl);    
 }
 
-void NucInstDig::readData2d(const std::string& name, const std::string& args, std::vector<double>& dataOut, size_t& nspec, size_t& npts)
+/// SAX handler for execute_read_command replies  {"response":"ok","data":[[n,n,...],[n,n,...],...]}
+/// numbers in "data" are written straight into the output vector, spectra of different lengths are
+/// padded with zeros after parsing by readData2d()
+template <typename T>
+struct Data2dHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, Data2dHandler<T> >
 {
-    rapidjson::Document doc_recv;
+    std::vector<T>& data;
+    std::vector<size_t> lengths; // points in each spectrum
+    std::string key; // last key seen in top level object
+    std::string response;
+    std::string message;
+    int error_code;
+    int depth;
+    bool in_data;
+    Data2dHandler(std::vector<T>& data_) : data(data_), error_code(0), depth(0), in_data(false) { }
+
+    /// true if v can be converted to U, NaN is never in range
+    template <typename U, typename V>
+    static bool inRange(V v)
+    {
+        double d = static_cast<double>(v);
+        return d >= static_cast<double>(std::numeric_limits<U>::lowest()) && d <= static_cast<double>(std::numeric_limits<U>::max());
+    }
+
+    template <typename V>
+    bool value(V v)
+    {
+        if (in_data)
+        {
+            if (!inRange<T>(v))
+            {
+                return false; // reported as a parse error rather than wrapping the value
+            }
+            if (lengths.empty())
+            {
+                lengths.push_back(0); // a single spectrum sent as a 1d array
+            }
+            data.push_back(static_cast<T>(v));
+            ++lengths.back();
+        }
+        else if (depth == 1 && key == "error_code")
+        {
+            if (!inRange<int>(v))
+            {
+                return false;
+            }
+            error_code = static_cast<int>(v);
+        }
+        return true;
+    }
+    bool Int(int i) { return value(i); }
+    bool Uint(unsigned u) { return value(u); }
+    bool Int64(int64_t i) { return value(i); }
+    bool Uint64(uint64_t u) { return value(u); }
+    bool Double(double d) { return value(d); }
+    bool String(const char* str, rapidjson::SizeType length, bool copy)
+    {
+        if (depth == 1 && key == "response")
+        {
+            response.assign(str, length);
+        }
+        else if (depth == 1 && key == "message")
+        {
+            message.assign(str, length);
+        }
+        return true;
+    }
+    bool Key(const char* str, rapidjson::SizeType length, bool copy)
+    {
+        if (depth == 1)
+        {
+            key.assign(str, length);
+        }
+        return true;
+    }
+    bool StartObject() { ++depth; return true; }
+    bool EndObject(rapidjson::SizeType memberCount) { --depth; return true; }
+    bool StartArray()
+    {
+        ++depth;
+        if (depth == 2 && key == "data")
+        {
+            in_data = true;
+        }
+        else if (in_data && depth == 3)
+        {
+            lengths.push_back(0);
+        }
+        return true;
+    }
+    bool EndArray(rapidjson::SizeType elementCount)
+    {
+        if (depth == 2)
+        {
+            in_data = false;
+        }
+        --depth;
+        return true;
+    }
+};
+
+template <typename T>
+void NucInstDig::readData2d(const std::string& name, const std::string& args, std::vector<T>& dataOut, size_t& nspec, size_t& npts, int addr)
+{
+    epicsTimeStamp startTime, endTime;
+    bool binary = (m_readBinary && m_readBinarySupported);
+    std::string sendstr = formatCommand("execute_read_command", name, args, (binary ? "binary" : ""));
+    std::future<zmq::message_t> reply_future = m_zmq_cmd.submit(sendstr, CmdBulkRead);
+    zmq::message_t reply = receiveReply(sendstr, reply_future);
+    epicsTimeGetCurrent(&startTime);
+    if (nidgIsBinaryReply(reply.data(), reply.size()))
+    {
+        decodeData2dBinary(sendstr, reply, dataOut, nspec, npts);
+        m_readBinaryActive = true;
+        m_readBinaryConfirmed = true;
+    }
+    else if (decodeData2dJSON(sendstr, reply, dataOut, nspec, npts, binary && !m_readBinaryConfirmed))
+    {
+        m_readBinaryActive = false;
+    }
+    else
+    {
+        // error reply before the digitiser has ever sent binary data, firmware without binary replies may word
+        // its rejection of the format argument in any way, so use JSON until READ_BINARY is next set
+        std::cerr << "Binary read not supported by digitiser, using JSON" << std::endl;
+        m_readBinarySupported = false;
+        readData2d(name, args, dataOut, nspec, npts, addr);
+        return;
+    }
+    epicsTimeGetCurrent(&endTime);
+    double parseTime = epicsTimeDiffInSeconds(&endTime, &startTime);
+    // callers hold a data lock here, so leave publishing the parameters to zmqMonitorPoller()
+    m_readDataRate[addr] = (parseTime > 0.0 ? reply.size() / parseTime / 1.0e6 : 0.0);
+    m_readDataSize[addr] = static_cast<int>(reply.size());
+}
+
+/// decode a binary execute_read_command reply, values are converted straight from the zmq message buffer
+template <typename T>
+void NucInstDig::decodeData2dBinary(const std::string& sendstr, const zmq::message_t& reply, std::vector<T>& dataOut, size_t& nspec, size_t& npts)
+{
+    const char* buffer = static_cast<const char*>(reply.data());
+    int version = static_cast<uint8_t>(buffer[offsetof(NIDGBinaryHeader, version)]);
+    int dtype = static_cast<uint8_t>(buffer[offsetof(NIDGBinaryHeader, dtype)]);
+    size_t header_size = nidgReadLE<uint16_t>(buffer + offsetof(NIDGBinaryHeader, header_size));
+    size_t dsize = nidgBinaryTypeSize(dtype);
+    nspec = nidgReadLE<uint32_t>(buffer + offsetof(NIDGBinaryHeader, nspec));
+    npts = nidgReadLE<uint32_t>(buffer + offsetof(NIDGBinaryHeader, npts));
+    if (version != NIDG_BINARY_VERSION || dsize == 0 || header_size < sizeof(NIDGBinaryHeader) ||
+        reply.size() != header_size + nspec * npts * dsize)
+    {
+        std::ostringstream oss;
+        oss << "Sent " << sendstr << " invalid binary reply: version=" << version << " dtype=" << dtype
+            << " nspec=" << nspec << " npts=" << npts << " size=" << reply.size();
+        nspec = npts = 0;
+        dataOut.resize(0);
+        throw std::runtime_error(oss.str());
+    }
+    dataOut.resize(nspec * npts);
+    if (dtype == NIDGBinaryUInt16)
+    {
+        nidgConvertLE<uint16_t>(buffer + header_size, dataOut.size(), dataOut.data());
+    }
+    else
+    {
+        nidgConvertLE<uint32_t>(buffer + header_size, dataOut.size(), dataOut.data());
+    }
+}
+
+/// decode a JSON execute_read_command reply, an error reply is thrown unless fallback is set, it
+/// then returns false so the read can be retried without the binary format argument
+template <typename T>
+bool NucInstDig::decodeData2dJSON(const std::string& sendstr, const zmq::message_t& reply, std::vector<T>& dataOut, size_t& nspec, size_t& npts, bool fallback)
+{
+    size_t old_size = dataOut.size();
     dataOut.resize(0);
+    dataOut.reserve(old_size);
     nspec = npts = 0;
-    execute("execute_read_command", name, args, "", doc_recv);
-    const rapidjson::Value& data = doc_recv["data"];
-    if (data.IsArray())
+    // parse directly from the zmq message buffer, no copy of the reply or DOM is made
+    Data2dHandler<T> handler(dataOut);
+    rapidjson::Reader reader;
+    rapidjson::MemoryStream ms(static_cast<const char*>(reply.data()), reply.size());
+    rapidjson::ParseResult ok = reader.Parse(ms, handler);
+    if (!ok)
+    {
+        throw std::runtime_error(std::string("Sent ") + sendstr + " JSON parse error: " + rapidjson::GetParseError_En(ok.Code()));
+    }
+    if (handler.response != "ok")
+    {
+        std::ostringstream oss;
+        oss << "Sent " << sendstr << " Error: code=" << handler.error_code << " message=" << handler.message;
+        std::cerr << oss.str() << std::endl;   // print as long message may get truncated on asyn print
+        if (fallback)
+        {
+            dataOut.resize(0);
+            return false;
+        }
+        throw std::runtime_error(oss.str());
+    }
+    nspec = handler.lengths.size();
+    for(size_t i = 0; i < nspec; ++i)
     {
-        nspec = data.Size();
-        const rapidjson::Value& spec0 = data[0];
-        npts = spec0.Size();
+        npts = std::max(npts, handler.lengths[i]);
+    }
+    if (dataOut.size() != nspec * npts)
+    {
+        // ragged spectra, spread out to npts per spectrum working backwards so nothing is overwritten before it is moved
+        size_t src = dataOut.size();
         dataOut.resize(nspec * npts);
-        for (rapidjson::SizeType i = 0; i < nspec; ++i)
+        for(size_t i = nspec; i-- > 0; )
         {
-            const rapidjson::Value& spec = data[i];
-            for (rapidjson::SizeType j = 0; j < spec.Size(); ++j)
-            {
-                dataOut[i * npts + j] = spec[j].GetDouble();
-            }
+            src -= handler.lengths[i];
+            std::copy_backward(dataOut.begin() + src, dataOut.begin() + src + handler.lengths[i], dataOut.begin() + i * npts + handler.lengths[i]);
+            std::fill(dataOut.begin() + i * npts + handler.lengths[i], dataOut.begin() + (i + 1) * npts, 0);
         }
     }
+    return true;
 }
 
 void NucInstDig::getParameter(const std::string& name, rapidjson::Document& doc_recv, int idx)
 {
     char idxStr[16];
     sprintf(idxStr, "%d", idx);
-    execute("get_parameter", name, idxStr, "", doc_recv);
+    execute("get_parameter", name, idxStr, "", doc_recv, CmdReadback);
 }
 
 void NucInstDig::setParameter(const std::string& name, const std::string& value, int idx)
@@ -1379,7 +2494,7 @@ void NucInstDig::setParameter(const std::string& name, const std::string& value,
     char idxStr[16];
     rapidjson::Document doc_recv;
     sprintf(idxStr, "%d", idx);
-    execute("set_parameter", name, value, idxStr, doc_recv);    
+    execute("set_parameter", name, value, idxStr, doc_recv, CmdInteractive);    
 }
 
 void NucInstDig::setParameter(const std::string& name, double value, int idx)
@@ -1388,7 +2503,7 @@ void NucInstDig::setParameter(const std::string& name, double value, int idx)
     rapidjson::Document doc_recv;
     sprintf(idxStr, "%d", idx);
     sprintf(valueStr, "%f", value);
-    execute("set_parameter", name, valueStr, idxStr, doc_recv);
+    execute("set_parameter", name, valueStr, idxStr, doc_recv, CmdInteractive);
 }
 
 void NucInstDig::setParameter(const std::string& name, int value, int idx)
@@ -1397,12 +2512,18 @@ void NucInstDig::setParameter(const std::string& name, int value, int idx)
     rapidjson::Document doc_recv;
     sprintf(idxStr, "%d", idx);
     sprintf(valueStr, "%d", value);
-    execute("set_parameter", name, valueStr, idxStr, doc_recv);
+    execute("set_parameter", name, valueStr, idxStr, doc_recv, CmdInteractive);
+}
+
+void NucInstDig::execute(const std::string& type, const std::string& name, const std::string& arg1, const std::string& arg2, rapidjson::Document& doc_recv, CommandClass cls)
+{
+    std::string sendstr = formatCommand(type, name, arg1, arg2);
+    std::future<zmq::message_t> reply_future = m_zmq_cmd.submit(sendstr, cls);
+    completeCommand(sendstr, reply_future, doc_recv);
 }
 
-void NucInstDig::execute(const std::string& type, const std::string& name, const std::string& arg1, const std::string& arg2, rapidjson::Document& doc_recv)
+std::string NucInstDig::formatCommand(const std::string& type, const std::string& name, const std::string& arg1, const std::string& arg2)
 {
-    epicsGuard<epicsMutex> _lock(m_executeLock);
     rapidjson::Document doc_send;
     rapidjson::Value arg1v, arg2v;
     rapidjson::Value typev(type.c_str(), doc_send.GetAllocator());
@@ -1431,6 +2552,11 @@ void NucInstDig::execute(const std::string& type, const std::string& name, const
     {
         arg1v.SetString(arg1.c_str(), doc_send.GetAllocator());
         doc_send.AddMember("args", arg1v, doc_send.GetAllocator());
+        if (!arg2.empty())
+        {
+            arg2v.SetString(arg2.c_str(), doc_send.GetAllocator());
+            doc_send.AddMember("format", arg2v, doc_send.GetAllocator());
+        }
     }
     else
     {
@@ -1440,21 +2566,26 @@ void NucInstDig::execute(const std::string& type, const std::string& name, const
     rapidjson::StringBuffer sb;
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     doc_send.Accept(writer);
-    std::string sendstr = sb.GetString();
-//    std::cout << "Sending " << sendstr << std::endl;
-    zmq::send_result_t nbytes_send = m_zmq_cmd.send(zmq::buffer(sendstr), zmq::send_flags::none);
-    if (!nbytes_send || *nbytes_send == 0)
+    return sb.GetString();
+}
+
+// wait for the reply to a command previously submitted to m_zmq_cmd
+zmq::message_t NucInstDig::receiveReply(const std::string& sendstr, std::future<zmq::message_t>& reply_future)
+{
+    try
     {
-        m_zmq_cmd.init();
-        throw std::runtime_error(std::string("unable to send: ") + type + " " + arg1 + " " + arg2);
+        return reply_future.get();
     }
-    zmq::message_t reply{};
-    zmq::recv_result_t nbytes_recv = m_zmq_cmd.recv(reply, zmq::recv_flags::none);
-    if (!nbytes_recv || *nbytes_recv == 0)
+    catch(const std::exception& ex)
     {
-        m_zmq_cmd.init();
-        throw std::runtime_error(std::string("unable to receive: ") + type + " " + arg1 + " " + arg2);
+        throw std::runtime_error(std::string("unable to receive: ") + sendstr + " (" + ex.what() + ")");
     }
+}
+
+// wait for the reply to a command previously submitted to m_zmq_cmd and check it succeeded
+void NucInstDig::completeCommand(const std::string& sendstr, std::future<zmq::message_t>& reply_future, rapidjson::Document& doc_recv)
+{
+    zmq::message_t reply = receiveReply(sendstr, reply_future);
 //    std::cout << "Received " << reply.to_string() << std::endl;
     doc_recv.Parse(reply.to_string().c_str());
     if (doc_recv["response"] != "ok")
@@ -1466,6 +2597,18 @@ void NucInstDig::execute(const std::string& type, const std::string& name, const
     }
 }
 
+// create a parameter for the event and trace streams, name has a %s for EVENTS or TRACES
+void NucInstDig::createStreamParams(const char* name, asynParamType type, int* param)
+{
+    static const char* streams[2] = { "EVENTS", "TRACES" };
+    char buffer[256];
+    for(int i=0; i<2; ++i)
+    {
+        sprintf(buffer, name, streams[i]);
+        createParam(buffer, type, &(param[i]));
+    }
+}
+
 void NucInstDig::createNParams(const char* name, asynParamType type, int* param, int n)
 {
     char buffer[256]; 
@@ -1476,12 +2619,33 @@ void NucInstDig::createNParams(const char* name, asynParamType type, int* param,
     }
 }
 
+// number of worker threads for each event histogram
+static int histogramThreads()
+{
+    static const int nthreads = atoi(getenv("NUCINSTDIG_HIST_THREADS") != NULL ? getenv("NUCINSTDIG_HIST_THREADS") : "2");
+    return nthreads;
+}
+
+// worker threads of the coincidence detector, each sweeps whole frames
+static int coincidenceThreads()
+{
+    static const int nthreads = atoi(getenv("NUCINSTDIG_COINC_THREADS") != NULL ? getenv("NUCINSTDIG_COINC_THREADS") : "2");
+    return nthreads;
+}
+
+// messages held between the event receive and processing threads
+static int eventsRingSize()
+{
+    static const int size = atoi(getenv("NUCINSTDIG_EVENTS_RING") != NULL ? getenv("NUCINSTDIG_EVENTS_RING") : "4096");
+    return size;
+}
+
 /// Constructor for the NucInstDigDriver class.
 /// Calls constructor for the asynPortDriver base class.
 /// \param[in] dcomint DCOM interface pointer created by lvDCOMConfigure()
 /// \param[in] portName @copydoc initArg0
 NucInstDig::NucInstDig(const char *portName, const char *targetAddress, int dig_idx)
-   : ADDriver(portName, 6, 100,
+   : ADDriver(portName, 9, 100,
 					0, // maxBuffers
 					0, // maxMemory
                     asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask | asynDrvUserMask, /* Interface mask */
@@ -1490,13 +2654,33 @@ NucInstDig::NucInstDig(const char *portName, const char *targetAddress, int dig_
                     1, /* Autoconnect */
                     0, /* Default priority */
                     0),	/* Default stack size*/
-                     m_zmq_events(zmq::socket_type::pull, std::string("tcp://") + targetAddress + ":5555", true),
-                     m_zmq_cmd(zmq::socket_type::req, std::string("tcp://") + targetAddress + ":5557"),
-#ifdef PULL_TRACES
+                     m_connected(false), m_zmq_cmd(std::string("tcp://") + targetAddress + ":5557"),
                      m_zmq_stream(zmq::socket_type::pull, std::string("tcp://") + targetAddress + ":5556", true),
+                     m_zmq_events(zmq::socket_type::pull, std::string("tcp://") + targetAddress + ":5555", false),
+                     m_paramBatchSize(64), m_paramBatchSupported(true), m_nParamBatchOk(0), m_nParamBatchFail(0), m_nParamSingleOk(0), m_nParamSingleFail(0),
+                     m_readBinary(true), m_readBinarySupported(true), m_readBinaryConfirmed(false), m_readBinaryActive(false),
+                     /*m_pTraces(NULL), m_pDCSpectra(NULL), m_pTOFSpectra(NULL),*/ m_pRaw(NULL),
+                     m_traces(8), m_timerQueue(epicsTimerQueueActive::allocate(true)), m_DCSpectraTimer(m_timerQueue, m_readDCSpectraEvent),
+                     m_TOFSpectraTimer(m_timerQueue, m_readTOFSpectraEvent), m_tracesTimer(m_timerQueue, m_readTracesEvent),
+                     m_eventsHWM(1000), m_eventsLossless(true),
+                     m_eventsReconfigure(true), m_eventsNMsgs(0), m_eventsNEvents(0), m_eventsNBytes(0), m_eventsNDropped(0),
+                     m_eventsRing(eventsRingSize()),
+#ifdef PULL_TRACES
+                     m_traceStream(true), // start streaming traces rather than waiting for TRACE_STREAM
+#else
+                     m_traceStream(false),
 #endif
-                     m_dig_idx(dig_idx), /*m_pTraces(NULL), m_pDCSpectra(NULL), m_pTOFSpectra(NULL),*/ m_pRaw(NULL),
-                     m_nDCSpec(0), m_nDCPts(0), m_nVoltage(0), m_NTRACE(8), m_nTOFSpec(0), m_nTOFPts(0), m_connected(false), m_dig_id(-1)
+                     m_traceFullRequest(false), m_traceStreamRate(2.0), m_traceStreamNPts(1000), m_traceStreamNMsgs(0), m_traceStreamNDropped(0),
+                     m_traceStreamReconfigure(false), m_traceHistNFrames(64), m_traceHistNChan(8), m_traceHistNPts(4096), m_traceHistNPre(4),
+                     m_traceHistNPost(4), m_traceHistPublished(0), m_pulseMatchNChan(8), m_pulseMatchWindow(100.0), m_pulseMatchNBins(100),
+                     m_eventsRepublisher(std::string(portName) + " events"), m_tracesRepublisher(std::string(portName) + " traces"),
+                     m_TOFHistogram(std::string(portName) + "TOF", EventHistogram::AxisTime, histogramThreads()), m_TOFHistogramConsumer(m_TOFHistogram),
+                     m_TOFHistNSpec(8), m_TOFHistTMin(0.0), m_TOFHistTMax(32768.0), m_TOFHistNBins(2048),
+                     m_numPeriods(1), m_vetoMask(0), m_vetoMode(HistogramEventConsumer::VetoIgnore),
+                     m_pulseHeight(std::string(portName) + "PH", EventHistogram::AxisVoltage, histogramThreads(), 4), m_pulseHeightConsumer(m_pulseHeight),
+                     m_pulseHeightNChan(8), m_pulseHeightVMin(0.0), m_pulseHeightVMax(65536.0), m_pulseHeightNBins(1024),
+                     m_coincidence(portName, coincidenceThreads()),
+                     m_dig_idx(dig_idx), m_dig_id(-1)
 {					
     const char *functionName = "NucInstDig";
 
@@ -1526,11 +2710,316 @@ NucInstDig::NucInstDig(const char *portName, const char *targetAddress, int dig_
     createParam(P_readTOFSpectraString, asynParamInt32, &P_readTOFSpectra);
     createParam(P_resetTOFSpectraString, asynParamInt32, &P_resetTOFSpectra);
     createParam(P_resetDCSpectraString, asynParamInt32, &P_resetDCSpectra);
+    createParam(P_paramBatchSizeString, asynParamInt32, &P_paramBatchSize);
+    createParam(P_paramSweepTimeString, asynParamFloat64, &P_paramSweepTime);
+    createParam(P_paramPollPeriodString, asynParamFloat64, &P_paramPollPeriod);
+    createNParams(P_cmdQueueDepthString, asynParamInt32, P_cmdQueueDepth, NCommandClasses);
+    createNParams(P_cmdQueueWaitString, asynParamFloat64, P_cmdQueueWait, NCommandClasses);
+    createNParams(P_readDataRateString, asynParamFloat64, P_readDataRate, 3);
+    createNParams(P_readDataSizeString, asynParamInt32, P_readDataSize, 3);
+    createParam(P_readBinaryString, asynParamInt32, &P_readBinary);
+    createParam(P_readBinaryActiveString, asynParamInt32, &P_readBinaryActive);
+    createParam(P_DCSpectraPeriodString, asynParamFloat64, &P_DCSpectraPeriod);
+    createParam(P_TOFSpectraPeriodString, asynParamFloat64, &P_TOFSpectraPeriod);
+    createParam(P_tracesPeriodString, asynParamFloat64, &P_tracesPeriod);
+    createParam(P_eventsHWMString, asynParamInt32, &P_eventsHWM);
+    createParam(P_eventsLosslessString, asynParamInt32, &P_eventsLossless);
+    createParam(P_eventsMsgRateString, asynParamFloat64, &P_eventsMsgRate);
+    createParam(P_eventsEventRateString, asynParamFloat64, &P_eventsEventRate);
+    createParam(P_eventsByteRateString, asynParamFloat64, &P_eventsByteRate);
+    createParam(P_eventsDropRateString, asynParamFloat64, &P_eventsDropRate);
+    createParam(P_eventsDroppedString, asynParamInt32, &P_eventsDropped);
+    createParam(P_TOFSourceString, asynParamInt32, &P_TOFSource);
+    createParam(P_TOFHistNSpecString, asynParamInt32, &P_TOFHistNSpec);
+    createParam(P_TOFHistTMinString, asynParamFloat64, &P_TOFHistTMin);
+    createParam(P_TOFHistTMaxString, asynParamFloat64, &P_TOFHistTMax);
+    createParam(P_TOFHistNBinsString, asynParamInt32, &P_TOFHistNBins);
+    createParam(P_TOFHistEdgesString, asynParamFloat64Array, &P_TOFHistEdges);
+    createParam(P_TOFHistDroppedString, asynParamInt32, &P_TOFHistDropped);
+    createParam(P_TOFHistOutsideString, asynParamInt32, &P_TOFHistOutside);
+    createParam(P_pulseHeightString, asynParamInt32, &P_pulseHeight);
+    createParam(P_resetPulseHeightString, asynParamInt32, &P_resetPulseHeight);
+    createParam(P_pulseHeightNChanString, asynParamInt32, &P_pulseHeightNChan);
+    createParam(P_pulseHeightVMinString, asynParamFloat64, &P_pulseHeightVMin);
+    createParam(P_pulseHeightVMaxString, asynParamFloat64, &P_pulseHeightVMax);
+    createParam(P_pulseHeightNBinsString, asynParamInt32, &P_pulseHeightNBins);
+    createParam(P_pulseHeightDroppedString, asynParamInt32, &P_pulseHeightDropped);
+    createParam(P_pulseHeightOutsideString, asynParamInt32, &P_pulseHeightOutside);
+    createParam(P_numPeriodsString, asynParamInt32, &P_numPeriods);
+    createParam(P_vetoMaskString, asynParamInt32, &P_vetoMask);
+    createParam(P_vetoModeString, asynParamInt32, &P_vetoMode);
+    createParam(P_currentPeriodString, asynParamInt32, &P_currentPeriod);
+    createParam(P_rawFramesString, asynParamInt32, &P_rawFrames);
+    createParam(P_goodFramesString, asynParamInt32, &P_goodFrames);
+    createParam(P_vetoedFramesString, asynParamInt32, &P_vetoedFrames);
+    createParam(P_protonChargeString, asynParamFloat64, &P_protonCharge);
+    createParam(P_periodGoodFramesString, asynParamFloat64Array, &P_periodGoodFrames);
+    createParam(P_periodProtonChargeString, asynParamFloat64Array, &P_periodProtonCharge);
+    createParam(P_resetFrameStatsString, asynParamInt32, &P_resetFrameStats);
+    createStreamParams(P_framesString, asynParamInt32, P_frames);
+    createStreamParams(P_framesMissingString, asynParamInt32, P_framesMissing);
+    createStreamParams(P_framesDuplicateString, asynParamInt32, P_framesDuplicate);
+    createStreamParams(P_framesOutOfOrderString, asynParamInt32, P_framesOutOfOrder);
+    createStreamParams(P_frameLatencyP50String, asynParamFloat64, P_frameLatencyP50);
+    createStreamParams(P_frameLatencyP90String, asynParamFloat64, P_frameLatencyP90);
+    createStreamParams(P_frameLatencyP99String, asynParamFloat64, P_frameLatencyP99);
+    createStreamParams(P_frameLatencyMaxString, asynParamFloat64, P_frameLatencyMax);
+    createStreamParams(P_republishedString, asynParamInt32, P_republished);
+    createStreamParams(P_republishDroppedString, asynParamInt32, P_republishDropped);
+    {
+        epicsGuard<epicsMutex> _lock(g_digCombinedLock);
+        m_mergeOwner = g_dig_list.empty();
+    }
+    P_mergeEvents = P_mergeWindow = P_mergeTimeout = P_mergeNChan = P_mergeFrames = -1;
+    P_mergeIncomplete = P_mergeLate = P_mergePending = P_mergeNDig = P_mergeMismatched = P_mergeBadChan = -1;
+    if (m_mergeOwner) {
+        createParam(P_mergeEventsString, asynParamInt32, &P_mergeEvents);
+        createParam(P_mergeWindowString, asynParamInt32, &P_mergeWindow);
+        createParam(P_mergeTimeoutString, asynParamFloat64, &P_mergeTimeout);
+        createParam(P_mergeNChanString, asynParamInt32, &P_mergeNChan);
+        createParam(P_mergeFramesString, asynParamInt32, &P_mergeFrames);
+        createParam(P_mergeIncompleteString, asynParamInt32, &P_mergeIncomplete);
+        createParam(P_mergeLateString, asynParamInt32, &P_mergeLate);
+        createParam(P_mergePendingString, asynParamInt32, &P_mergePending);
+        createParam(P_mergeNDigString, asynParamInt32, &P_mergeNDig);
+        createParam(P_mergeMismatchedString, asynParamInt32, &P_mergeMismatched);
+        createParam(P_mergeBadChanString, asynParamInt32, &P_mergeBadChan);
+    }
+    createParam(P_eventsRingPolicyString, asynParamInt32, &P_eventsRingPolicy);
+    createParam(P_eventsRingSizeString, asynParamInt32, &P_eventsRingSize);
+    createParam(P_eventsRingUsedString, asynParamInt32, &P_eventsRingUsed);
+    createParam(P_eventsRingHWMString, asynParamInt32, &P_eventsRingHWM);
+    createParam(P_eventsRingDroppedString, asynParamInt32, &P_eventsRingDropped);
+    createParam(P_eventsRingBlockedString, asynParamInt32, &P_eventsRingBlocked);
+    createParam(P_eventsFilterString, asynParamInt32, &P_eventsFilter);
+    createParam(P_eventsFilterChanMaskString, asynParamInt32, &P_eventsFilterChanMask);
+    createParam(P_eventsFilterVMinString, asynParamFloat64Array, &P_eventsFilterVMin);
+    createParam(P_eventsFilterVMaxString, asynParamFloat64Array, &P_eventsFilterVMax);
+    createParam(P_eventsFilterTMinString, asynParamFloat64, &P_eventsFilterTMin);
+    createParam(P_eventsFilterTMaxString, asynParamFloat64, &P_eventsFilterTMax);
+    createParam(P_eventsFilterRejectedString, asynParamFloat64Array, &P_eventsFilterRejected);
+    createParam(P_eventsFilterNRejectedString, asynParamInt32, &P_eventsFilterNRejected);
+    createParam(P_eventsFilterNPassedString, asynParamInt32, &P_eventsFilterNPassed);
+    createParam(P_coincString, asynParamInt32, &P_coinc);
+    createParam(P_coincSourceString, asynParamInt32, &P_coincSource);
+    createParam(P_coincNChanString, asynParamInt32, &P_coincNChan);
+    createParam(P_coincWindowString, asynParamFloat64, &P_coincWindow);
+    createParam(P_coincPairsString, asynParamFloat64Array, &P_coincPairs);
+    createParam(P_coincOutputString, asynParamInt32, &P_coincOutput);
+    createParam(P_coincResetString, asynParamInt32, &P_coincReset);
+    createParam(P_coincCountsString, asynParamFloat64Array, &P_coincCounts);
+    createParam(P_coincRatesString, asynParamFloat64Array, &P_coincRates);
+    createParam(P_coincSinglesRatesString, asynParamFloat64Array, &P_coincSinglesRates);
+    createParam(P_coincFramesString, asynParamInt32, &P_coincFrames);
+    createParam(P_coincTotalString, asynParamInt32, &P_coincTotal);
+    createParam(P_coincDroppedString, asynParamInt32, &P_coincDropped);
+    createParam(P_asymString, asynParamInt32, &P_asym);
+    createParam(P_asymGroupingFileString, asynParamOctet, &P_asymGroupingFile);
+    createParam(P_asymGroupingString, asynParamFloat64Array, &P_asymGrouping);
+    createParam(P_asymAlphaString, asynParamFloat64, &P_asymAlpha);
+    createParam(P_asymBgFirstString, asynParamInt32, &P_asymBgFirst);
+    createParam(P_asymBgLastString, asynParamInt32, &P_asymBgLast);
+    createParam(P_asymNFwdString, asynParamInt32, &P_asymNFwd);
+    createParam(P_asymNBwdString, asynParamInt32, &P_asymNBwd);
+    createParam(P_asymXString, asynParamFloat64Array, &P_asymX);
+    createParam(P_asymYString, asynParamFloat64Array, &P_asymY);
+    createParam(P_asymEString, asynParamFloat64Array, &P_asymE);
+    createParam(P_asymFwdString, asynParamFloat64Array, &P_asymFwd);
+    createParam(P_asymBwdString, asynParamFloat64Array, &P_asymBwd);
+    createParam(P_asymFwdTotalString, asynParamFloat64, &P_asymFwdTotal);
+    createParam(P_asymBwdTotalString, asynParamFloat64, &P_asymBwdTotal);
+    createParam(P_asymIntegralString, asynParamFloat64, &P_asymIntegral);
+    createParam(P_asymIntegralErrString, asynParamFloat64, &P_asymIntegralErr);
+    createParam(P_traceStreamString, asynParamInt32, &P_traceStream);
+    createParam(P_traceStreamRateString, asynParamFloat64, &P_traceStreamRate);
+    createParam(P_traceStreamNPtsString, asynParamInt32, &P_traceStreamNPts);
+    createParam(P_traceStreamMsgsString, asynParamInt32, &P_traceStreamMsgs);
+    createParam(P_traceStreamDroppedString, asynParamInt32, &P_traceStreamDropped);
+    createParam(P_traceAvgString, asynParamInt32, &P_traceAvg);
+    createParam(P_traceAvgNFramesString, asynParamInt32, &P_traceAvgNFrames);
+    createParam(P_traceAvgCountString, asynParamInt32, &P_traceAvgCount);
+    createParam(P_traceAvgResetString, asynParamInt32, &P_traceAvgReset);
+    createParam(P_traceHistString, asynParamInt32, &P_traceHist);
+    createParam(P_traceHistNFramesString, asynParamInt32, &P_traceHistNFrames);
+    createParam(P_traceHistNChanString, asynParamInt32, &P_traceHistNChan);
+    createParam(P_traceHistNPtsString, asynParamInt32, &P_traceHistNPts);
+    createParam(P_traceHistNPreString, asynParamInt32, &P_traceHistNPre);
+    createParam(P_traceHistNPostString, asynParamInt32, &P_traceHistNPost);
+    createParam(P_traceHistTrigString, asynParamInt32, &P_traceHistTrig);
+    createParam(P_traceHistTrigChanString, asynParamInt32, &P_traceHistTrigChan);
+    createParam(P_traceHistTrigLevelString, asynParamInt32, &P_traceHistTrigLevel);
+    createParam(P_traceHistArmString, asynParamInt32, &P_traceHistArm);
+    createParam(P_traceHistTriggerString, asynParamInt32, &P_traceHistTrigger);
+    createParam(P_traceHistStateString, asynParamInt32, &P_traceHistState);
+    createParam(P_traceHistCapturesString, asynParamInt32, &P_traceHistCaptures);
+    createParam(P_traceHistTrigFrameString, asynParamInt32, &P_traceHistTrigFrame);
+    createParam(P_pulseFindString, asynParamInt32, &P_pulseFind);
+    createParam(P_pulseFindModeString, asynParamInt32, &P_pulseFindMode);
+    createParam(P_pulseFindPolarityString, asynParamInt32, &P_pulseFindPolarity);
+    createParam(P_pulseFindThresholdString, asynParamInt32, &P_pulseFindThreshold);
+    createParam(P_pulseFindFractionString, asynParamFloat64, &P_pulseFindFraction);
+    createParam(P_pulseFindBaselineString, asynParamInt32, &P_pulseFindBaseline);
+    createParam(P_pulseFindTracesString, asynParamInt32, &P_pulseFindTraces);
+    createParam(P_pulseFindPulsesString, asynParamInt32, &P_pulseFindPulses);
+    createParam(P_pulseFindChanString, asynParamFloat64Array, &P_pulseFindChan);
+    createParam(P_pulseFindTimeString, asynParamFloat64Array, &P_pulseFindTime);
+    createParam(P_pulseFindAmplString, asynParamFloat64Array, &P_pulseFindAmpl);
+    createParam(P_pulseMatchNChanString, asynParamInt32, &P_pulseMatchNChan);
+    createParam(P_pulseMatchWindowString, asynParamFloat64, &P_pulseMatchWindow);
+    createParam(P_pulseMatchNBinsString, asynParamInt32, &P_pulseMatchNBins);
+    createParam(P_pulseMatchResetString, asynParamInt32, &P_pulseMatchReset);
+    createParam(P_pulseMatchEffString, asynParamFloat64, &P_pulseMatchEff);
+    createParam(P_pulseMatchChanEffString, asynParamFloat64Array, &P_pulseMatchChanEff);
+    createParam(P_pulseMatchDTXString, asynParamFloat64Array, &P_pulseMatchDTX);
+    createParam(P_pulseMatchDTString, asynParamFloat64Array, &P_pulseMatchDT);
+    createParam(P_pulseMatchDTChanString, asynParamFloat64Array, &P_pulseMatchDTChan);
+    createParam(P_pulseMatchFramesString, asynParamInt32, &P_pulseMatchFrames);
+    createParam(P_pulseMatchPulsesString, asynParamInt32, &P_pulseMatchPulses);
+    createParam(P_pulseMatchEventsString, asynParamInt32, &P_pulseMatchEvents);
+    createParam(P_pulseMatchMatchedString, asynParamInt32, &P_pulseMatchMatched);
+    createParam(P_pulseMatchNoEventsString, asynParamInt32, &P_pulseMatchNoEvents);
+    createParam(P_pulseMatchNoTracesString, asynParamInt32, &P_pulseMatchNoTraces);
     
     setStringParam(P_setupFile, "");
     setStringParam(P_error, "");
     setIntegerParam(P_setupDone, 0);
     setIntegerParam(P_ZMQConnected, 0);
+    setIntegerParam(P_paramBatchSize, m_paramBatchSize);
+    setIntegerParam(P_readBinary, 1);
+    setDoubleParam(P_DCSpectraPeriod, 1.0);
+    setDoubleParam(P_TOFSpectraPeriod, 1.0);
+    setDoubleParam(P_tracesPeriod, 0.0);
+    setIntegerParam(P_eventsHWM, m_eventsHWM);
+    setIntegerParam(P_eventsLossless, 1);
+    setDoubleParam(P_eventsMsgRate, 0.0);
+    setDoubleParam(P_eventsEventRate, 0.0);
+    setDoubleParam(P_eventsByteRate, 0.0);
+    setDoubleParam(P_eventsDropRate, 0.0);
+    setIntegerParam(P_eventsDropped, 0);
+    setIntegerParam(P_eventsRingPolicy, m_eventsRing.policy());
+    setIntegerParam(P_eventsRingSize, static_cast<int>(m_eventsRing.capacity()));
+    setIntegerParam(P_eventsRingUsed, 0);
+    setIntegerParam(P_eventsRingHWM, 0);
+    setIntegerParam(P_eventsRingDropped, 0);
+    setIntegerParam(P_eventsRingBlocked, 0);
+    setIntegerParam(P_eventsFilter, 0);
+    setIntegerParam(P_eventsFilterChanMask, -1);
+    setDoubleParam(P_eventsFilterTMin, 0.0);
+    setDoubleParam(P_eventsFilterTMax, 0.0);
+    setIntegerParam(P_eventsFilterNRejected, 0);
+    setIntegerParam(P_eventsFilterNPassed, 0);
+    setIntegerParam(P_TOFSource, 0);
+    setIntegerParam(P_TOFHistNSpec, m_TOFHistNSpec);
+    setDoubleParam(P_TOFHistTMin, m_TOFHistTMin);
+    setDoubleParam(P_TOFHistTMax, m_TOFHistTMax);
+    setIntegerParam(P_TOFHistNBins, m_TOFHistNBins);
+    setIntegerParam(P_TOFHistDropped, 0);
+    setIntegerParam(P_TOFHistOutside, 0);
+    configureTOFHistogram();
+    setIntegerParam(P_numPeriods, m_numPeriods);
+    setIntegerParam(P_vetoMask, m_vetoMask);
+    setIntegerParam(P_vetoMode, m_vetoMode);
+    setIntegerParam(P_currentPeriod, 0);
+    setIntegerParam(P_rawFrames, 0);
+    setIntegerParam(P_goodFrames, 0);
+    setIntegerParam(P_vetoedFrames, 0);
+    setDoubleParam(P_protonCharge, 0.0);
+    configurePeriods();
+    addEventConsumer(&m_TOFHistogramConsumer);
+    setIntegerParam(P_pulseHeight, 0);
+    setIntegerParam(P_pulseHeightNChan, m_pulseHeightNChan);
+    setDoubleParam(P_pulseHeightVMin, m_pulseHeightVMin);
+    setDoubleParam(P_pulseHeightVMax, m_pulseHeightVMax);
+    setIntegerParam(P_pulseHeightNBins, m_pulseHeightNBins);
+    setIntegerParam(P_pulseHeightDropped, 0);
+    setIntegerParam(P_pulseHeightOutside, 0);
+    configurePulseHeight();
+    addEventConsumer(&m_pulseHeightConsumer);
+    if (m_mergeOwner) {
+        setIntegerParam(P_mergeEvents, 0);
+        setIntegerParam(P_mergeWindow, 16);
+        setDoubleParam(P_mergeTimeout, 0.5);
+        setIntegerParam(P_mergeNChan, 0);
+    }
+    addEventConsumer(&frameMerger());
+    frameMerger().addConsumer(&m_TOFHistogramConsumer);
+    setIntegerParam(P_coinc, 0);
+    setIntegerParam(P_coincSource, 0);
+    setIntegerParam(P_coincNChan, 8);
+    setDoubleParam(P_coincWindow, 10.0);
+    setIntegerParam(P_coincOutput, CoincidenceDetector::OutputNone);
+    setIntegerParam(P_coincFrames, 0);
+    setIntegerParam(P_coincTotal, 0);
+    setIntegerParam(P_coincDropped, 0);
+    addEventConsumer(&m_coincidence);
+    addEventConsumer(&m_pulseMatcher);
+    frameMerger().addConsumer(&m_coincidence);
+    setIntegerParam(P_asym, 0);
+    setStringParam(P_asymGroupingFile, "");
+    setDoubleParam(P_asymAlpha, m_asymmetry.alpha());
+    setIntegerParam(P_asymBgFirst, 0);
+    setIntegerParam(P_asymBgLast, -1);
+    setIntegerParam(P_asymNFwd, 0);
+    setIntegerParam(P_asymNBwd, 0);
+    setDoubleParam(P_asymFwdTotal, 0.0);
+    setDoubleParam(P_asymBwdTotal, 0.0);
+    setDoubleParam(P_asymIntegral, 0.0);
+    setDoubleParam(P_asymIntegralErr, 0.0);
+    setIntegerParam(P_traceStream, (m_traceStream ? 1 : 0));
+    setDoubleParam(P_traceStreamRate, m_traceStreamRate);
+    setIntegerParam(P_traceStreamNPts, m_traceStreamNPts);
+    setIntegerParam(P_traceStreamMsgs, 0);
+    setIntegerParam(P_traceStreamDropped, 0);
+    setIntegerParam(P_traceAvg, TraceAverager::ModeOff);
+    setIntegerParam(P_traceAvgNFrames, 16);
+    setIntegerParam(P_traceAvgCount, 0);
+    setIntegerParam(P_traceAvgReset, 0);
+    setIntegerParam(P_traceHist, 0);
+    setIntegerParam(P_traceHistNFrames, m_traceHistNFrames);
+    setIntegerParam(P_traceHistNChan, m_traceHistNChan);
+    setIntegerParam(P_traceHistNPts, m_traceHistNPts);
+    setIntegerParam(P_traceHistNPre, m_traceHistNPre);
+    setIntegerParam(P_traceHistNPost, m_traceHistNPost);
+    setIntegerParam(P_traceHistTrig, TraceHistory::TriggerNone);
+    setIntegerParam(P_traceHistTrigChan, -1);
+    setIntegerParam(P_traceHistTrigLevel, 0);
+    setIntegerParam(P_traceHistArm, 0);
+    setIntegerParam(P_traceHistTrigger, 0);
+    setIntegerParam(P_traceHistState, TraceHistory::StateIdle);
+    setIntegerParam(P_traceHistCaptures, 0);
+    setIntegerParam(P_traceHistTrigFrame, 0);
+    configureTraceHistory();
+    setIntegerParam(P_pulseFind, 0);
+    setIntegerParam(P_pulseFindMode, PulseFinder::ModeThreshold);
+    setIntegerParam(P_pulseFindPolarity, PulseFinder::PolarityPositive);
+    setIntegerParam(P_pulseFindThreshold, 100);
+    setDoubleParam(P_pulseFindFraction, 0.5);
+    setIntegerParam(P_pulseFindBaseline, 16);
+    setIntegerParam(P_pulseFindTraces, 0);
+    setIntegerParam(P_pulseFindPulses, 0);
+    setIntegerParam(P_pulseMatchNChan, m_pulseMatchNChan);
+    setDoubleParam(P_pulseMatchWindow, m_pulseMatchWindow);
+    setIntegerParam(P_pulseMatchNBins, m_pulseMatchNBins);
+    setIntegerParam(P_pulseMatchReset, 0);
+    setDoubleParam(P_pulseMatchEff, 0.0);
+    setIntegerParam(P_pulseMatchFrames, 0);
+    setIntegerParam(P_pulseMatchPulses, 0);
+    setIntegerParam(P_pulseMatchEvents, 0);
+    setIntegerParam(P_pulseMatchMatched, 0);
+    setIntegerParam(P_pulseMatchNoEvents, 0);
+    setIntegerParam(P_pulseMatchNoTraces, 0);
+    configurePulseMatcher();
+    m_DCSpectraTimer.setPeriod(1.0);
+    m_TOFSpectraTimer.setPeriod(1.0);
+    setIntegerParam(P_readBinaryActive, 0);
+    for(int i=0; i<3; ++i) {
+        m_readDataRate[i] = 0.0;
+        m_readDataSize[i] = 0;
+        setDoubleParam(P_readDataRate[i], 0.0);
+        setIntegerParam(P_readDataSize[i], 0);
+    }
+    setDoubleParam(P_paramSweepTime, 0.0);
+    setDoubleParam(P_paramPollPeriod, 3.0);
     
 	//int maxSizes[2][2] = { {16, 20000}, { 16, 4096 } };
     NDDataType_t dataType = NDFloat64; // data type for each frame
@@ -1562,6 +3051,7 @@ NucInstDig::NucInstDig(const char *portName, const char *targetAddress, int dig_
 		status |= setDoubleParam (i, ADAcquirePeriod, .005);
 		status |= setIntegerParam(i, ADNumImages, 100);
     }
+    status |= setIntegerParam(1, NDDataType, NDUInt16); // traces are published as the ADC samples, see computeImage()
 
     if (status) {
         printf("%s: unable to set DAE parameters\n", functionName);
@@ -1594,14 +3084,30 @@ NucInstDig::NucInstDig(const char *portName, const char *targetAddress, int dig_
         printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
         return;
     }
+    if (epicsThreadCreate("NucInstDigPoller8",
+                          epicsThreadPriorityMedium, // streamed traces
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)pollerThreadC8, this) == 0)
+    {
+        printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+        return;
+    }
     if (epicsThreadCreate("NucInstDigPoller3",
-                          epicsThreadPriorityMedium,
+                          epicsThreadPriorityHigh, // event ingest, needs to keep up with the digitiser
                           epicsThreadGetStackSize(epicsThreadStackMedium),
                           (EPICSTHREADFUNC)pollerThreadC3, this) == 0)
     {
         printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
         return;
     }
+    if (epicsThreadCreate("NucInstDigPoller7",
+                          epicsThreadPriorityMedium, // event processing, m_eventsRing absorbs delays
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)pollerThreadC7, this) == 0)
+    {
+        printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+        return;
+    }
     if (epicsThreadCreate("NucInstDigPoller4",
                           epicsThreadPriorityMedium,
                           epicsThreadGetStackSize(epicsThreadStackMedium),
@@ -1682,6 +3188,24 @@ void NucInstDig::pollerThreadC6(void* arg)
 	}
 }
 
+void NucInstDig::pollerThreadC7(void* arg)
+{
+    NucInstDig* driver = (NucInstDig*)arg;
+	if (driver != NULL)
+	{
+	    driver->pollerThread7();
+	}
+}
+
+void NucInstDig::pollerThreadC8(void* arg)
+{
+    NucInstDig* driver = (NucInstDig*)arg;
+	if (driver != NULL)
+	{
+	    driver->pollerThread8();
+	}
+}
+
 void NucInstDig::zmqMonitorPollerC(void* arg)
 {
     NucInstDig* driver = (NucInstDig*)arg;
@@ -1691,52 +3215,264 @@ void NucInstDig::zmqMonitorPollerC(void* arg)
 	}
 }
 
+void NucInstDig::setParamFromValue(int param, ParamData* p, const rapidjson::Value& value)
+{
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    p->last_read = now.secPastEpoch + now.nsec / 1.e9;
+    if (p->type == asynParamInt32)
+    {
+        setIntegerParam(param, (value.IsInt() ? value.GetInt() : atoi(value.GetString())));
+    }
+    else if (p->type == asynParamFloat64)
+    {
+        setDoubleParam(param, (value.IsNumber() ? value.GetDouble() : atof(value.GetString())));
+    }
+    else if (p->type == asynParamOctet)
+    {
+        setStringParam(param, value.GetString());
+    }
+    else
+    {
+        std::cerr << "pollerThread1: invalid type " << p->type << " for " << p->name << std::endl;
+    }
+}
+
+// digitiser firmware that supports it can return several parameters in one round trip using
+//   {"command":"get_parameters","params":[{"name":name,"idx":idx},...]}
+// with reply {"response":"ok","values":[value,...]} in the same order as requested
+std::string NucInstDig::formatGetParamsCommand(const ParamBatch& batch)
+{
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    writer.StartObject();
+    writer.Key("command");
+    writer.String("get_parameters");
+    writer.Key("params");
+    writer.StartArray();
+    for(const auto& kv : batch)
+    {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(kv.second->name.c_str());
+        writer.Key("idx");
+        writer.Int(kv.second->chan);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return sb.GetString();
+}
+
+void NucInstDig::completeParamBatch(const ParamBatch& batch, const std::string& sendstr, std::future<zmq::message_t>& reply_future)
+{
+    rapidjson::Document doc_recv;
+    completeCommand(sendstr, reply_future, doc_recv);
+    if (batch.size() == 1)
+    {
+        epicsGuard<NucInstDig> _lock(*this);
+        setParamFromValue(batch[0].first, batch[0].second, doc_recv["value"]);
+        ++m_nParamSingleOk;
+        return;
+    }
+    const rapidjson::Value& values = doc_recv["values"];
+    if (!values.IsArray() || values.Size() != batch.size())
+    {
+        throw std::runtime_error(std::string("invalid get_parameters reply to ") + sendstr);
+    }
+    epicsGuard<NucInstDig> _lock(*this);
+    for(rapidjson::SizeType i = 0; i < values.Size(); ++i)
+    {
+        setParamFromValue(batch[i].first, batch[i].second, values[i]);
+    }
+    ++m_nParamBatchOk;
+}
+
+// a get_parameters command failed, either the firmware does not support it or a parameter
+// in the batch is bad. Split in two and retry each half, down to single get_parameter commands
+void NucInstDig::readParamBatchSplit(const ParamBatch& batch)
+{
+    ParamBatch halves[2];
+    std::string requests[2];
+    std::future<zmq::message_t> replies[2];
+    size_t mid = batch.size() / 2;
+    halves[0].assign(batch.begin(), batch.begin() + mid);
+    halves[1].assign(batch.begin() + mid, batch.end());
+    for(int i=0; i<2; ++i)
+    {
+        if (halves[i].size() == 1)
+        {
+            char idxStr[16];
+            sprintf(idxStr, "%d", halves[i][0].second->chan);
+            requests[i] = formatCommand("get_parameter", halves[i][0].second->name, idxStr, "");
+        }
+        else
+        {
+            requests[i] = formatGetParamsCommand(halves[i]);
+        }
+        replies[i] = m_zmq_cmd.submit(requests[i], CmdReadback);
+    }
+    for(int i=0; i<2; ++i)
+    {
+        try
+        {
+            completeParamBatch(halves[i], requests[i], replies[i]);
+        }
+        catch(const std::exception& ex)
+        {
+            if (halves[i].size() > 1)
+            {
+                ++m_nParamBatchFail;
+                readParamBatchSplit(halves[i]);
+            }
+            else
+            {
+                ++m_nParamSingleFail;
+                std::cerr << "pollerThread1: exception " << ex.what() << " for parameter " << halves[i][0].second->name << " channel " << halves[i][0].second->chan << std::endl;
+            }
+        }
+    }
+}
+
+// read a set of parameters, batched into get_parameters commands where possible
+void NucInstDig::readParams(const ParamBatch& params)
+{
+    std::vector<ParamBatch> batches;
+    std::vector<std::string> requests;
+    std::vector< std::future<zmq::message_t> > replies;
+    int batch_size_sp = m_paramBatchSize;
+    size_t batch_size = (m_paramBatchSupported && batch_size_sp > 1 ? batch_size_sp : 1);
+    for(size_t i=0; i<params.size(); i += batch_size)
+    {
+        batches.push_back(ParamBatch(params.begin() + i, params.begin() + std::min(i + batch_size, params.size())));
+    }
+    // submit all requests first so they are pipelined on the command channel, then collect the replies
+    for(const auto& batch : batches)
+    {
+        if (batch.size() == 1)
+        {
+            char idxStr[16];
+            sprintf(idxStr, "%d", batch[0].second->chan);
+            requests.push_back(formatCommand("get_parameter", batch[0].second->name, idxStr, ""));
+        }
+        else
+        {
+            requests.push_back(formatGetParamsCommand(batch));
+        }
+        replies.push_back(m_zmq_cmd.submit(requests.back(), CmdReadback));
+    }
+    m_nParamBatchOk = m_nParamBatchFail = m_nParamSingleOk = m_nParamSingleFail = 0;
+    for(size_t i=0; i<batches.size(); ++i)
+    {
+        const ParamBatch& batch = batches[i];
+        try
+        {
+            completeParamBatch(batch, requests[i], replies[i]);
+        }
+        catch(const std::exception& ex)
+        {
+            if (batch.size() > 1)
+            {
+                ++m_nParamBatchFail;
+                readParamBatchSplit(batch);
+            }
+            else
+            {
+                ++m_nParamSingleFail;
+                std::cerr << "pollerThread1: exception " << ex.what() << " for parameter " << batch[0].second->name << " channel " << batch[0].second->chan << std::endl;
+            }
+        }
+    }
+    // every batch failed but each parameter could be read on its own
+    if (m_nParamBatchFail > 1 && m_nParamBatchOk == 0 && m_nParamSingleFail == 0 && m_nParamSingleOk > 0)
+    {
+        std::cerr << "pollerThread1: get_parameters not supported by digitiser, reading parameters individually" << std::endl;
+        m_paramBatchSupported = false;
+    }
+}
+
+// Each parameter is polled at its own rate given by log_freq in its drvInfo, parameters are kept in
+// a heap ordered by when they are next due and all those due are read together
 void NucInstDig::pollerThread1()
 {
     static const char* functionName = "NucInstDigPoller1";
-    unsigned long counter = 0;
+    typedef std::pair<double, int> PollEntry; // (time due, asyn param index)
+    std::priority_queue< PollEntry, std::vector<PollEntry>, std::greater<PollEntry> > poll_queue;
+    size_t nscheduled = 0;
+    ParamBatch params;
+    epicsTimeStamp now_ts;
+    double now, poll_period;
     while(true)
     {
         try
         {
-            for(const auto& kv : m_param_data)
+            epicsTimeGetCurrent(&now_ts);
+            now = now_ts.secPastEpoch + now_ts.nsec / 1.e9;
+            params.resize(0);
             {
-                const ParamData* p = kv.second;
-                try
+                // parameters are created in drvUserCreate() as records initialise, which adds to m_param_data
+                // under the same lock, schedule any new ones
+                epicsGuard<NucInstDig> _lock(*this);
+                if (m_param_data.size() != nscheduled)
                 {
-                    rapidjson::Document doc_recv;
-                    getParameter(p->name, doc_recv, p->chan);
-                    rapidjson::Value& value = doc_recv["value"];
-                    epicsGuard<NucInstDig> _lock(*this);
-                    if (p->type == asynParamInt32)
-                    {
-                        setIntegerParam(kv.first, (value.IsInt() ? value.GetInt() : atoi(value.GetString())));
-                    }
-                    else if (p->type == asynParamFloat64)
+                    for(const auto& kv : m_param_data)
                     {
-                        setDoubleParam(kv.first, (value.IsNumber() ? value.GetDouble() : atof(value.GetString())));
-                    }
-                    else if (p->type == asynParamOctet)
-                    {
-                        setStringParam(kv.first, value.GetString());
+                        if (kv.second->poll_due == 0.0)
+                        {
+                            kv.second->poll_due = now;
+                            poll_queue.push(PollEntry(now, kv.first));
+                        }
                     }
-                    else
+                    nscheduled = m_param_data.size();
+                }
+                while (!poll_queue.empty() && poll_queue.top().first <= now)
+                {
+                    int param = poll_queue.top().second;
+                    poll_queue.pop();
+                    auto it = m_param_data.find(param);
+                    if (it != m_param_data.end())
                     {
-                        std::cerr << "pollerThread1: invalid type " << p->type << " for " << p->name << std::endl;
+                        params.push_back(*it);
                     }
                 }
-                catch(const std::exception& ex)
+            }
+            if (params.size() > 0)
+            {
+                double start = now;
+                readParams(params);
                 {
-                    std::cerr << "pollerThread1: exception " << ex.what() << " for parameter " << p->name << " channel " << p->chan << std::endl;
-                    epicsThreadSleep(1.0);
+                    epicsGuard<NucInstDig> _lock(*this);
+                    getDoubleParam(P_paramPollPeriod, &poll_period);
                 }
-                catch(...)
+                epicsTimeGetCurrent(&now_ts);
+                now = now_ts.secPastEpoch + now_ts.nsec / 1.e9;
+                epicsGuard<NucInstDig> _lock(*this);
+                for(const auto& kv : params)
                 {
-                    std::cerr << "pollerThread1: exception for parameter " << p->name << " channel " << p->chan << std::endl;
-                    epicsThreadSleep(1.0);
+                    ParamData* p = kv.second;
+                    bool read_ok = (p->last_read >= p->poll_due);
+                    if (read_ok)
+                    {
+                        p->poll_latency = p->last_read - p->poll_due;
+                        char key[16];
+                        sprintf(key, "_%d", p->chan);
+                        auto it = m_param_latency.find(p->name + key);
+                        if (it != m_param_latency.end())
+                        {
+                            setDoubleParam(it->second, p->poll_latency);
+                        }
+                    }
+                    if (read_ok && p->log_freq < 0)
+                    {
+                        continue; // static value, only needs reading once
+                    }
+                    double period = (p->log_freq > 0 ? p->log_freq : poll_period);
+                    p->poll_due = std::max(p->poll_due + period, now);
+                    poll_queue.push(PollEntry(p->poll_due, kv.first));
                 }
+                setDoubleParam(P_paramSweepTime, now - start);
+                callParamCallbacks();
             }
-            callParamCallbacks();
         }
         catch(const std::exception& ex)
         {
@@ -1748,7 +3484,14 @@ void NucInstDig::pollerThread1()
             std::cerr << "pollerThread1: exception " << std::endl;
             epicsThreadSleep(3.0);
         }
-        epicsThreadSleep(3.0);
+        // wake at least once a second to pick up newly created parameters
+        epicsTimeGetCurrent(&now_ts);
+        now = now_ts.secPastEpoch + now_ts.nsec / 1.e9;
+        double delay = (poll_queue.empty() ? 1.0 : std::min(1.0, poll_queue.top().first - now));
+        if (delay > 0.0)
+        {
+            epicsThreadSleep(delay);
+        }
     }
 }
 
@@ -1759,12 +3502,24 @@ void NucInstDig::pollerThread2()
     updateTracesOnRequest();
 }
 
+void NucInstDig::pollerThread8()
+{
+    static const char* functionName = "NucInstDigPoller8";
+    updateTraces();
+}
+
 void NucInstDig::pollerThread3()
 {
     static const char* functionName = "NucInstDigPoller3";
     updateEvents();
 }
 
+void NucInstDig::pollerThread7()
+{
+    static const char* functionName = "NucInstDigPoller7";
+    processEvents();
+}
+
 void NucInstDig::pollerThread4()
 {
     static const char* functionName = "NucInstDigPoller4";
@@ -1786,15 +3541,16 @@ void NucInstDig::pollerThread6()
 void NucInstDig::zmqMonitorPoller()
 {
     static const char* functionName = "zmqMonitorPoller";
+    uint64_t last_msgs = 0, last_events = 0, last_bytes = 0, last_dropped = 0;
+    epicsTimeStamp last_time, now;
+    epicsTimeGetCurrent(&last_time);
     while(true)
     {
         epicsThreadSleep(0.5);
         try
         {
             m_zmq_cmd.pollMonitor();
-#ifdef PULL_TRACES
             m_zmq_stream.pollMonitor();
-#endif
             m_zmq_events.pollMonitor();
         }
         catch(const std::exception& ex)
@@ -1809,17 +3565,131 @@ void NucInstDig::zmqMonitorPoller()
         }
         {
             epicsGuard<NucInstDig> _lock(*this);
-            if (m_zmq_cmd.connected() && m_zmq_events.connected()
-#ifdef PULL_TRACES
-                                      && m_zmq_stream.connected()
-#endif
-            ) {
+            if (m_zmq_cmd.connected() && m_zmq_events.connected() && (!m_traceStream || m_zmq_stream.connected())) {
                 setIntegerParam(P_ZMQConnected, 1);
                 m_connected = true;
             } else {
                 setIntegerParam(P_ZMQConnected, 0);
                 m_connected = false;
             }
+            for(int i=0; i<NCommandClasses; ++i) {
+                size_t depth;
+                double mean_wait;
+                m_zmq_cmd.getQueueStats(static_cast<CommandClass>(i), depth, mean_wait);
+                setIntegerParam(P_cmdQueueDepth[i], static_cast<int>(depth));
+                setDoubleParam(P_cmdQueueWait[i], mean_wait);
+            }
+            epicsTimeGetCurrent(&now);
+            double dt = epicsTimeDiffInSeconds(&now, &last_time);
+            for(int i=0; i<2; ++i) {
+                FrameTracker::Stats stats = m_frameTracker[i].totals();
+                FrameTracker::Latency latency = m_frameTracker[i].latency();
+                setIntegerParam(P_frames[i], static_cast<int>(stats.frames));
+                setIntegerParam(P_framesMissing[i], static_cast<int>(stats.missing));
+                setIntegerParam(P_framesDuplicate[i], static_cast<int>(stats.duplicate));
+                setIntegerParam(P_framesOutOfOrder[i], static_cast<int>(stats.out_of_order));
+                setDoubleParam(P_frameLatencyP50[i], latency.p50);
+                setDoubleParam(P_frameLatencyP90[i], latency.p90);
+                setDoubleParam(P_frameLatencyP99[i], latency.p99);
+                setDoubleParam(P_frameLatencyMax[i], latency.max);
+                uint64_t sent = 0, dropped = 0;
+                (i == 0 ? m_eventsRepublisher : m_tracesRepublisher).totals(sent, dropped);
+                setIntegerParam(P_republished[i], static_cast<int>(sent));
+                setIntegerParam(P_republishDropped[i], static_cast<int>(dropped));
+            }
+            EventRing::Stats ring_stats = m_eventsRing.stats();
+            setIntegerParam(P_eventsRingUsed, static_cast<int>(ring_stats.occupancy));
+            setIntegerParam(P_eventsRingHWM, static_cast<int>(ring_stats.high_water));
+            setIntegerParam(P_eventsRingDropped, static_cast<int>(ring_stats.dropped));
+            setIntegerParam(P_eventsRingBlocked, static_cast<int>(ring_stats.blocked));
+            setIntegerParam(P_traceStreamMsgs, static_cast<int>(m_traceStreamNMsgs));
+            setIntegerParam(P_traceStreamDropped, static_cast<int>(m_traceStreamNDropped));
+            setIntegerParam(P_traceAvgCount, m_traceAverager.count());
+            uint64_t hist_captures = 0;
+            uint32_t hist_trigger_frame = 0;
+            int hist_state = m_traceHistory.state();
+            m_traceHistory.captureStats(hist_captures, hist_trigger_frame);
+            setIntegerParam(P_traceHistState, hist_state);
+            setIntegerParam(P_traceHistArm, (hist_state != TraceHistory::StateIdle ? 1 : 0)); // a capture disarms
+            setIntegerParam(P_traceHistCaptures, static_cast<int>(hist_captures));
+            setIntegerParam(P_traceHistTrigFrame, static_cast<int>(hist_trigger_frame));
+            uint64_t filter_rejected = 0, filter_passed = 0;
+            m_eventFilter.getRejected(m_eventFilterRejected, filter_rejected, filter_passed);
+            setIntegerParam(P_eventsFilterNRejected, static_cast<int>(filter_rejected));
+            setIntegerParam(P_eventsFilterNPassed, static_cast<int>(filter_passed));
+            doCallbacksFloat64Array(m_eventFilterRejected.data(), m_eventFilterRejected.size(), P_eventsFilterRejected, 0);
+            size_t coinc_nchan = 0;
+            m_coincidence.merge(m_coincCounts, m_coincRates, m_coincSinglesRates, coinc_nchan);
+            CoincidenceDetector::Stats coinc_stats = m_coincidence.stats();
+            setIntegerParam(P_coincFrames, static_cast<int>(coinc_stats.frames));
+            setIntegerParam(P_coincTotal, static_cast<int>(coinc_stats.coincidences));
+            setIntegerParam(P_coincDropped, static_cast<int>(coinc_stats.dropped));
+            doCallbacksFloat64Array(m_coincCounts.data(), m_coincCounts.size(), P_coincCounts, 0);
+            doCallbacksFloat64Array(m_coincRates.data(), m_coincRates.size(), P_coincRates, 0);
+            doCallbacksFloat64Array(m_coincSinglesRates.data(), m_coincSinglesRates.size(), P_coincSinglesRates, 0);
+            if (m_pulseFinder.enabled()) {
+                size_t match_nchan = 0, match_nbins = 0;
+                m_pulseMatcher.merge(m_pulseMatchChanEff, m_pulseMatchDT, m_pulseMatchDTSum, m_pulseMatchDTX, match_nchan, match_nbins);
+                PulseMatcher::Stats match_stats = m_pulseMatcher.stats();
+                m_pulseMatcher.lastPulses(m_pulseFindLast);
+                m_pulseFindChan.resize(m_pulseFindLast.size());
+                m_pulseFindTime.resize(m_pulseFindLast.size());
+                m_pulseFindAmpl.resize(m_pulseFindLast.size());
+                for(size_t i=0; i<m_pulseFindLast.size(); ++i) {
+                    m_pulseFindChan[i] = m_pulseFindLast[i].channel;
+                    m_pulseFindTime[i] = m_pulseFindLast[i].time;
+                    m_pulseFindAmpl[i] = m_pulseFindLast[i].amplitude;
+                }
+                setIntegerParam(P_pulseFindTraces, static_cast<int>(m_pulseFinder.tracesSearched()));
+                setIntegerParam(P_pulseFindPulses, static_cast<int>(m_pulseFinder.pulsesFound()));
+                setDoubleParam(P_pulseMatchEff, (match_stats.pulses > 0 ? static_cast<double>(match_stats.matched) / match_stats.pulses : 0.0));
+                setIntegerParam(P_pulseMatchFrames, static_cast<int>(match_stats.frames));
+                setIntegerParam(P_pulseMatchPulses, static_cast<int>(match_stats.pulses));
+                setIntegerParam(P_pulseMatchEvents, static_cast<int>(match_stats.events));
+                setIntegerParam(P_pulseMatchMatched, static_cast<int>(match_stats.matched));
+                setIntegerParam(P_pulseMatchNoEvents, static_cast<int>(match_stats.frames_no_events));
+                setIntegerParam(P_pulseMatchNoTraces, static_cast<int>(match_stats.frames_no_traces));
+                doCallbacksFloat64Array(m_pulseFindChan.data(), m_pulseFindChan.size(), P_pulseFindChan, 0);
+                doCallbacksFloat64Array(m_pulseFindTime.data(), m_pulseFindTime.size(), P_pulseFindTime, 0);
+                doCallbacksFloat64Array(m_pulseFindAmpl.data(), m_pulseFindAmpl.size(), P_pulseFindAmpl, 0);
+                doCallbacksFloat64Array(m_pulseMatchChanEff.data(), m_pulseMatchChanEff.size(), P_pulseMatchChanEff, 0);
+                doCallbacksFloat64Array(m_pulseMatchDTX.data(), m_pulseMatchDTX.size(), P_pulseMatchDTX, 0);
+                doCallbacksFloat64Array(m_pulseMatchDTSum.data(), m_pulseMatchDTSum.size(), P_pulseMatchDT, 0);
+                doCallbacksFloat64Array(m_pulseMatchDT.data(), m_pulseMatchDT.size(), P_pulseMatchDTChan, 0);
+            }
+            if (m_mergeOwner) {
+                FrameMerger::Stats merge_stats = frameMerger().stats();
+                setIntegerParam(P_mergeFrames, static_cast<int>(merge_stats.complete + merge_stats.incomplete));
+                setIntegerParam(P_mergeIncomplete, static_cast<int>(merge_stats.incomplete));
+                setIntegerParam(P_mergeLate, static_cast<int>(merge_stats.late));
+                setIntegerParam(P_mergePending, static_cast<int>(merge_stats.pending));
+                setIntegerParam(P_mergeNDig, static_cast<int>(merge_stats.ndigitisers));
+                setIntegerParam(P_mergeMismatched, static_cast<int>(merge_stats.mismatched));
+                setIntegerParam(P_mergeBadChan, static_cast<int>(merge_stats.bad_channel));
+            }
+            uint64_t msgs = m_eventsNMsgs, events = m_eventsNEvents, bytes = m_eventsNBytes;
+            uint64_t dropped = m_eventsNDropped + m_frameTracker[0].totals().missing;
+            if (dt > 0.0) {
+                setDoubleParam(P_eventsMsgRate, (msgs - last_msgs) / dt);
+                setDoubleParam(P_eventsEventRate, (events - last_events) / dt);
+                setDoubleParam(P_eventsByteRate, (bytes - last_bytes) / dt);
+                setDoubleParam(P_eventsDropRate, (dropped > last_dropped ? (dropped - last_dropped) / dt : 0.0)); // late frames reduce the count
+            }
+            setIntegerParam(P_eventsDropped, static_cast<int>(dropped));
+            setIntegerParam(P_TOFHistDropped, static_cast<int>(m_TOFHistogram.nDropped()));
+            setIntegerParam(P_TOFHistOutside, static_cast<int>(m_TOFHistogram.nOutside()));
+            setIntegerParam(P_pulseHeightDropped, static_cast<int>(m_pulseHeight.nDropped()));
+            setIntegerParam(P_pulseHeightOutside, static_cast<int>(m_pulseHeight.nOutside()));
+            last_msgs = msgs;
+            last_events = events;
+            last_bytes = bytes;
+            last_dropped = dropped;
+            last_time = now;
+            setIntegerParam(P_readBinaryActive, (m_readBinaryActive ? 1 : 0));
+            for(int i=0; i<3; ++i) {
+                setDoubleParam(P_readDataRate[i], m_readDataRate[i]);
+                setIntegerParam(P_readDataSize[i], m_readDataSize[i]);
+            }
             callParamCallbacks();
         }
     }
@@ -1845,14 +3715,74 @@ void NucInstDig::report(FILE *fp, int details)
     int connected;
     getIntegerParam(P_ZMQConnected, &connected);
     fprintf(fp, "connected: %s\n", (connected != 0 ? "YES" : "NO"));
+    if (details > 1) {
+        epicsTimeStamp now_ts;
+        epicsTimeGetCurrent(&now_ts);
+        double now = now_ts.secPastEpoch + now_ts.nsec / 1.e9;
+        fprintf(fp, "  %-32s %4s %8s %10s %10s\n", "parameter", "chan", "log_freq", "age (s)", "latency (s)");
+        for(const auto& kv : m_param_data) {
+            const ParamData* p = kv.second;
+            fprintf(fp, "  %-32s %4d %8d %10.3f %10.3f\n", p->name.c_str(), p->chan, p->log_freq,
+                    (p->last_read > 0.0 ? now - p->last_read : -1.0), p->poll_latency);
+        }
+        fprintf(fp, "  generations: DC spectra %llu traces %llu TOF spectra %llu\n", (unsigned long long)m_dcSpectra.generation(),
+                (unsigned long long)m_traces.generation(), (unsigned long long)m_TOFSpectra.generation());
+    }
+    if (details > 0) {
+        EventRing::Stats ring_stats = m_eventsRing.stats();
+        fprintf(fp, "  event ring: %s, %d of %d used, high water %d, pushed %llu popped %llu dropped %llu blocked %llu\n",
+                (m_eventsRing.policy() == EventRing::Block ? "block" : "drop oldest"),
+                static_cast<int>(ring_stats.occupancy), static_cast<int>(ring_stats.capacity), static_cast<int>(ring_stats.high_water),
+                (unsigned long long)ring_stats.pushed, (unsigned long long)ring_stats.popped, (unsigned long long)ring_stats.dropped,
+                (unsigned long long)ring_stats.blocked);
+        uint64_t filter_rejected = 0, filter_passed = 0;
+        std::vector<double> rejected;
+        m_eventFilter.getRejected(rejected, filter_rejected, filter_passed);
+        fprintf(fp, "  event filter: %s, passed %llu rejected %llu\n", (m_eventFilter.enabled() ? "enabled" : "disabled"),
+                (unsigned long long)filter_passed, (unsigned long long)filter_rejected);
+        m_coincidence.report(fp);
+        m_asymmetry.report(fp);
+        m_traceAverager.report(fp);
+        m_traceHistory.report(fp);
+        m_pulseFinder.report(fp);
+        m_pulseMatcher.report(fp);
+        m_frameTracker[0].report(fp, "event");
+        m_frameTracker[1].report(fp, "trace");
+        m_eventsRepublisher.report(fp);
+        m_tracesRepublisher.report(fp);
+        if (m_mergeOwner) {
+            frameMerger().report(fp);
+        }
+    }
     /* Invoke the base class method */
     ADDriver::report(fp, details);
 }
 
 asynStatus NucInstDig::drvUserCreate(asynUser *pasynUser, const char* drvInfo, const char** pptypeName, size_t* psize)
 {
+   // PARAM_LATENCY,name,chan  is the poll latency of the PARAM with that name and channel
+   if (strncmp(drvInfo, "PARAM_LATENCY,", 14) == 0)
+     {
+         std::string param_name;
+         std::vector<std::string> split_vec;
+         int param_index;
+         boost::split(split_vec, drvInfo, boost::is_any_of(","), boost::token_compress_on);
+         if (split_vec.size() == 3)
+         {
+             param_name = split_vec[0] + "_" + split_vec[1] + "_" + split_vec[2];
+             if (findParam(param_name.c_str(), &param_index) == asynSuccess ||
+                 createParam(param_name.c_str(), asynParamFloat64, &param_index) == asynSuccess)
+             {
+                 m_param_latency[split_vec[1] + "_" + split_vec[2]] = param_index;
+                 pasynUser->reason = param_index;
+                 return asynSuccess;
+             }
+         }
+         std::cerr << "ERROR: Incorrect field count in drvInfo " << drvInfo << std::endl;
+         return asynError;
+     }
    // PARAM,name,type,chan,log_freq
-   if (strncmp(drvInfo, "PARAM,", 6) == 0)
+   else if (strncmp(drvInfo, "PARAM,", 6) == 0)
      {
          std::string param_name;
          std::vector<std::string> split_vec;
@@ -1885,6 +3815,7 @@ asynStatus NucInstDig::drvUserCreate(asynUser *pasynUser, const char* drvInfo, c
                  std::cerr << "ERROR: Param " << param_name << " invalid type " << split_vec[2] << std::endl;
                  return asynError;
              }
+             epicsGuard<NucInstDig> _lock(*this); // pollerThread1() reads m_param_data
              if (createParam(param_name.c_str(), param_type, &param_index) == asynSuccess)
              {
                  m_param_data[param_index] = new ParamData(split_vec[1], param_type, atoi(split_vec[3].c_str()), atoi(split_vec[4].c_str()));
@@ -1901,6 +3832,26 @@ asynStatus NucInstDig::drvUserCreate(asynUser *pasynUser, const char* drvInfo, c
      }
 }
 
+/// forward messages received on stream "events" (dev2) or "traces" (dat2, only while TRACE_STREAM is 1) to endpoint, see Republisher.
+/// Stream "merged" is the frames of all digitisers from the FrameMerger as dev2 messages, e.g. for a file writer
+void NucInstDig::addRepublisher(const char* stream, const char* endpoint, int hwm, int digitiser, int chan_min, int chan_max)
+{
+    if (endpoint == NULL || *endpoint == '\0') {
+        throw std::runtime_error("no endpoint given");
+    }
+    if (stream != NULL && strcmp(stream, "events") == 0) {
+        m_eventsRepublisher.addSubscriber(endpoint, hwm, digitiser, chan_min, chan_max);
+    } else if (stream != NULL && strcmp(stream, "traces") == 0) {
+        m_tracesRepublisher.addSubscriber(endpoint, hwm, digitiser, chan_min, chan_max);
+    } else if (stream != NULL && strcmp(stream, "merged") == 0) {
+        frameMerger().republisher().addSubscriber(endpoint, hwm, digitiser, chan_min, chan_max);
+    } else if (stream != NULL && strcmp(stream, "coincidence") == 0) {
+        m_coincidence.republisher().addSubscriber(endpoint, hwm, digitiser, chan_min, chan_max);
+    } else {
+        throw std::runtime_error(std::string("unknown stream \"") + (stream != NULL ? stream : "") + "\", use events, traces, merged or coincidence");
+    }
+}
+
 // used to free pasynUser->userData is needed
 asynStatus NucInstDig::drvUserDestroy(asynUser *pasynUser)
 {
@@ -1909,6 +3860,7 @@ asynStatus NucInstDig::drvUserDestroy(asynUser *pasynUser)
 
 NDArray* NucInstDig::g_rawCombined[3]; 
 std::vector<NucInstDig*> NucInstDig::g_dig_list;
+FrameMerger* NucInstDig::g_frameMerger = NULL;
 epicsMutex NucInstDig::g_digCombinedLock;
 
 int nucInstDigConfigure(const char *portName, const char *targetAddress, int dig_idx)
@@ -1926,6 +3878,32 @@ int nucInstDigConfigure(const char *portName, const char *targetAddress, int dig
 	}
 }
 
+// digitiser is a digitizer_id, channels is "first-last" or a single channel, empty for all
+int nucInstDigRepublish(const char *portName, const char *stream, const char *endpoint, int hwm, const char* digitiser, const char* channels)
+{
+	try
+	{
+		NucInstDig* iface = NucInstDig::findDigitiser(portName);
+        if (iface == NULL) {
+            throw std::runtime_error(std::string("no digitiser port ") + (portName != NULL ? portName : ""));
+        }
+        int dig = (digitiser != NULL && *digitiser != '\0' ? atoi(digitiser) : -1);
+        int chan_min = 0, chan_max = -1;
+        if (channels != NULL && *channels != '\0') {
+            if (sscanf(channels, "%d-%d", &chan_min, &chan_max) == 1) {
+                chan_max = chan_min;
+            }
+        }
+        iface->addRepublisher(stream, endpoint, (hwm > 0 ? hwm : 1000), dig, chan_min, chan_max);
+		return(asynSuccess);
+	}
+	catch(const std::exception& ex)
+	{
+		errlogSevPrintf(errlogMajor, "nucInstDigRepublish failed: %s\n", ex.what());
+		return(asynError);
+	}
+}
+
 // EPICS iocsh shell commands 
 
 // NucInstDigConfigure
@@ -1944,9 +3922,27 @@ static void initCallFunc(const iocshArgBuf *args)
     nucInstDigConfigure(args[0].sval, args[1].sval, args[2].ival);
 }
 
+// nucInstDigRepublish
+static const iocshArg repArg0 = { "portName", iocshArgString};			///< port of a digitiser created by nucInstDigConfigure
+static const iocshArg repArg1 = { "stream", iocshArgString};			///< events, traces, merged or coincidence
+static const iocshArg repArg2 = { "endpoint", iocshArgString};			///< e.g. tcp://*:5565 or inproc://events
+static const iocshArg repArg3 = { "hwm", iocshArgInt};			///< send high water mark in messages, 0 for the default of 1000
+static const iocshArg repArg4 = { "digitiser", iocshArgString};			///< only this digitizer_id, empty for all
+static const iocshArg repArg5 = { "channels", iocshArgString};			///< only messages with a channel in this range e.g. 0-7, empty for all
+
+static const iocshArg * const repArgs[] = { &repArg0, &repArg1, &repArg2, &repArg3, &repArg4, &repArg5 };
+
+static const iocshFuncDef repFuncDef = {"nucInstDigRepublish", sizeof(repArgs) / sizeof(iocshArg*), repArgs};
+
+static void repCallFunc(const iocshArgBuf *args)
+{
+    nucInstDigRepublish(args[0].sval, args[1].sval, args[2].sval, args[3].ival, args[4].sval, args[5].sval);
+}
+
 static void nucInstDigRegister(void)
 {
 	iocshRegister(&initFuncDef, initCallFunc);
+	iocshRegister(&repFuncDef, repCallFunc);
 }
 
 epicsExportRegistrar(nucInstDigRegister);
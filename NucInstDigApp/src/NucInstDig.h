@@ -8,10 +8,17 @@ struct ParamData
     std::string name;
     asynParamType type;
     int chan;
-    int log_freq;
-    ParamData(const std::string& name_, asynParamType type_, int chan_, int log_freq_) : name(name_), type(type_), chan(chan_), log_freq(log_freq_) { }
+    int log_freq; // poll period in seconds, 0 for the default period, < 0 to only read once
+    double poll_due; // poll scheduling state, only used by pollerThread1
+    double last_read; // time value last received from digitiser
+    double poll_latency; // delay between poll being due and value being received
+    ParamData(const std::string& name_, asynParamType type_, int chan_, int log_freq_) : name(name_), type(type_), chan(chan_), log_freq(log_freq_),
+                                                poll_due(0.0), last_read(0.0), poll_latency(0.0) { }
 };
 
+// (asyn param index, digitiser parameter) pairs read together with one get_parameters command
+typedef std::vector< std::pair<int, ParamData*> > ParamBatch;
+
 class zmq_monitor_t : public zmq::monitor_t {
     bool m_connected;
 public:
@@ -60,9 +67,21 @@ class ZMQConnectionHandler
     std::string m_address;
     epicsMutex m_lock;
     bool m_conflate;
+    int m_rcvhwm; // 0 for zmq default
     public:
-    ZMQConnectionHandler(zmq::socket_type sock_type, const std::string& address, bool conflate = false) : m_sock_type(sock_type), m_address(address), m_zmq_ctx{1}, m_zmq_socket(nullptr), m_zmq_mon(nullptr), m_conflate(conflate)
+    ZMQConnectionHandler(zmq::socket_type sock_type, const std::string& address, bool conflate = false) : m_sock_type(sock_type), m_address(address), m_zmq_ctx{1}, m_zmq_socket(nullptr), m_zmq_mon(nullptr), m_conflate(conflate), m_rcvhwm(0)
+    {
+        init();
+    }
+
+    // change receive options, this creates a new socket so any queued messages are lost
+    void setOptions(int rcvhwm, bool conflate)
     {
+        {
+            epicsGuard<epicsMutex> _lock(m_lock);
+            m_rcvhwm = rcvhwm;
+            m_conflate = conflate;
+        }
         init();
     }
     
@@ -84,6 +103,9 @@ class ZMQConnectionHandler
         if (m_conflate) {
             m_zmq_socket->set(zmq::sockopt::conflate, 1);
         }
+        else if (m_rcvhwm > 0) {
+            m_zmq_socket->set(zmq::sockopt::rcvhwm, m_rcvhwm);
+        }
         m_zmq_mon = new zmq_monitor_t();
         m_zmq_mon->init(*m_zmq_socket, "inproc://NucInstDigConMon", events_to_monitor);
         m_zmq_socket->connect(m_address);
@@ -125,6 +147,516 @@ class ZMQConnectionHandler
         return m_zmq_socket->send(msg, flags);
     }
 
+    // returns true if a message is waiting to be received
+    bool poll(int timeout)
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        zmq::pollitem_t items[] = { { static_cast<void*>(*m_zmq_socket), 0, ZMQ_POLLIN, 0 } };
+        zmq::poll(items, 1, std::chrono::milliseconds(timeout));
+        return (items[0].revents & ZMQ_POLLIN) != 0;
+    }
+
+};
+
+/// priority classes for ZMQCommandChannel, lower values are always sent first
+enum CommandClass { CmdInteractive = 0, CmdRunControl, CmdReadback, CmdBulkRead, NCommandClasses };
+
+/// a command sent (or waiting to be sent) on a ZMQCommandChannel
+struct ZMQCommand
+{
+    uint32_t id;
+    CommandClass cls;
+    std::string request;
+    std::promise<zmq::message_t> reply;
+    epicsTimeStamp queued;
+    epicsTimeStamp deadline;
+    ZMQCommand(uint32_t id_, CommandClass cls_, const std::string& request_) : id(id_), cls(cls_), request(request_) { }
+};
+
+/// Pipelined command channel to the digitiser. A DEALER socket is used and each request is sent
+/// as [request id][empty delimiter][request], the digitiser REP socket treats the first two frames
+/// as the reply envelope and returns them with the reply so several commands can be in flight
+/// at once and replies matched back to the caller's future.
+/// Commands are queued by CommandClass. The digitiser answers commands in the order it receives them,
+/// so background readback and bulk reads are only allowed a couple of commands in flight and an
+/// interactive write queued behind them is sent as soon as there is room.
+class ZMQCommandChannel
+{
+    ZMQConnectionHandler m_conn; // only used from ioThread() once constructed
+    epicsMutex m_lock; // protects everything below
+    epicsEvent m_wakeup;
+    std::deque<ZMQCommand*> m_queued[NCommandClasses];
+    std::map<uint32_t, ZMQCommand*> m_in_flight;
+    size_t m_n_in_flight[NCommandClasses];
+    size_t m_max_class_in_flight[NCommandClasses];
+    double m_wait_sum[NCommandClasses]; // time spent queued by commands sent since last getQueueStats()
+    size_t m_n_sent[NCommandClasses];
+    uint32_t m_next_id;
+    size_t m_max_in_flight;
+    double m_timeout;
+
+    public:
+    ZMQCommandChannel(const std::string& address, size_t max_in_flight = 16, double timeout = 5.0) : m_conn(zmq::socket_type::dealer, address), m_next_id(0), m_max_in_flight(max_in_flight), m_timeout(timeout)
+    {
+        for(int i=0; i<NCommandClasses; ++i)
+        {
+            m_n_in_flight[i] = m_n_sent[i] = 0;
+            m_wait_sum[i] = 0.0;
+            m_max_class_in_flight[i] = max_in_flight;
+        }
+        m_max_class_in_flight[CmdReadback] = 2;
+        m_max_class_in_flight[CmdBulkRead] = 1;
+        if (epicsThreadCreate("ZMQCommandChannel",
+                              epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)ioThreadC, this) == 0)
+        {
+            throw std::runtime_error("ZMQCommandChannel: epicsThreadCreate failure");
+        }
+    }
+
+    /// queue a request, the returned future becomes ready when the reply arrives or throws on error/timeout
+    std::future<zmq::message_t> submit(const std::string& request, CommandClass cls)
+    {
+        ZMQCommand* cmd;
+        std::future<zmq::message_t> reply;
+        {
+            epicsGuard<epicsMutex> _lock(m_lock);
+            cmd = new ZMQCommand(++m_next_id, cls, request);
+            reply = cmd->reply.get_future();
+            epicsTimeGetCurrent(&cmd->queued);
+            m_queued[cls].push_back(cmd);
+        }
+        m_wakeup.signal();
+        return reply;
+    }
+
+    /// send a request and wait for its reply
+    zmq::message_t execute(const std::string& request, CommandClass cls)
+    {
+        return submit(request, cls).get();
+    }
+
+    /// number of commands of a class waiting to be sent, and their mean time spent waiting since the last call
+    void getQueueStats(CommandClass cls, size_t& depth, double& mean_wait)
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        depth = m_queued[cls].size();
+        mean_wait = (m_n_sent[cls] > 0 ? m_wait_sum[cls] / m_n_sent[cls] : 0.0);
+        m_wait_sum[cls] = 0.0;
+        m_n_sent[cls] = 0;
+    }
+
+    bool connected()
+    {
+        return m_conn.connected();
+    }
+
+    void pollMonitor(int timeout = 10)
+    {
+        m_conn.pollMonitor(timeout);
+    }
+
+    size_t numInFlight()
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        return m_in_flight.size();
+    }
+
+    size_t numQueued()
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        size_t n = 0;
+        for(int i=0; i<NCommandClasses; ++i)
+        {
+            n += m_queued[i].size();
+        }
+        return n;
+    }
+
+    private:
+    static void ioThreadC(void* arg)
+    {
+        ZMQCommandChannel* chan = (ZMQCommandChannel*)arg;
+        chan->ioThread();
+    }
+
+    void ioThread()
+    {
+        while(true)
+        {
+            try
+            {
+                bool busy;
+                {
+                    epicsGuard<epicsMutex> _lock(m_lock);
+                    busy = !m_in_flight.empty();
+                    for(int i=0; i<NCommandClasses; ++i)
+                    {
+                        busy = busy || !m_queued[i].empty();
+                    }
+                }
+                if (!busy)
+                {
+                    m_wakeup.wait(1.0);
+                }
+                sendQueued();
+                if (m_conn.poll(1))
+                {
+                    receiveReplies();
+                }
+                expireCommands();
+            }
+            catch(const std::exception& ex)
+            {
+                std::cerr << "ZMQCommandChannel: exception " << ex.what() << std::endl;
+                failInFlight(ex.what());
+                epicsThreadSleep(1.0);
+            }
+        }
+    }
+
+    // pick the next command to send, highest priority class first, or NULL if none can be sent yet
+    ZMQCommand* nextToSend()
+    {
+        if (m_in_flight.size() >= m_max_in_flight)
+        {
+            return NULL;
+        }
+        for(int i=0; i<NCommandClasses; ++i)
+        {
+            if (!m_queued[i].empty() && m_n_in_flight[i] < m_max_class_in_flight[i])
+            {
+                ZMQCommand* cmd = m_queued[i].front();
+                m_queued[i].pop_front();
+                return cmd;
+            }
+        }
+        return NULL;
+    }
+
+    // the command is moved to m_in_flight under the lock, so it still counts against the in flight limits,
+    // and then sent without holding the lock so submit() is not blocked behind a slow peer
+    void sendQueued()
+    {
+        while(true)
+        {
+            ZMQCommand* cmd;
+            {
+                epicsGuard<epicsMutex> _lock(m_lock);
+                if ((cmd = nextToSend()) == NULL)
+                {
+                    return;
+                }
+                epicsTimeGetCurrent(&cmd->deadline);
+                m_wait_sum[cmd->cls] += epicsTimeDiffInSeconds(&cmd->deadline, &cmd->queued);
+                ++m_n_sent[cmd->cls];
+                epicsTimeAddSeconds(&cmd->deadline, m_timeout);
+                m_in_flight[cmd->id] = cmd;
+                ++m_n_in_flight[cmd->cls];
+            }
+            if (!m_conn.send(zmq::const_buffer(&cmd->id, sizeof(cmd->id)), zmq::send_flags::sndmore) ||
+                !m_conn.send(zmq::message_t(), zmq::send_flags::sndmore) ||
+                !m_conn.send(zmq::buffer(cmd->request), zmq::send_flags::none))
+            {
+                {
+                    epicsGuard<epicsMutex> _lock(m_lock);
+                    --m_n_in_flight[cmd->cls];
+                    m_in_flight.erase(cmd->id);
+                }
+                cmd->reply.set_exception(std::make_exception_ptr(std::runtime_error("unable to send")));
+                delete cmd;
+                // replies to anything else in flight would go to the old socket
+                failInFlight("connection reset after send failure");
+                m_conn.init();
+            }
+        }
+    }
+
+    void receiveReplies()
+    {
+        while(true)
+        {
+            std::vector<zmq::message_t> parts(1);
+            if (!m_conn.recv(parts[0], zmq::recv_flags::dontwait))
+            {
+                return;
+            }
+            // rest of a multipart message is always available once the first part has arrived
+            while (parts.back().more())
+            {
+                parts.emplace_back();
+                if (!m_conn.recv(parts.back(), zmq::recv_flags::dontwait))
+                {
+                    break;
+                }
+            }
+            if (parts.size() != 3 || parts[0].size() != sizeof(uint32_t) || parts[1].size() != 0)
+            {
+                std::cerr << "ZMQCommandChannel: discarding malformed reply" << std::endl;
+                continue;
+            }
+            zmq::message_t& reply = parts[2];
+            uint32_t id;
+            memcpy(&id, parts[0].data(), sizeof(id));
+            ZMQCommand* cmd = NULL;
+            {
+                epicsGuard<epicsMutex> _lock(m_lock);
+                auto it = m_in_flight.find(id);
+                if (it != m_in_flight.end())
+                {
+                    cmd = it->second;
+                    --m_n_in_flight[cmd->cls];
+                    m_in_flight.erase(it);
+                }
+            }
+            if (cmd == NULL)
+            {
+                std::cerr << "ZMQCommandChannel: discarding reply to expired request " << id << std::endl;
+                continue;
+            }
+            cmd->reply.set_value(std::move(reply));
+            delete cmd;
+        }
+    }
+
+    // a timed out reply may still arrive later and would then be discarded, but if the digitiser
+    // has restarted nothing in flight will be answered so start again with a new socket
+    void expireCommands()
+    {
+        epicsTimeStamp now;
+        bool expired = false;
+        epicsTimeGetCurrent(&now);
+        {
+            epicsGuard<epicsMutex> _lock(m_lock);
+            for(auto it = m_in_flight.begin(); it != m_in_flight.end(); )
+            {
+                if (epicsTimeDiffInSeconds(&now, &(it->second->deadline)) > 0.0)
+                {
+                    it->second->reply.set_exception(std::make_exception_ptr(std::runtime_error("timeout waiting for reply")));
+                    --m_n_in_flight[it->second->cls];
+                    delete it->second;
+                    it = m_in_flight.erase(it);
+                    expired = true;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        if (expired)
+        {
+            failInFlight("connection reset after timeout");
+            m_conn.init();
+        }
+    }
+
+    void failInFlight(const std::string& reason)
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        for(auto& kv : m_in_flight)
+        {
+            kv.second->reply.set_exception(std::make_exception_ptr(std::runtime_error(reason)));
+            delete kv.second;
+        }
+        m_in_flight.clear();
+        for(int i=0; i<NCommandClasses; ++i)
+        {
+            m_n_in_flight[i] = 0;
+        }
+    }
+};
+
+/// a complete set of spectra or traces, nspec spectra of npts points stored spectrum by spectrum
+/// in the digitiser's native type (uint32 counts or uint16 ADC samples)
+template <typename T>
+struct Data2d
+{
+    std::vector<T> data;
+    size_t nspec;
+    size_t npts;
+    size_t nperiods; // spectra are split into nperiods blocks of nspec / nperiods
+    uint64_t generation; // incremented every time a new snapshot is published
+    epicsTimeStamp ts; // when it was published
+    Data2d() : nspec(0), npts(0), nperiods(1), generation(0) { memset(&ts, 0, sizeof(ts)); }
+};
+
+/// Double buffered (RCU style) holder of a Data2d. A writer fills the back buffer, e.g. during a
+/// network read, and then publishes it by atomically swapping the front index. Readers take
+/// a Snapshot of the current front buffer without waiting on the writer, a writer only waits
+/// for readers still holding the buffer it is about to reuse, which are short copies into an NDArray.
+template <typename T>
+class Data2dBuffer
+{
+    Data2d<T> m_buffers[2];
+    std::atomic<int> m_front; // index of the published buffer
+    std::atomic<int> m_readers[2]; // number of Snapshots holding each buffer
+    std::atomic<uint64_t> m_generation;
+    epicsMutex m_writeLock; // only one Writer at a time
+
+public:
+    Data2dBuffer(size_t nspec = 0) : m_front(0), m_generation(0)
+    {
+        m_readers[0] = m_readers[1] = 0;
+        m_buffers[0].nspec = m_buffers[1].nspec = nspec;
+    }
+
+    /// read only access to the latest published data, valid for the lifetime of the Snapshot
+    class Snapshot
+    {
+        Data2dBuffer& m_buffer;
+        int m_idx;
+        Snapshot& operator=(const Snapshot&);
+
+    public:
+        explicit Snapshot(Data2dBuffer& buffer) : m_buffer(buffer)
+        {
+            while(true)
+            {
+                m_idx = m_buffer.m_front;
+                ++(m_buffer.m_readers[m_idx]);
+                // if a writer swapped buffers between reading m_front and registering, it may already
+                // be writing to this one so try again with the new front
+                if (m_idx == m_buffer.m_front)
+                {
+                    break;
+                }
+                --(m_buffer.m_readers[m_idx]);
+            }
+        }
+        Snapshot(const Snapshot& s) : m_buffer(s.m_buffer), m_idx(s.m_idx) { ++(m_buffer.m_readers[m_idx]); }
+        ~Snapshot() { --(m_buffer.m_readers[m_idx]); }
+        const Data2d<T>& operator*() const { return m_buffer.m_buffers[m_idx]; }
+        const Data2d<T>* operator->() const { return &(m_buffer.m_buffers[m_idx]); }
+    };
+
+    /// exclusive access to the back buffer, nothing is visible to readers until publish() is called
+    class Writer
+    {
+        Data2dBuffer& m_buffer;
+        epicsGuard<epicsMutex> m_guard;
+        int m_idx;
+        Writer(const Writer&);
+        Writer& operator=(const Writer&);
+
+    public:
+        /// if copy_front is true the back buffer starts as a copy of the published data, for partial updates
+        explicit Writer(Data2dBuffer& buffer, bool copy_front = false) : m_buffer(buffer), m_guard(buffer.m_writeLock)
+        {
+            int front = m_buffer.m_front;
+            m_idx = 1 - front;
+            while(m_buffer.m_readers[m_idx] != 0)
+            {
+                epicsThreadSleep(0.001);
+            }
+            if (copy_front)
+            {
+                Data2d<T>& back = m_buffer.m_buffers[m_idx];
+                const Data2d<T>& current = m_buffer.m_buffers[front];
+                back.data.assign(current.data.begin(), current.data.end()); // keeps back buffer capacity
+                back.nspec = current.nspec;
+                back.npts = current.npts;
+                back.nperiods = current.nperiods;
+            }
+        }
+        Data2d<T>& operator*() { return m_buffer.m_buffers[m_idx]; }
+        Data2d<T>* operator->() { return &(m_buffer.m_buffers[m_idx]); }
+        /// make the back buffer the front one, the Writer must not be used afterwards
+        void publish()
+        {
+            Data2d<T>& back = m_buffer.m_buffers[m_idx];
+            back.generation = ++(m_buffer.m_generation);
+            epicsTimeGetCurrent(&back.ts);
+            m_buffer.m_front = m_idx;
+        }
+    };
+
+    Snapshot read() { return Snapshot(*this); }
+    uint64_t generation() const { return m_generation; }
+};
+
+typedef Data2dBuffer<epicsUInt32> SpectraBuffer;
+typedef Data2dBuffer<epicsUInt16> TracesBuffer;
+
+/// received event lists waiting to be processed
+typedef SPSCRing< std::shared_ptr<EventMessage> > EventRing;
+
+/// passes event lists to an EventHistogram while enabled, the histogram references
+/// the flatbuffers vectors directly so this assumes a little endian host.
+/// With more than one period, events go to the period_number of their frame metadata (0 based).
+/// Frames with any veto_flags bit in the veto mask are counted as vetoed and can be histogrammed as normal,
+/// rejected, or histogrammed separately in an extra period after the last one. Good frames (all frames
+/// when vetoed frames are histogrammed as normal) and their protons_per_pulse are counted for each period
+/// so spectra can be normalised.
+/// In merged mode, frames from the FrameMerger are histogrammed instead of digitiser messages.
+class HistogramEventConsumer : public EventConsumer, public MergedFrameConsumer
+{
+public:
+    enum VetoMode { VetoIgnore = 0, VetoReject, VetoSeparate };
+
+private:
+    EventHistogram& m_hist;
+    std::atomic<bool> m_enabled;
+    std::atomic<bool> m_merged;
+    epicsMutex m_lock; // protects members below
+    size_t m_nperiods;
+    uint16_t m_vetoMask;
+    VetoMode m_vetoMode;
+    std::vector<double> m_goodFrames; // for each period
+    std::vector<double> m_protons; // sum of protons_per_pulse of good frames for each period
+    uint64_t m_rawFrames;
+    uint64_t m_vetoedFrames;
+    uint64_t m_currentPeriod;
+    std::set<uint32_t> m_recentFrames; // frames already counted, a frame may arrive in more than one message
+    std::deque<uint32_t> m_recentOrder; // m_recentFrames in arrival order, oldest are forgotten first
+
+public:
+    HistogramEventConsumer(EventHistogram& hist);
+    void enable(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    void setMerged(bool merged) { m_merged = merged; }
+    /// clears the histogram and frame counts
+    void setPeriods(size_t nperiods, uint16_t veto_mask, VetoMode veto_mode);
+    void resetCounts();
+    void getCounts(std::vector<double>& good_frames, std::vector<double>& protons, uint64_t& raw_frames,
+                   uint64_t& vetoed_frames, uint64_t& current_period);
+    void consumeEvents(const EventMessagePtr& msg);
+    void consumeFrame(const MergedFramePtr& frame);
+
+private:
+    bool countFrame(const FrameMetadataV2* metadata, size_t& period);
+};
+
+/// signals an epicsEvent every period seconds from a shared timer queue, a period <= 0 stops it
+class RefreshTimer : public epicsTimerNotify
+{
+    epicsEvent& m_event;
+    epicsTimer& m_timer;
+    std::atomic<double> m_period;
+
+public:
+    RefreshTimer(epicsTimerQueueActive& queue, epicsEvent& event) : m_event(event), m_timer(queue.createTimer()), m_period(0.0) { }
+    ~RefreshTimer() { m_timer.destroy(); }
+    void setPeriod(double period)
+    {
+        m_period = period;
+        if (period > 0.0)
+        {
+            m_timer.start(*this, period);
+        }
+        else
+        {
+            m_timer.cancel();
+        }
+    }
+    double period() const { return m_period; }
+    expireStatus expire(const epicsTime& currentTime)
+    {
+        double period = m_period;
+        m_event.signal();
+        return (period > 0.0 ? expireStatus(restart, period) : expireStatus(noRestart));
+    }
 };
 
 class NucInstDig : public ADDriver
@@ -137,6 +669,8 @@ public:
  	static void pollerThreadC4(void* arg);
  	static void pollerThreadC5(void* arg);
  	static void pollerThreadC6(void* arg);
+ 	static void pollerThreadC7(void* arg);
+ 	static void pollerThreadC8(void* arg);
     static void zmqMonitorPollerC(void* arg);
 
     // These are the methods that we override from asynPortDriver
@@ -147,19 +681,19 @@ public:
 	virtual asynStatus readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason);
 	virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual);
     virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
+    virtual asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements);
     virtual asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements, size_t *nIn);
 	
     virtual void report(FILE *fp, int details);
     virtual void setShutter(int addr, int open);
+    void addRepublisher(const char* stream, const char* endpoint, int hwm, int digitiser, int chan_min, int chan_max);
 
 private:
 
     std::atomic<bool> m_connected;
 
-    ZMQConnectionHandler m_zmq_cmd;
-#ifdef PULL_TRACES
-    ZMQConnectionHandler m_zmq_stream;
-#endif
+    ZMQCommandChannel m_zmq_cmd;
+    ZMQConnectionHandler m_zmq_stream; // dat2 traces, only read while TRACE_STREAM is 1
     ZMQConnectionHandler m_zmq_events;
     
     std::string m_targetAddress;
@@ -190,40 +724,311 @@ private:
     int P_configSTAVES; // int
     int P_resetTOFSpectra; // int
     int P_resetDCSpectra; // int
+    int P_paramBatchSize; // int
+    int P_paramSweepTime; // double
+    int P_paramPollPeriod; // double
+    int P_cmdQueueDepth[NCommandClasses]; // int
+    int P_cmdQueueWait[NCommandClasses]; // double
+    int P_readDataRate[3]; // double, indexed by areaDetector address 0=DC spectra, 1=traces, 2=TOF spectra
+    int P_readDataSize[3]; // int
+    int P_readBinary; // int
+    int P_readBinaryActive; // int
+    int P_DCSpectraPeriod; // double
+    int P_TOFSpectraPeriod; // double
+    int P_tracesPeriod; // double
+    int P_eventsHWM; // int
+    int P_eventsLossless; // int
+    int P_eventsMsgRate; // double
+    int P_eventsEventRate; // double
+    int P_eventsByteRate; // double
+    int P_eventsDropRate; // double
+    int P_eventsDropped; // int
+    int P_TOFSource; // int, 0 get_tof_spectra from digitiser, 1 histogram events in the IOC, 2 histogram merged frames
+    int P_TOFHistNSpec; // int
+    int P_TOFHistTMin; // double
+    int P_TOFHistTMax; // double
+    int P_TOFHistNBins; // int
+    int P_TOFHistEdges; // double array
+    int P_TOFHistDropped; // int
+    int P_TOFHistOutside; // int
+    int P_pulseHeight; // int, histogram event voltages, published on NDArray address 6
+    int P_resetPulseHeight; // int
+    int P_pulseHeightNChan; // int
+    int P_pulseHeightVMin; // double
+    int P_pulseHeightVMax; // double
+    int P_pulseHeightNBins; // int
+    int P_pulseHeightDropped; // int
+    int P_pulseHeightOutside; // int
+    int P_numPeriods; // int
+    int P_vetoMask; // int
+    int P_vetoMode; // int, a HistogramEventConsumer::VetoMode
+    int P_currentPeriod; // int
+    int P_rawFrames; // int
+    int P_goodFrames; // int
+    int P_vetoedFrames; // int
+    int P_protonCharge; // double
+    int P_periodGoodFrames; // realarray
+    int P_periodProtonCharge; // realarray
+    int P_resetFrameStats; // int
+    int P_frames[2]; // int, [0] event stream [1] trace stream
+    int P_framesMissing[2]; // int
+    int P_framesDuplicate[2]; // int
+    int P_framesOutOfOrder[2]; // int
+    int P_frameLatencyP50[2]; // double
+    int P_frameLatencyP90[2]; // double
+    int P_frameLatencyP99[2]; // double
+    int P_frameLatencyMax[2]; // double
+    int P_republished[2]; // int
+    int P_republishDropped[2]; // int
+    int P_mergeEvents; // int, the FrameMerger is shared so MERGE_* are only created on the first port, -1 on others
+    int P_mergeWindow; // int
+    int P_mergeTimeout; // double
+    int P_mergeNChan; // int
+    int P_mergeFrames; // int
+    int P_mergeIncomplete; // int
+    int P_mergeLate; // int
+    int P_mergePending; // int
+    int P_mergeNDig; // int
+    int P_mergeMismatched; // int
+    int P_mergeBadChan; // int
+    int P_eventsRingPolicy; // int, an EventRing::Policy
+    int P_eventsRingSize; // int
+    int P_eventsRingUsed; // int
+    int P_eventsRingHWM; // int
+    int P_eventsRingDropped; // int
+    int P_eventsRingBlocked; // int
+    int P_eventsFilter; // int
+    int P_eventsFilterChanMask; // int
+    int P_eventsFilterVMin; // float64array
+    int P_eventsFilterVMax; // float64array
+    int P_eventsFilterTMin; // double
+    int P_eventsFilterTMax; // double
+    int P_eventsFilterRejected; // float64array, per channel
+    int P_eventsFilterNRejected; // int
+    int P_eventsFilterNPassed; // int
+    int P_coinc; // int
+    int P_coincSource; // int, 0 digitiser events, 1 merged frames
+    int P_coincNChan; // int
+    int P_coincWindow; // double
+    int P_coincPairs; // float64array
+    int P_coincOutput; // int, a CoincidenceDetector::Output
+    int P_coincReset; // int
+    int P_coincCounts; // float64array, nchan * nchan
+    int P_coincRates; // float64array, nchan * nchan
+    int P_coincSinglesRates; // float64array
+    int P_coincFrames; // int
+    int P_coincTotal; // int
+    int P_coincDropped; // int
+    int P_asym; // int
+    int P_asymGroupingFile; // string
+    int P_asymGrouping; // float64array, an Asymmetry::Group per spectrum
+    int P_asymAlpha; // double
+    int P_asymBgFirst; // int
+    int P_asymBgLast; // int
+    int P_asymNFwd; // int
+    int P_asymNBwd; // int
+    int P_asymX; // float64array
+    int P_asymY; // float64array
+    int P_asymE; // float64array
+    int P_asymFwd; // float64array
+    int P_asymBwd; // float64array
+    int P_asymFwdTotal; // double
+    int P_asymBwdTotal; // double
+    int P_asymIntegral; // double
+    int P_asymIntegralErr; // double
+    int P_traceStream; // int
+    int P_traceStreamRate; // double, Hz
+    int P_traceStreamNPts; // int, envelope buckets, 0 for full resolution
+    int P_traceStreamMsgs; // int
+    int P_traceStreamDropped; // int
+    int P_traceAvg; // int, TraceAverager::Mode
+    int P_traceAvgNFrames; // int
+    int P_traceAvgCount; // int
+    int P_traceAvgReset; // int
+    int P_traceHist; // int
+    int P_traceHistNFrames; // int
+    int P_traceHistNChan; // int
+    int P_traceHistNPts; // int
+    int P_traceHistNPre; // int
+    int P_traceHistNPost; // int
+    int P_traceHistTrig; // int, TraceHistory::Trigger
+    int P_traceHistTrigChan; // int, -1 for any
+    int P_traceHistTrigLevel; // int, ADC counts
+    int P_traceHistArm; // int
+    int P_traceHistTrigger; // int
+    int P_traceHistState; // int, TraceHistory::State
+    int P_traceHistCaptures; // int
+    int P_traceHistTrigFrame; // int
+    int P_pulseFind; // int
+    int P_pulseFindMode; // int, PulseFinder::Mode
+    int P_pulseFindPolarity; // int, PulseFinder::Polarity
+    int P_pulseFindThreshold; // int, ADC counts from baseline
+    int P_pulseFindFraction; // double
+    int P_pulseFindBaseline; // int, samples
+    int P_pulseFindTraces; // int
+    int P_pulseFindPulses; // int
+    int P_pulseFindChan; // float64array, pulses of the last frame
+    int P_pulseFindTime; // float64array, ns
+    int P_pulseFindAmpl; // float64array
+    int P_pulseMatchNChan; // int
+    int P_pulseMatchWindow; // double, ns
+    int P_pulseMatchNBins; // int
+    int P_pulseMatchReset; // int
+    int P_pulseMatchEff; // double
+    int P_pulseMatchChanEff; // float64array
+    int P_pulseMatchDTX; // float64array, ns
+    int P_pulseMatchDT; // float64array
+    int P_pulseMatchDTChan; // float64array, nchan x nbins
+    int P_pulseMatchFrames; // int
+    int P_pulseMatchPulses; // int
+    int P_pulseMatchEvents; // int
+    int P_pulseMatchMatched; // int
+    int P_pulseMatchNoEvents; // int
+    int P_pulseMatchNoTraces; // int
     
     std::map<int, ParamData*> m_param_data;
+    std::map<std::string, int> m_param_latency; // "name_chan" to PARAM_LATENCY asyn param
+    std::atomic<int> m_paramBatchSize; // max parameters per get_parameters command, <= 1 to disable
+    std::atomic<bool> m_paramBatchSupported; // cleared if digitiser firmware does not understand get_parameters
+    int m_nParamBatchOk; // counts of multi and single parameter reads in the current readParams()
+    int m_nParamBatchFail;
+    int m_nParamSingleOk;
+    int m_nParamSingleFail;
+    std::atomic<bool> m_readBinary; // request binary replies for bulk reads
+    std::atomic<bool> m_readBinarySupported; // cleared if digitiser rejected a binary read request
+    std::atomic<bool> m_readBinaryConfirmed; // a binary reply has been received since READ_BINARY was set
+    std::atomic<bool> m_readBinaryActive; // last bulk read reply was binary
+    std::atomic<double> m_readDataRate[3]; // MB/s decode rate of last readData2d() for each address
+    std::atomic<int> m_readDataSize[3]; // bytes in last readData2d() reply for each address
     
 	#define FIRST_NUCINSTDIG_PARAM P_setup
-	#define LAST_NUCINSTDIG_PARAM P_resetDCSpectra
+	#define LAST_NUCINSTDIG_PARAM P_pulseMatchNoTraces
 
     //NDArray* m_pTraces;
     //NDArray* m_pDCSpectra;
     //NDArray* m_pTOFSpectra;
     NDArray* m_pRaw; // temporary for traces, tof etc. real info in this->pArrays[addr]
     
-    epicsMutex m_dcLock;
-    epicsMutex m_tracesLock;
-    epicsMutex m_TOFSpectraLock;
-    epicsMutex m_executeLock;
-    
-    std::vector<double> m_traces;
-    std::vector<double> m_dcSpectra;
-    std::vector<double> m_TOFSpectra;
-    size_t m_NTRACE;
-    size_t m_nDCSpec;
-    size_t m_nDCPts;
-    size_t m_nVoltage;
-    size_t m_nTOFPts;
-    size_t m_nTOFSpec;
+    TracesBuffer m_traces; // trace spectra are channels, points are voltage samples
+    SpectraBuffer m_dcSpectra;
+    SpectraBuffer m_TOFSpectra;
+
+    // worker threads wait on these, they are signalled by the READ_* parameters and refresh timers
+    epicsEvent m_readDCSpectraEvent;
+    epicsEvent m_readTOFSpectraEvent;
+    epicsEvent m_readTracesEvent;
+    epicsEvent m_traceStreamEvent; // TRACE_STREAM changed
+    epicsEvent m_readEventsEvent;
+    epicsEvent m_updateADEvent; // acquire started or new data published
+    epicsTimerQueueActive& m_timerQueue;
+    RefreshTimer m_DCSpectraTimer;
+    RefreshTimer m_TOFSpectraTimer;
+    RefreshTimer m_tracesTimer;
+
+    std::vector<EventConsumer*> m_eventConsumers;
+    epicsMutex m_eventConsumersLock;
+    std::atomic<int> m_eventsHWM;
+    std::atomic<bool> m_eventsLossless; // if false the events socket is conflated and only the latest message is kept
+    std::atomic<bool> m_eventsReconfigure; // socket options have changed
+    std::atomic<uint64_t> m_eventsNMsgs; // running totals updated by ingestEvents()
+    std::atomic<uint64_t> m_eventsNEvents;
+    std::atomic<uint64_t> m_eventsNBytes;
+    std::atomic<uint64_t> m_eventsNDropped; // messages that failed verification, missing frames are counted by m_frameTracker
+    EventRing m_eventsRing; // received by updateEvents(), processed by processEvents()
+    std::atomic<bool> m_traceStream; // updateTraces() is receiving dat2 messages
+    std::atomic<bool> m_traceFullRequest; // copy the next streamed message to m_traces
+    std::atomic<double> m_traceStreamRate;
+    std::atomic<int> m_traceStreamNPts;
+    std::atomic<uint64_t> m_traceStreamNMsgs;
+    std::atomic<uint64_t> m_traceStreamNDropped; // messages that failed verification
+    std::atomic<bool> m_traceStreamReconfigure; // conflate the trace socket unless averaging
+    TraceAverager m_traceAverager; // averages every streamed or read trace frame when TRACE_AVG is set
+    TraceHistory m_traceHistory; // last streamed trace frames and the triggered capture published on NDArray address 8
+    int m_traceHistNFrames;
+    int m_traceHistNChan;
+    int m_traceHistNPts;
+    int m_traceHistNPre;
+    int m_traceHistNPost;
+    uint64_t m_traceHistPublished; // captures published by updateAD()
+    PulseFinder m_pulseFinder; // on streamed traces when PULSE_FIND is 1
+    PulseMatcher m_pulseMatcher; // compares m_pulseFinder with the event stream
+    std::vector<Pulse> m_tracePulses; // scratch for updateTraces()
+    int m_pulseMatchNChan;
+    double m_pulseMatchWindow;
+    int m_pulseMatchNBins;
+    std::vector<Pulse> m_pulseFindLast; // published by zmqMonitorPoller()
+    std::vector<double> m_pulseFindChan;
+    std::vector<double> m_pulseFindTime;
+    std::vector<double> m_pulseFindAmpl;
+    std::vector<double> m_pulseMatchChanEff;
+    std::vector<double> m_pulseMatchDT;
+    std::vector<double> m_pulseMatchDTSum;
+    std::vector<double> m_pulseMatchDTX;
+    EventFilter m_eventFilter; // applied by ingestEvents() before the event consumers
+    std::vector<double> m_eventFilterRejected; // published by zmqMonitorPoller()
+    FrameTracker m_frameTracker[2]; // frame continuity and latency of the event and trace streams
+    Republisher m_eventsRepublisher; // forwards dev2 messages from ingestEvents()
+    Republisher m_tracesRepublisher; // forwards dat2 messages from updateTraces()
+
+    EventHistogram m_TOFHistogram; // TOF spectra histogrammed from events when TOF_SOURCE is 1
+    HistogramEventConsumer m_TOFHistogramConsumer;
+    int m_TOFHistNSpec;
+    double m_TOFHistTMin;
+    double m_TOFHistTMax;
+    int m_TOFHistNBins;
+    std::vector<double> m_TOFHistEdges; // if not empty, used instead of TMIN/TMAX/NBINS
+    SpectraBuffer m_TOFPeriods; // TOF x spectrum x period histogram when TOF_SOURCE is 1, NDArray address 7
+    int m_numPeriods;
+    int m_vetoMask;
+    int m_vetoMode;
+    std::vector<double> m_periodGoodFrames;
+    std::vector<double> m_periodProtonCharge;
+    EventHistogram m_pulseHeight; // channel x voltage histogram when PULSE_HEIGHT is 1
+    HistogramEventConsumer m_pulseHeightConsumer;
+    int m_pulseHeightNChan;
+    double m_pulseHeightVMin;
+    double m_pulseHeightVMax;
+    int m_pulseHeightNBins;
+    std::vector<epicsUInt32> m_pulseHeightData; // merged histogram for updateAD()
+    CoincidenceDetector m_coincidence; // channel coincidences when COINC is 1
+    std::vector<double> m_coincCounts; // published by zmqMonitorPoller()
+    std::vector<double> m_coincRates;
+    std::vector<double> m_coincSinglesRates;
+    Asymmetry m_asymmetry; // of the TOF spectra when ASYM is 1
+    Asymmetry::Result m_asymResult; // published by updateAsymmetry()
+    std::vector<double> m_asymX;
+    std::vector<double> m_asymGrouping;
     
     void updateTraces();
     void updateTracesOnRequest();
     void updateEvents();
+    void processEvents();
+    void ingestEvents(const std::shared_ptr<EventMessage>& msg);
+    void addEventConsumer(EventConsumer* consumer);
+    void configureTOFHistogram();
+    void checkHistogramSize(int nchan, int nbins, int nperiods);
+    void configurePulseHeight();
+    void configurePeriods();
+    void updatePeriodCounts();
+    void updateAsymmetry(const Data2d<epicsUInt32>& spectra);
+    void updateAsymmetryGrouping();
+    int computeCube(int addr, const std::vector<epicsUInt32>& data, int nx, int ny, int nz);
+    void configureTraceHistory();
+    void configurePulseMatcher();
+    int computeTraceCapture(int addr);
     void updateDCSpectra();
     void updateTOFSpectra();
     void updateAD();
     void zmqMonitorPoller();
-    void execute(const std::string& type, const std::string& name, const std::string& arg1, const std::string& arg2, rapidjson::Document& doc_recv);
+    void execute(const std::string& type, const std::string& name, const std::string& arg1, const std::string& arg2, rapidjson::Document& doc_recv, CommandClass cls);
+    std::string formatCommand(const std::string& type, const std::string& name, const std::string& arg1, const std::string& arg2);
+    zmq::message_t receiveReply(const std::string& sendstr, std::future<zmq::message_t>& reply_future);
+    void completeCommand(const std::string& sendstr, std::future<zmq::message_t>& reply_future, rapidjson::Document& doc_recv);
+    void setParamFromValue(int param, ParamData* p, const rapidjson::Value& value);
+    std::string formatGetParamsCommand(const ParamBatch& batch);
+    void completeParamBatch(const ParamBatch& batch, const std::string& sendstr, std::future<zmq::message_t>& reply_future);
+    void readParamBatchSplit(const ParamBatch& batch);
+    void readParams(const ParamBatch& params);
 	void executeCmd(const std::string& name, const std::string& args = "");
     void getParameter(const std::string& name, rapidjson::Document& doc_recv, int idx = 0);
     void setParameter(const std::string& name, const std::string& value, int idx = 0);
@@ -236,6 +1041,7 @@ private:
     
     void setup();
     
+    void createStreamParams(const char* name, asynParamType type, int* param);
     void createNParams(const char* name, asynParamType type, int* param, int n);
     
 	void pollerThread1();
@@ -244,19 +1050,26 @@ private:
 	void pollerThread4();
 	void pollerThread5();
 	void pollerThread6();
-    void readData2d(const std::string& name, const std::string& args, std::vector<double>& dataOut, size_t& nspec, size_t& npts);
+	void pollerThread7();
+	void pollerThread8();
+    template <typename T>
+        void readData2d(const std::string& name, const std::string& args, std::vector<T>& dataOut, size_t& nspec, size_t& npts, int addr);
+    template <typename T>
+        void decodeData2dBinary(const std::string& sendstr, const zmq::message_t& reply, std::vector<T>& dataOut, size_t& nspec, size_t& npts);
+    template <typename T>
+        bool decodeData2dJSON(const std::string& sendstr, const zmq::message_t& reply, std::vector<T>& dataOut, size_t& nspec, size_t& npts, bool fallback);
     void setADAcquire(int addr, int acquire);
-    int computeImage(int addr, const std::vector<double>& data_in, int nx, int ny);
-    template <typename epicsType> 
-         int computeArray(int addr, const std::vector<double>& data, int maxSizeX, int maxSizeY);
-         
-    int callComputeArray(NDDataType_t dataType, int addr,
-      const std::vector<double>& data, int sizeX, int sizeY);
-    int rebin(const double* data_in, double xmin_in, double xmax_in, int nin,
+    template <typename T>
+        int computeImage(int addr, const std::vector<T>& data_in, int nx, int ny);
+    template <typename epicsType, typename T> 
+         int computeArray(int addr, const std::vector<T>& data, int maxSizeX, int maxSizeY);
+    template <typename T>
+        int callComputeArray(NDDataType_t dataType, int addr,
+          const std::vector<T>& data, int sizeX, int sizeY);
+    template <typename T>
+        int rebin(const T* data_in, double xmin_in, double xmax_in, int nin,
                double* data_out, double xmin_out, double xmax_out, int nout);
 
-    std::vector<double> m_traceX[4];
-    std::vector<double> m_traceY[4];
     int m_traceIdx[4];
     std::vector<double> m_DCSpecX[4];
     std::vector<double> m_DCSpecY[4];
@@ -267,10 +1080,19 @@ private:
     
     int m_dig_idx;
     int m_dig_id; // this is our position in g_dig_list
+    bool m_mergeOwner; // first digitiser port, the only one with MERGE_* parameters
     
     static NDArray* g_rawCombined[3]; // across all digitisers
     static std::vector<NucInstDig*> g_dig_list;
     static epicsMutex g_digCombinedLock;
+    static FrameMerger* g_frameMerger; // events of all digitisers merged by frame
+    static FrameMerger& frameMerger() {
+        epicsGuard<epicsMutex> _lock(g_digCombinedLock);
+        if (g_frameMerger == NULL) {
+            g_frameMerger = new FrameMerger();
+        }
+        return *g_frameMerger;
+    }
     public:
     void setDigId(int id) { m_dig_id = id; }
     static void addDigitiser(NucInstDig* dig, int dig_idx) {
@@ -278,6 +1100,18 @@ private:
         g_dig_list.push_back(dig);
         dig->setDigId(g_dig_list.size() - 1);
     }
+    static NucInstDig* findDigitiser(const char* portName) {
+        if (portName == NULL) {
+            return NULL;
+        }
+        epicsGuard<epicsMutex> _lock(g_digCombinedLock);
+        for(size_t i=0; i<g_dig_list.size(); ++i) {
+            if (strcmp(g_dig_list[i]->portName, portName) == 0) {
+                return g_dig_list[i];
+            }
+        }
+        return NULL;
+    }
 };
 
 #define P_setupString	            "SETUP"
@@ -306,5 +1140,166 @@ private:
 #define P_TOFSpecYString            "TOFSPEC%dY"
 #define P_TOFSpecIdxString          "TOFSPEC%dIDX"
 #define P_readTracesString          "READ_TRACES"
+#define P_paramBatchSizeString      "PARAM_BATCH_SIZE"
+#define P_paramSweepTimeString      "PARAM_SWEEP_TIME"
+#define P_paramPollPeriodString     "PARAM_POLL_PERIOD"
+#define P_cmdQueueDepthString       "CMDQ%dDEPTH"
+#define P_cmdQueueWaitString        "CMDQ%dWAIT"
+#define P_readDataRateString        "READDATA%dRATE"
+#define P_readDataSizeString        "READDATA%dSIZE"
+#define P_readBinaryString          "READ_BINARY"
+#define P_readBinaryActiveString    "READ_BINARY_ACTIVE"
+#define P_DCSpectraPeriodString     "READ_DC_SPECTRA_PERIOD"
+#define P_TOFSpectraPeriodString    "READ_TOF_SPECTRA_PERIOD"
+#define P_tracesPeriodString        "READ_TRACES_PERIOD"
+#define P_eventsHWMString           "EVENTS_HWM"
+#define P_eventsLosslessString      "EVENTS_LOSSLESS"
+#define P_eventsMsgRateString       "EVENTS_MSG_RATE"
+#define P_eventsEventRateString     "EVENTS_EVENT_RATE"
+#define P_eventsByteRateString      "EVENTS_BYTE_RATE"
+#define P_eventsDropRateString      "EVENTS_DROP_RATE"
+#define P_eventsDroppedString       "EVENTS_DROPPED"
+#define P_TOFSourceString           "TOF_SOURCE"
+#define P_TOFHistNSpecString        "TOF_HIST_NSPEC"
+#define P_TOFHistTMinString         "TOF_HIST_TMIN"
+#define P_TOFHistTMaxString         "TOF_HIST_TMAX"
+#define P_TOFHistNBinsString        "TOF_HIST_NBINS"
+#define P_TOFHistEdgesString        "TOF_HIST_EDGES"
+#define P_TOFHistDroppedString      "TOF_HIST_DROPPED"
+#define P_TOFHistOutsideString      "TOF_HIST_OUTSIDE"
+#define P_pulseHeightString         "PULSE_HEIGHT"
+#define P_resetPulseHeightString    "RESET_PULSE_HEIGHT"
+#define P_pulseHeightNChanString    "PULSE_HEIGHT_NCHAN"
+#define P_pulseHeightVMinString     "PULSE_HEIGHT_VMIN"
+#define P_pulseHeightVMaxString     "PULSE_HEIGHT_VMAX"
+#define P_pulseHeightNBinsString    "PULSE_HEIGHT_NBINS"
+#define P_pulseHeightDroppedString  "PULSE_HEIGHT_DROPPED"
+#define P_pulseHeightOutsideString  "PULSE_HEIGHT_OUTSIDE"
+#define P_numPeriodsString          "NUM_PERIODS"
+#define P_vetoMaskString            "VETO_MASK"
+#define P_vetoModeString            "VETO_MODE"
+#define P_currentPeriodString       "CURRENT_PERIOD"
+#define P_rawFramesString           "RAW_FRAMES"
+#define P_goodFramesString          "GOOD_FRAMES"
+#define P_vetoedFramesString        "VETOED_FRAMES"
+#define P_protonChargeString        "PROTON_CHARGE"
+#define P_periodGoodFramesString    "PERIOD_GOOD_FRAMES"
+#define P_periodProtonChargeString  "PERIOD_PROTON_CHARGE"
+#define P_resetFrameStatsString     "RESET_FRAME_STATS"
+#define P_framesString              "%s_FRAMES"   // %s is EVENTS or TRACES
+#define P_framesMissingString       "%s_FRAMES_MISSING"
+#define P_framesDuplicateString     "%s_FRAMES_DUPLICATE"
+#define P_framesOutOfOrderString    "%s_FRAMES_OUT_OF_ORDER"
+#define P_frameLatencyP50String     "%s_LATENCY_P50"
+#define P_frameLatencyP90String     "%s_LATENCY_P90"
+#define P_frameLatencyP99String     "%s_LATENCY_P99"
+#define P_frameLatencyMaxString     "%s_LATENCY_MAX"
+#define P_republishedString         "%s_REPUBLISHED"
+#define P_republishDroppedString    "%s_REPUBLISH_DROPPED"
+#define P_mergeEventsString         "MERGE_EVENTS"
+#define P_mergeWindowString         "MERGE_WINDOW"
+#define P_mergeTimeoutString        "MERGE_TIMEOUT"
+#define P_mergeNChanString          "MERGE_NCHAN"
+#define P_mergeFramesString         "MERGE_FRAMES"
+#define P_mergeIncompleteString     "MERGE_INCOMPLETE"
+#define P_mergeLateString           "MERGE_LATE"
+#define P_mergePendingString        "MERGE_PENDING"
+#define P_mergeNDigString           "MERGE_NDIG"
+#define P_mergeMismatchedString     "MERGE_MISMATCHED"
+#define P_mergeBadChanString        "MERGE_BADCHAN"
+#define P_eventsRingPolicyString    "EVENTS_RING_POLICY"
+#define P_eventsRingSizeString      "EVENTS_RING_SIZE"
+#define P_eventsRingUsedString      "EVENTS_RING_USED"
+#define P_eventsRingHWMString       "EVENTS_RING_HWM"
+#define P_eventsRingDroppedString   "EVENTS_RING_DROPPED"
+#define P_eventsRingBlockedString   "EVENTS_RING_BLOCKED"
+#define P_eventsFilterString        "EVENTS_FILTER"
+#define P_eventsFilterChanMaskString "EVENTS_FILTER_CHAN_MASK"
+#define P_eventsFilterVMinString    "EVENTS_FILTER_VMIN"
+#define P_eventsFilterVMaxString    "EVENTS_FILTER_VMAX"
+#define P_eventsFilterTMinString    "EVENTS_FILTER_TMIN"
+#define P_eventsFilterTMaxString    "EVENTS_FILTER_TMAX"
+#define P_eventsFilterRejectedString "EVENTS_FILTER_REJECTED"
+#define P_eventsFilterNRejectedString "EVENTS_FILTER_NREJECTED"
+#define P_eventsFilterNPassedString "EVENTS_FILTER_NPASSED"
+#define P_coincString               "COINC"
+#define P_coincSourceString         "COINC_SOURCE"
+#define P_coincNChanString          "COINC_NCHAN"
+#define P_coincWindowString         "COINC_WINDOW"
+#define P_coincPairsString          "COINC_PAIRS"
+#define P_coincOutputString         "COINC_OUTPUT"
+#define P_coincResetString          "COINC_RESET"
+#define P_coincCountsString         "COINC_COUNTS"
+#define P_coincRatesString          "COINC_RATES"
+#define P_coincSinglesRatesString   "COINC_SINGLES_RATES"
+#define P_coincFramesString         "COINC_FRAMES"
+#define P_coincTotalString          "COINC_TOTAL"
+#define P_coincDroppedString        "COINC_DROPPED"
+#define P_asymString                "ASYM"
+#define P_asymGroupingFileString    "ASYM_GROUPING_FILE"
+#define P_asymGroupingString        "ASYM_GROUPING"
+#define P_asymAlphaString           "ASYM_ALPHA"
+#define P_asymBgFirstString         "ASYM_BG_FIRST"
+#define P_asymBgLastString          "ASYM_BG_LAST"
+#define P_asymNFwdString            "ASYM_NFWD"
+#define P_asymNBwdString            "ASYM_NBWD"
+#define P_asymXString               "ASYM_X"
+#define P_asymYString               "ASYM_Y"
+#define P_asymEString               "ASYM_E"
+#define P_asymFwdString             "ASYM_FWD"
+#define P_asymBwdString             "ASYM_BWD"
+#define P_asymFwdTotalString        "ASYM_FWD_TOTAL"
+#define P_asymBwdTotalString        "ASYM_BWD_TOTAL"
+#define P_asymIntegralString        "ASYM_INTEGRAL"
+#define P_asymIntegralErrString     "ASYM_INTEGRAL_ERR"
+#define P_traceStreamString         "TRACE_STREAM"
+#define P_traceStreamRateString     "TRACE_STREAM_RATE"
+#define P_traceStreamNPtsString     "TRACE_STREAM_NPTS"
+#define P_traceStreamMsgsString     "TRACE_STREAM_MSGS"
+#define P_traceStreamDroppedString  "TRACE_STREAM_DROPPED"
+#define P_traceAvgString            "TRACE_AVG"
+#define P_traceAvgNFramesString     "TRACE_AVG_NFRAMES"
+#define P_traceAvgCountString       "TRACE_AVG_COUNT"
+#define P_traceAvgResetString       "TRACE_AVG_RESET"
+#define P_traceHistString           "TRACE_HIST"
+#define P_traceHistNFramesString    "TRACE_HIST_NFRAMES"
+#define P_traceHistNChanString      "TRACE_HIST_NCHAN"
+#define P_traceHistNPtsString       "TRACE_HIST_NPTS"
+#define P_traceHistNPreString       "TRACE_HIST_NPRE"
+#define P_traceHistNPostString      "TRACE_HIST_NPOST"
+#define P_traceHistTrigString       "TRACE_HIST_TRIG"
+#define P_traceHistTrigChanString   "TRACE_HIST_TRIG_CHAN"
+#define P_traceHistTrigLevelString  "TRACE_HIST_TRIG_LEVEL"
+#define P_traceHistArmString        "TRACE_HIST_ARM"
+#define P_traceHistTriggerString    "TRACE_HIST_TRIGGER"
+#define P_traceHistStateString      "TRACE_HIST_STATE"
+#define P_traceHistCapturesString   "TRACE_HIST_CAPTURES"
+#define P_traceHistTrigFrameString  "TRACE_HIST_TRIG_FRAME"
+#define P_pulseFindString           "PULSE_FIND"
+#define P_pulseFindModeString       "PULSE_FIND_MODE"
+#define P_pulseFindPolarityString   "PULSE_FIND_POLARITY"
+#define P_pulseFindThresholdString  "PULSE_FIND_THRESHOLD"
+#define P_pulseFindFractionString   "PULSE_FIND_FRACTION"
+#define P_pulseFindBaselineString   "PULSE_FIND_BASELINE"
+#define P_pulseFindTracesString     "PULSE_FIND_TRACES"
+#define P_pulseFindPulsesString     "PULSE_FIND_PULSES"
+#define P_pulseFindChanString       "PULSE_FIND_CHAN"
+#define P_pulseFindTimeString       "PULSE_FIND_TIME"
+#define P_pulseFindAmplString       "PULSE_FIND_AMPL"
+#define P_pulseMatchNChanString     "PULSE_MATCH_NCHAN"
+#define P_pulseMatchWindowString    "PULSE_MATCH_WINDOW"
+#define P_pulseMatchNBinsString     "PULSE_MATCH_NBINS"
+#define P_pulseMatchResetString     "PULSE_MATCH_RESET"
+#define P_pulseMatchEffString       "PULSE_MATCH_EFF"
+#define P_pulseMatchChanEffString   "PULSE_MATCH_CHAN_EFF"
+#define P_pulseMatchDTXString       "PULSE_MATCH_DT_X"
+#define P_pulseMatchDTString        "PULSE_MATCH_DT"
+#define P_pulseMatchDTChanString    "PULSE_MATCH_DT_CHAN"
+#define P_pulseMatchFramesString    "PULSE_MATCH_FRAMES"
+#define P_pulseMatchPulsesString    "PULSE_MATCH_PULSES"
+#define P_pulseMatchEventsString    "PULSE_MATCH_EVENTS"
+#define P_pulseMatchMatchedString   "PULSE_MATCH_MATCHED"
+#define P_pulseMatchNoEventsString  "PULSE_MATCH_NO_EVENTS"
+#define P_pulseMatchNoTracesString  "PULSE_MATCH_NO_TRACES"
 
 #endif /* NUCINSTDIG_H */
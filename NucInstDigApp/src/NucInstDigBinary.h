@@ -0,0 +1,110 @@
+#ifndef NUCINSTDIGBINARY_H
+#define NUCINSTDIGBINARY_H
+
+/// Binary reply format for execute_read_command.
+///
+/// If the command JSON contains "format":"binary" a digitiser that supports it replies with a
+/// NIDGBinaryHeader followed by nspec*npts little endian values of type dtype, spectrum by spectrum.
+/// Error replies, and digitisers that do not support binary mode, still reply with JSON so
+/// a reply is binary only if it starts with NIDG_BINARY_MAGIC (a JSON reply always starts with '{').
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <type_traits>
+
+#include <epicsEndian.h>
+
+#define NIDG_BINARY_MAGIC   "NIDB"
+#define NIDG_BINARY_VERSION 1
+
+enum NIDGBinaryType { NIDGBinaryUInt16 = 1, NIDGBinaryUInt32 = 2 };
+
+#pragma pack(push, 1)
+struct NIDGBinaryHeader
+{
+    char magic[4];        ///< NIDG_BINARY_MAGIC, not null terminated
+    uint8_t version;      ///< NIDG_BINARY_VERSION
+    uint8_t dtype;        ///< an NIDGBinaryType
+    uint16_t header_size; ///< offset of data from start of message, allows header to be extended
+    uint32_t nspec;       ///< number of spectra (or traces)
+    uint32_t npts;        ///< points in each spectrum
+};
+#pragma pack(pop)
+
+/// size in bytes of one value of type dtype, 0 if unknown
+inline size_t nidgBinaryTypeSize(int dtype)
+{
+    switch(dtype)
+    {
+        case NIDGBinaryUInt16:
+            return sizeof(uint16_t);
+        case NIDGBinaryUInt32:
+            return sizeof(uint32_t);
+        default:
+            return 0;
+    }
+}
+
+/// true if a reply starts with a binary header rather than JSON text
+inline bool nidgIsBinaryReply(const void* data, size_t size)
+{
+    return (size >= sizeof(NIDGBinaryHeader) && memcmp(data, NIDG_BINARY_MAGIC, 4) == 0);
+}
+
+/// read little endian unsigned integers from a possibly unaligned buffer
+template <typename T>
+inline T nidgReadLE(const char* p)
+{
+    T v;
+    memcpy(&v, p, sizeof(T));
+#if EPICS_BYTE_ORDER == EPICS_ENDIAN_BIG
+    T r = 0;
+    for(size_t i = 0; i < sizeof(T); ++i)
+    {
+        r = static_cast<T>((r << 8) | static_cast<uint8_t>(p[sizeof(T) - 1 - i]));
+    }
+    v = r;
+#endif /* EPICS_BYTE_ORDER */
+    return v;
+}
+
+/// write little endian unsigned integers, used by the test server
+template <typename T>
+inline void nidgWriteLE(char* p, T v)
+{
+    for(size_t i = 0; i < sizeof(T); ++i)
+    {
+        p[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+
+/// convert count values of type S stored little endian at src to dest
+template <typename S, typename D>
+inline void nidgConvertLE(const char* src, size_t count, D* dest)
+{
+#if EPICS_BYTE_ORDER == EPICS_ENDIAN_LITTLE
+    if (std::is_same<S, D>::value)
+    {
+        memcpy(dest, src, count * sizeof(S)); // already in native layout
+        return;
+    }
+#endif /* EPICS_BYTE_ORDER */
+    for(size_t i = 0; i < count; ++i)
+    {
+        dest[i] = static_cast<D>(nidgReadLE<S>(src + i * sizeof(S)));
+    }
+}
+
+/// fill in a header, header fields are stored little endian like the data
+inline void nidgMakeBinaryHeader(char* p, NIDGBinaryType dtype, uint32_t nspec, uint32_t npts)
+{
+    memcpy(p, NIDG_BINARY_MAGIC, 4);
+    p[4] = NIDG_BINARY_VERSION;
+    p[5] = static_cast<char>(dtype);
+    nidgWriteLE<uint16_t>(p + offsetof(NIDGBinaryHeader, header_size), static_cast<uint16_t>(sizeof(NIDGBinaryHeader)));
+    nidgWriteLE<uint32_t>(p + offsetof(NIDGBinaryHeader, nspec), nspec);
+    nidgWriteLE<uint32_t>(p + offsetof(NIDGBinaryHeader, npts), npts);
+}
+
+#endif /* NUCINSTDIGBINARY_H */
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "PulseFinder.h"
+
+// first k >= start with samples[k] >= level (above) or samples[k] <= level (!above), n if none
+static size_t scanFirst(const uint16_t* samples, size_t n, size_t start, uint16_t level, bool above)
+{
+    size_t i = start;
+#if defined(__AVX2__)
+    // no unsigned 16 bit compare, flipping the top bit maps unsigned order onto signed order
+    const __m256i flip = _mm256_set1_epi16(static_cast<short>(0x8000));
+    const __m256i lv = _mm256_set1_epi16(static_cast<short>(level ^ 0x8000));
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i)), flip);
+        __m256i miss = (above ? _mm256_cmpgt_epi16(lv, v) : _mm256_cmpgt_epi16(v, lv));
+        if (_mm256_movemask_epi8(miss) != -1)
+        {
+            break; // a hit in these 16, found below
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i lv = _mm_set1_epi16(static_cast<short>(level ^ 0x8000));
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i)), flip);
+        __m128i miss = (above ? _mm_cmpgt_epi16(lv, v) : _mm_cmpgt_epi16(v, lv));
+        if (_mm_movemask_epi8(miss) != 0xffff)
+        {
+            break;
+        }
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        if (above ? samples[i] >= level : samples[i] <= level)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+// height of a sample above the baseline in the direction of the pulses
+static inline int height(uint16_t sample, int baseline, bool above)
+{
+    return (above ? static_cast<int>(sample) - baseline : baseline - static_cast<int>(sample));
+}
+
+PulseFinder::PulseFinder() : m_enabled(false), m_mode(ModeThreshold), m_polarity(PolarityPositive), m_threshold(100), m_fraction(0.5),
+                             m_baselineSamples(16), m_nTraces(0), m_nPulses(0)
+{
+}
+
+void PulseFinder::find(uint32_t channel, const uint16_t* samples, size_t n, double sample_ns, std::vector<Pulse>& pulses)
+{
+    ++m_nTraces;
+    if (n == 0)
+    {
+        return;
+    }
+    int mode = m_mode, threshold = std::max(static_cast<int>(m_threshold), 1);
+    double fraction = m_fraction;
+    bool above = (m_polarity == PolarityPositive);
+    size_t nb = std::min(n, static_cast<size_t>(m_baselineSamples));
+    uint64_t sum = 0;
+    for(size_t k=0; k<nb; ++k)
+    {
+        sum += samples[k];
+    }
+    int baseline = static_cast<int>((sum + nb / 2) / nb);
+    int level = (above ? baseline + threshold : baseline - threshold);
+    if (level < 0 || level > UINT16_MAX)
+    {
+        return; // no sample can reach it
+    }
+    size_t npulses = 0, k = 0;
+    while((k = scanFirst(samples, n, k, static_cast<uint16_t>(level), above)) < n)
+    {
+        size_t start = k, peak = k;
+        int hmax = height(samples[k], baseline, above);
+        for(++k; k < n && height(samples[k], baseline, above) >= threshold; ++k)
+        {
+            if (height(samples[k], baseline, above) > hmax)
+            {
+                hmax = height(samples[k], baseline, above);
+                peak = k;
+            }
+        }
+        double t = static_cast<double>(start);
+        if (mode == ModeCFD)
+        {
+            double level_cfd = fraction * hmax;
+            size_t j = peak;
+            while(j > 0 && height(samples[j], baseline, above) >= level_cfd)
+            {
+                --j;
+            }
+            int h0 = height(samples[j], baseline, above);
+            if (j < peak && h0 < level_cfd)
+            {
+                t = j + (level_cfd - h0) / static_cast<double>(height(samples[j + 1], baseline, above) - h0);
+            }
+            else
+            {
+                t = static_cast<double>(j);
+            }
+        }
+        else if (start > 0)
+        {
+            int h0 = height(samples[start - 1], baseline, above), h1 = height(samples[start], baseline, above);
+            t = (start - 1) + (threshold - h0) / static_cast<double>(h1 - h0);
+        }
+        Pulse p;
+        p.channel = channel;
+        p.time = t * sample_ns;
+        p.amplitude = static_cast<uint16_t>(std::min(hmax, static_cast<int>(UINT16_MAX)));
+        pulses.push_back(p);
+        ++npulses;
+    }
+    m_nPulses += npulses;
+}
+
+void PulseFinder::report(FILE* fp)
+{
+    static const char* modes[] = { "threshold", "CFD" };
+    fprintf(fp, "  Pulse finder: %s, %s %s pulses, threshold %d, fraction %g, baseline of %d samples, %llu traces %llu pulses\n",
+            (m_enabled ? "enabled" : "disabled"), (m_mode == ModeCFD ? modes[1] : modes[0]),
+            (m_polarity == PolarityNegative ? "negative" : "positive"), static_cast<int>(m_threshold), static_cast<double>(m_fraction),
+            static_cast<int>(m_baselineSamples), static_cast<unsigned long long>(m_nTraces), static_cast<unsigned long long>(m_nPulses));
+}
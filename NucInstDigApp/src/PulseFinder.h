@@ -0,0 +1,61 @@
+#ifndef PULSEFINDER_H
+#define PULSEFINDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+/// a pulse found in a trace
+struct Pulse
+{
+    uint32_t channel;
+    double time; ///< ns since the start of the trace
+    uint16_t amplitude; ///< peak height above the baseline, ADC counts
+};
+
+/// Software pulse finder on uint16 trace samples, independent of the digitiser's own discrimination
+/// so the two can be compared, see PulseMatcher.
+///
+/// The baseline is the mean of the first baseline samples of the trace and a pulse is a run of samples
+/// at least threshold above it, or below it for negative pulses. The search for the next run tests 16
+/// samples at a time with AVX2, or 8 with SSE2, when the compiler targets it, so the time taken is mostly
+/// that of reading the trace. The amplitude is the peak of the run and the time is where the leading edge
+/// crosses the threshold (ModeThreshold) or fraction of the amplitude (ModeCFD, a constant fraction
+/// discriminator that does not walk with amplitude), interpolated between samples.
+class PulseFinder
+{
+public:
+    enum Mode { ModeThreshold = 0, ModeCFD = 1 };
+    enum Polarity { PolarityPositive = 0, PolarityNegative = 1 };
+
+    PulseFinder();
+    void enable(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    void setMode(int mode) { m_mode = mode; }
+    void setPolarity(int polarity) { m_polarity = polarity; }
+    /// ADC counts from the baseline
+    void setThreshold(int threshold) { m_threshold = threshold; }
+    /// of the amplitude for ModeCFD, 0 to 1
+    void setFraction(double fraction) { m_fraction = fraction; }
+    /// at least 1
+    void setBaselineSamples(int n) { m_baselineSamples = (n > 0 ? n : 1); }
+    /// append the pulses of a trace of n samples, each sample_ns long, to pulses in time order
+    void find(uint32_t channel, const uint16_t* samples, size_t n, double sample_ns, std::vector<Pulse>& pulses);
+    uint64_t tracesSearched() const { return m_nTraces; }
+    uint64_t pulsesFound() const { return m_nPulses; }
+    void report(FILE* fp);
+
+private:
+    std::atomic<bool> m_enabled;
+    std::atomic<int> m_mode;
+    std::atomic<int> m_polarity;
+    std::atomic<int> m_threshold;
+    std::atomic<double> m_fraction;
+    std::atomic<int> m_baselineSamples;
+    std::atomic<uint64_t> m_nTraces;
+    std::atomic<uint64_t> m_nPulses;
+};
+
+#endif /* PULSEFINDER_H */
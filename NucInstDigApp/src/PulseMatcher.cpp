@@ -0,0 +1,261 @@
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <epicsGuard.h>
+
+#include "PulseMatcher.h"
+
+PulseMatcher::PulseMatcher(size_t max_pending) : m_max_pending(max_pending), m_enabled(false), m_nchan(0), m_window(0.0), m_nbins(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    configure(8, 100.0, 100);
+}
+
+void PulseMatcher::checkSize(size_t nchan, size_t nbins)
+{
+    if (nchan == 0 || nchan > MaxChannels || nbins == 0 || nbins > MaxBins)
+    {
+        throw std::runtime_error("PulseMatcher: channels must be 1 to " + std::to_string(MaxChannels) + " and bins 1 to " +
+                                 std::to_string(MaxBins));
+    }
+}
+
+void PulseMatcher::configure(size_t nchan, double window, size_t nbins)
+{
+    checkSize(nchan, nbins);
+    std::vector<uint64_t> pulses(nchan, 0), events(nchan, 0), matched(nchan, 0), dt(nchan * nbins, 0);
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_nchan = nchan;
+    m_window = (window > 0.0 ? window : 1.0);
+    m_nbins = nbins;
+    m_pending.clear();
+    m_pulses.swap(pulses);
+    m_events.swap(events);
+    m_matched.swap(matched);
+    m_dt.swap(dt);
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void PulseMatcher::reset()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    std::fill(m_pulses.begin(), m_pulses.end(), 0);
+    std::fill(m_events.begin(), m_events.end(), 0);
+    std::fill(m_matched.begin(), m_matched.end(), 0);
+    std::fill(m_dt.begin(), m_dt.end(), 0);
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// index in m_pending of the frame, added if it is not there
+size_t PulseMatcher::find(int digitizer_id, uint32_t frame_number)
+{
+    for(size_t i=0; i<m_pending.size(); ++i)
+    {
+        if (m_pending[i].frame_number == frame_number && m_pending[i].digitizer_id == digitizer_id)
+        {
+            return i;
+        }
+    }
+    m_pending.push_back(Pending());
+    m_pending.back().digitizer_id = digitizer_id;
+    m_pending.back().frame_number = frame_number;
+    return m_pending.size() - 1;
+}
+
+// drop the oldest frames still waiting for their other half
+void PulseMatcher::expire()
+{
+    while(m_pending.size() > m_max_pending)
+    {
+        if (m_pending.front().has_pulses)
+        {
+            ++m_stats.frames_no_events;
+        }
+        else
+        {
+            ++m_stats.frames_no_traces;
+        }
+        m_pending.pop_front();
+    }
+}
+
+void PulseMatcher::addPulses(int digitizer_id, uint32_t frame_number, std::vector<Pulse>& pulses)
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+    Pending ready;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        m_last.assign(pulses.begin(), pulses.end());
+        size_t idx = find(digitizer_id, frame_number);
+        Pending& p = m_pending[idx];
+        p.pulses.swap(pulses);
+        p.has_pulses = true;
+        if (p.events == NULL)
+        {
+            expire();
+            return;
+        }
+        std::swap(ready, p);
+        m_pending.erase(m_pending.begin() + idx);
+    }
+    match(ready);
+}
+
+void PulseMatcher::consumeEvents(const EventMessagePtr& msg)
+{
+    if (!m_enabled)
+    {
+        return;
+    }
+    const DigitizerEventListMessage* ev = msg->events();
+    if (ev->metadata() == NULL)
+    {
+        return;
+    }
+    Pending ready;
+    {
+        epicsGuard<epicsMutex> _lock(m_lock);
+        size_t idx = find(ev->digitizer_id(), ev->metadata()->frame_number());
+        Pending& p = m_pending[idx];
+        p.events = msg;
+        if (!p.has_pulses)
+        {
+            expire();
+            return;
+        }
+        std::swap(ready, p);
+        m_pending.erase(m_pending.begin() + idx);
+    }
+    match(ready);
+}
+
+static bool pulseBefore(const Pulse& a, const Pulse& b)
+{
+    return (a.channel != b.channel ? a.channel < b.channel : a.time < b.time);
+}
+
+// pair pulses and events channel by channel, both in channel then time order
+void PulseMatcher::match(const Pending& p)
+{
+    std::vector<Pulse> pulses(p.pulses);
+    std::sort(pulses.begin(), pulses.end(), pulseBefore);
+    EventList events = p.events->eventList();
+    std::vector<uint64_t> order; // channel << 32 | time
+    order.reserve(events.n);
+    for(size_t i=0; i<events.n; ++i)
+    {
+        order.push_back(static_cast<uint64_t>(events.channel[i]) << 32 | events.time[i]);
+    }
+    std::sort(order.begin(), order.end());
+    epicsGuard<epicsMutex> _lock(m_lock);
+    double bin_width = 2.0 * m_window / m_nbins;
+    size_t i = 0, j = 0, nmatched = 0;
+    for(size_t k=0; k<order.size(); ++k)
+    {
+        uint32_t chan = static_cast<uint32_t>(order[k] >> 32);
+        if (chan < m_nchan)
+        {
+            ++m_events[chan];
+        }
+    }
+    for(size_t k=0; k<pulses.size(); ++k)
+    {
+        if (pulses[k].channel < m_nchan)
+        {
+            ++m_pulses[pulses[k].channel];
+        }
+    }
+    while(i < pulses.size() && j < order.size())
+    {
+        uint32_t chan = static_cast<uint32_t>(order[j] >> 32);
+        double t = static_cast<double>(order[j] & 0xffffffff);
+        if (pulses[i].channel < chan)
+        {
+            ++i;
+        }
+        else if (pulses[i].channel > chan)
+        {
+            ++j;
+        }
+        else if (t < pulses[i].time - m_window)
+        {
+            ++j; // event with no pulse
+        }
+        else if (t > pulses[i].time + m_window)
+        {
+            ++i; // pulse with no event
+        }
+        else
+        {
+            double dt = t - pulses[i].time;
+            if (chan < m_nchan)
+            {
+                ++m_matched[chan];
+                size_t bin = std::min(static_cast<size_t>(floor((dt + m_window) / bin_width)), m_nbins - 1);
+                ++m_dt[chan * m_nbins + bin];
+            }
+            ++nmatched;
+            ++i;
+            ++j;
+        }
+    }
+    ++m_stats.frames;
+    m_stats.pulses += pulses.size();
+    m_stats.events += order.size();
+    m_stats.matched += nmatched;
+}
+
+void PulseMatcher::merge(std::vector<double>& efficiency, std::vector<double>& dt, std::vector<double>& dt_sum, std::vector<double>& dt_x,
+                         size_t& nchan, size_t& nbins)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    nchan = m_nchan;
+    nbins = m_nbins;
+    efficiency.resize(nchan);
+    dt.resize(nchan * nbins);
+    dt_sum.assign(nbins, 0.0);
+    dt_x.resize(nbins);
+    for(size_t i=0; i<nchan; ++i)
+    {
+        efficiency[i] = (m_pulses[i] > 0 ? static_cast<double>(m_matched[i]) / m_pulses[i] : 0.0);
+        for(size_t k=0; k<nbins; ++k)
+        {
+            dt[i * nbins + k] = static_cast<double>(m_dt[i * nbins + k]);
+            dt_sum[k] += dt[i * nbins + k];
+        }
+    }
+    double bin_width = 2.0 * m_window / nbins;
+    for(size_t k=0; k<nbins; ++k)
+    {
+        dt_x[k] = -m_window + (k + 0.5) * bin_width;
+    }
+}
+
+void PulseMatcher::lastPulses(std::vector<Pulse>& pulses)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    pulses.assign(m_last.begin(), m_last.end());
+}
+
+PulseMatcher::Stats PulseMatcher::stats()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    return m_stats;
+}
+
+void PulseMatcher::report(FILE* fp)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    fprintf(fp, "  Pulse matcher: %s, %d channels, window %g ns, %d frames compared, %llu pulses %llu events %llu matched (%.1f%%), "
+            "%llu frames without events %llu without traces, %d pending\n", (m_enabled ? "enabled" : "disabled"), static_cast<int>(m_nchan),
+            m_window, static_cast<int>(m_stats.frames), static_cast<unsigned long long>(m_stats.pulses),
+            static_cast<unsigned long long>(m_stats.events), static_cast<unsigned long long>(m_stats.matched),
+            (m_stats.pulses > 0 ? 100.0 * m_stats.matched / m_stats.pulses : 0.0), static_cast<unsigned long long>(m_stats.frames_no_events),
+            static_cast<unsigned long long>(m_stats.frames_no_traces), static_cast<int>(m_pending.size()));
+}
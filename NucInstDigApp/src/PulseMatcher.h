@@ -0,0 +1,92 @@
+#ifndef PULSEMATCHER_H
+#define PULSEMATCHER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+#include <epicsMutex.h>
+
+#include "EventMessage.h"
+#include "PulseFinder.h"
+
+/// Compares the pulses found in the traces of a frame by PulseFinder with the digitiser's events for
+/// the same digitizer_id and frame_number, to check its on-board discrimination.
+///
+/// Traces and events arrive on different streams and threads so each side waits, for up to max_pending
+/// frames, for the other. As elsewhere on the trace path (FrameTracker, TraceHistory, TraceAverager)
+/// a dat2 message is taken to be a whole frame of one digitiser, and so is a dev2 event message.
+/// Within a channel pulses and events are taken in time order and each is paired with the next
+/// of the other within the window. Per channel this counts pulses, events and
+/// pairs, the efficiency is pairs / pulses, and histograms the event time less the pulse time over
+/// -window to window. The events used are those passing EVENTS_FILTER, as for other consumers.
+class PulseMatcher : public EventConsumer
+{
+public:
+    struct Stats
+    {
+        uint64_t frames; ///< frames compared
+        uint64_t pulses; ///< found in the traces of compared frames
+        uint64_t events; ///< from the digitiser in compared frames
+        uint64_t matched;
+        uint64_t frames_no_events; ///< frames with traces that never had events
+        uint64_t frames_no_traces; ///< frames with events that never had traces, expected if the trace stream drops frames
+    };
+
+    static const size_t MaxChannels = 1024;
+    static const size_t MaxBins = 4096;
+
+    PulseMatcher(size_t max_pending = 64);
+    /// throws if nchan or nbins is 0 or above MaxChannels or MaxBins
+    static void checkSize(size_t nchan, size_t nbins);
+    void enable(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    /// channels 0 to nchan-1, timing window in ns and histogram bins, clears everything. If checkSize() or
+    /// the allocation throws the previous configuration is kept
+    void configure(size_t nchan, double window, size_t nbins);
+    /// the pulses of a frame, taken from pulses which is left empty
+    void addPulses(int digitizer_id, uint32_t frame_number, std::vector<Pulse>& pulses);
+    void consumeEvents(const EventMessagePtr& msg);
+    /// efficiency of each channel, 0 where there are no pulses, the time difference histograms of each channel
+    /// as an nchan x nbins matrix and their sum, with bin centres in ns
+    void merge(std::vector<double>& efficiency, std::vector<double>& dt, std::vector<double>& dt_sum, std::vector<double>& dt_x,
+               size_t& nchan, size_t& nbins);
+    /// pulses of the frame last given to addPulses()
+    void lastPulses(std::vector<Pulse>& pulses);
+    void reset();
+    Stats stats();
+    void report(FILE* fp);
+
+private:
+    struct Pending
+    {
+        int digitizer_id;
+        uint32_t frame_number;
+        bool has_pulses;
+        std::vector<Pulse> pulses;
+        EventMessagePtr events;
+        Pending() : digitizer_id(0), frame_number(0), has_pulses(false) { }
+    };
+
+    size_t m_max_pending;
+    std::atomic<bool> m_enabled;
+    epicsMutex m_lock; // protects all members except m_enabled
+    size_t m_nchan;
+    double m_window;
+    size_t m_nbins;
+    std::deque<Pending> m_pending;
+    std::vector<Pulse> m_last;
+    std::vector<uint64_t> m_pulses; // per channel
+    std::vector<uint64_t> m_events;
+    std::vector<uint64_t> m_matched;
+    std::vector<uint64_t> m_dt; // nchan * nbins
+    Stats m_stats;
+
+    size_t find(int digitizer_id, uint32_t frame_number);
+    void expire();
+    void match(const Pending& p);
+};
+
+#endif /* PULSEMATCHER_H */
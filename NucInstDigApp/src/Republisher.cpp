@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <iostream>
+
+#include <epicsGuard.h>
+
+#include "Republisher.h"
+
+bool Republisher::Subscriber::accepts(int digitiser_id, uint32_t msg_chan_min, uint32_t msg_chan_max) const
+{
+    if (digitiser >= 0 && digitiser != digitiser_id)
+    {
+        return false;
+    }
+    // forward whole messages with any channel in range, messages are not split
+    return (!filtersChannels() || (msg_chan_max >= chan_min && msg_chan_min <= chan_max));
+}
+
+Republisher::Republisher(const std::string& name) : m_name(name), m_ctx(1), m_nsubscribers(0), m_nbound(0), m_filtersChannels(false)
+{
+}
+
+Republisher::~Republisher()
+{
+    for(size_t i=0; i<m_subscribers.size(); ++i)
+    {
+        delete m_subscribers[i];
+    }
+}
+
+void Republisher::addSubscriber(const std::string& endpoint, int hwm, int digitiser, int chan_min, int chan_max)
+{
+    uint32_t sub_chan_min = 1, sub_chan_max = 0; // accept all channels
+    if (chan_min >= 0 && chan_max >= chan_min)
+    {
+        sub_chan_min = static_cast<uint32_t>(chan_min);
+        sub_chan_max = static_cast<uint32_t>(chan_max);
+    }
+    Subscriber* sub = new Subscriber(endpoint, hwm, digitiser, sub_chan_min, sub_chan_max);
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_subscribers.push_back(sub);
+    if (sub->filtersChannels())
+    {
+        m_filtersChannels = true;
+    }
+    ++m_nsubscribers;
+}
+
+// create sockets for newly added subscribers, called on the publishing thread
+void Republisher::bindSubscribers()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    for(size_t i=0; i<m_subscribers.size(); ++i)
+    {
+        Subscriber* sub = m_subscribers[i];
+        if (sub->socket)
+        {
+            continue;
+        }
+        try
+        {
+            std::unique_ptr<zmq::socket_t> socket(new zmq::socket_t(m_ctx, zmq::socket_type::xpub));
+            socket->set(zmq::sockopt::sndhwm, sub->hwm);
+            socket->set(zmq::sockopt::xpub_nodrop, true); // a full queue fails the send so drops can be counted
+            socket->set(zmq::sockopt::linger, 0);
+            socket->bind(sub->endpoint);
+            sub->socket.swap(socket);
+            std::cerr << m_name << " republishing on " << sub->endpoint << std::endl;
+        }
+        catch(const std::exception& ex)
+        {
+            std::cerr << m_name << " cannot republish on " << sub->endpoint << ": " << ex.what() << std::endl;
+            sub->socket.reset(new zmq::socket_t()); // unusable, do not retry
+        }
+        ++m_nbound;
+    }
+}
+
+void Republisher::publish(const zmq::message_t& msg, int digitiser_id, uint32_t msg_chan_min, uint32_t msg_chan_max)
+{
+    if (m_nbound != m_nsubscribers)
+    {
+        bindSubscribers();
+    }
+    epicsGuard<epicsMutex> _lock(m_lock);
+    for(size_t i=0; i<m_subscribers.size(); ++i)
+    {
+        Subscriber* sub = m_subscribers[i];
+        if (!sub->socket || !(*sub->socket) || !sub->accepts(digitiser_id, msg_chan_min, msg_chan_max))
+        {
+            continue;
+        }
+        zmq::message_t sub_msg;
+        while(sub->socket->recv(sub_msg, zmq::recv_flags::dontwait))
+        {
+            // 1 or 0 then the topic, XPUB only passes on the first subscription and last unsubscription
+            // of a topic, including those of subscribers that disconnect
+            if (sub_msg.size() > 0)
+            {
+                sub->subscriptions += (*static_cast<const uint8_t*>(sub_msg.data()) == 1 ? 1 : -1);
+            }
+        }
+        if (sub->subscriptions <= 0)
+        {
+            continue; // nobody to send to
+        }
+        sub_msg.copy(const_cast<zmq::message_t&>(msg)); // zmq_msg_copy only updates the reference count of msg
+        if (sub->socket->send(sub_msg, zmq::send_flags::dontwait))
+        {
+            ++sub->sent;
+        }
+        else
+        {
+            ++sub->dropped;
+        }
+    }
+}
+
+void Republisher::totals(uint64_t& sent, uint64_t& dropped)
+{
+    sent = dropped = 0;
+    epicsGuard<epicsMutex> _lock(m_lock);
+    for(size_t i=0; i<m_subscribers.size(); ++i)
+    {
+        sent += m_subscribers[i]->sent;
+        dropped += m_subscribers[i]->dropped;
+    }
+}
+
+void Republisher::report(FILE* fp)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (m_subscribers.empty())
+    {
+        return;
+    }
+    fprintf(fp, "  %s republished to:\n", m_name.c_str());
+    fprintf(fp, "    %-32s %8s %5s %13s %12s %12s\n", "endpoint", "hwm", "dig", "channels", "sent", "dropped");
+    for(size_t i=0; i<m_subscribers.size(); ++i)
+    {
+        const Subscriber* sub = m_subscribers[i];
+        char channels[32];
+        if (sub->filtersChannels())
+        {
+            sprintf(channels, "%u-%u", sub->chan_min, sub->chan_max);
+        }
+        else
+        {
+            sprintf(channels, "all");
+        }
+        fprintf(fp, "    %-32s %8d %5d %13s %12llu %12llu\n", sub->endpoint.c_str(), sub->hwm, sub->digitiser, channels,
+                (unsigned long long)sub->sent, (unsigned long long)sub->dropped);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef REPUBLISHER_H
+#define REPUBLISHER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include <epicsMutex.h>
+
+#include <zmq.hpp>
+
+/// Forwards received messages unchanged to local subscribers, e.g. analysis processes that also
+/// want the digitiser event or trace stream which can only be pulled by one client (this IOC).
+///
+/// Each subscriber endpoint (tcp://*:port or inproc://name) is its own XPUB socket so it has its
+/// own send high water mark, filter and counters. Messages are forwarded with zmq_msg_copy(), which
+/// shares the received buffer rather than copying it, and sent without waiting: if a subscriber's
+/// queue is full the message is dropped for that subscriber and counted. Messages are only sent, and counted,
+/// while the endpoint has at least one subscription, so sent is what reached a connected subscriber.
+/// Sockets are created and used only by the thread calling publish(), subscribers can be added from any thread.
+class Republisher
+{
+public:
+    /// digitiser < 0 accepts all digitisers, chan_max < chan_min accepts all channels
+    struct Subscriber
+    {
+        std::string endpoint;
+        int hwm;
+        int digitiser;
+        uint32_t chan_min;
+        uint32_t chan_max;
+        std::atomic<uint64_t> sent;
+        std::atomic<uint64_t> dropped;
+        int subscriptions; // distinct topics subscribed, from the XPUB subscription messages
+        std::unique_ptr<zmq::socket_t> socket;
+        Subscriber(const std::string& endpoint_, int hwm_, int digitiser_, uint32_t chan_min_, uint32_t chan_max_) :
+            endpoint(endpoint_), hwm(hwm_), digitiser(digitiser_), chan_min(chan_min_), chan_max(chan_max_), sent(0), dropped(0),
+            subscriptions(0) { }
+        bool filtersChannels() const { return chan_max >= chan_min; }
+        bool accepts(int digitiser_id, uint32_t msg_chan_min, uint32_t msg_chan_max) const;
+    };
+
+    Republisher(const std::string& name);
+    ~Republisher();
+    void addSubscriber(const std::string& endpoint, int hwm, int digitiser, int chan_min, int chan_max);
+    bool enabled() const { return m_nsubscribers > 0; }
+    /// true if some subscriber needs the channel range of a message to be passed to publish()
+    bool filtersChannels() const { return m_filtersChannels; }
+    /// forward msg to all subscribers accepting it, msg is unchanged
+    void publish(const zmq::message_t& msg, int digitiser_id, uint32_t msg_chan_min, uint32_t msg_chan_max);
+    void totals(uint64_t& sent, uint64_t& dropped);
+    void report(FILE* fp);
+    /// context of inproc:// endpoints, in process subscribers must connect using this
+    zmq::context_t& context() { return m_ctx; }
+
+private:
+    std::string m_name;
+    zmq::context_t m_ctx;
+    epicsMutex m_lock; // protects m_subscribers
+    std::vector<Subscriber*> m_subscribers;
+    std::atomic<int> m_nsubscribers;
+    std::atomic<int> m_nbound; // subscribers that have had a socket created
+    std::atomic<bool> m_filtersChannels;
+
+    void bindSubscribers();
+};
+
+#endif /* REPUBLISHER_H */
@@ -0,0 +1,234 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+/// Bounded ring of handles (e.g. shared_ptr to a received message) between one producer thread
+/// and one consumer thread, preallocated so neither side allocates or takes a lock to pass an item.
+/// Each slot has a sequence number (as in D. Vyukov's bounded queue) so the producer can also take
+/// the oldest item itself when the ring is full and the policy is DropOldest, with Block the producer
+/// waits for the consumer instead. The producer and consumer positions are on separate cache lines.
+/// Threads only wait on an epicsEvent when the ring is empty (consumer) or full (producer).
+template <typename T>
+class SPSCRing
+{
+public:
+    enum Policy { Block = 0, DropOldest };
+
+    struct Stats
+    {
+        size_t capacity;
+        size_t occupancy;
+        size_t high_water; ///< highest occupancy since the last resetStats()
+        uint64_t pushed;
+        uint64_t popped;
+        uint64_t dropped; ///< oldest items discarded by push() with DropOldest
+        uint64_t blocked; ///< push() calls that had to wait with Block
+    };
+
+    /// capacity is rounded up to a power of two, at least 2
+    explicit SPSCRing(size_t capacity, Policy policy = Block) : m_policy(policy), m_enqueuePos(0), m_highWater(0), m_pushed(0),
+                       m_dropped(0), m_blocked(0), m_dequeuePos(0), m_popped(0), m_producerWaiting(false), m_consumerWaiting(false)
+    {
+        size_t n = 2;
+        while(n < capacity)
+        {
+            n *= 2;
+        }
+        m_mask = n - 1;
+        m_cells.reset(new Cell[n]);
+        for(size_t i=0; i<n; ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    void setPolicy(Policy policy) { m_policy = policy; }
+    Policy policy() const { return m_policy; }
+    size_t capacity() const { return m_mask + 1; }
+    size_t occupancy() const
+    {
+        size_t head = m_enqueuePos.load(std::memory_order_relaxed), tail = m_dequeuePos.load(std::memory_order_relaxed);
+        return (head > tail ? head - tail : 0);
+    }
+
+    /// producer only, item is moved into the ring
+    void push(T& item)
+    {
+        bool waited = false;
+        while(!enqueue(item))
+        {
+            if (m_policy == DropOldest)
+            {
+                T oldest;
+                if (dequeue(oldest))
+                {
+                    ++m_dropped;
+                }
+                else
+                {
+                    epicsThreadSleep(0.0); // consumer is taking the oldest item
+                }
+            }
+            else
+            {
+                if (!waited)
+                {
+                    ++m_blocked;
+                    waited = true;
+                }
+                m_producerWaiting = true;
+                if (!enqueue(item))
+                {
+                    m_notFull.wait(0.01);
+                    m_producerWaiting = false;
+                    continue;
+                }
+                m_producerWaiting = false;
+                break;
+            }
+        }
+        ++m_pushed;
+        size_t occ = occupancy();
+        if (occ > m_highWater.load(std::memory_order_relaxed))
+        {
+            m_highWater.store(occ, std::memory_order_relaxed);
+        }
+        if (m_consumerWaiting)
+        {
+            m_notEmpty.signal();
+        }
+    }
+
+    /// consumer only, waits up to timeout seconds for an item, returns false if there was none
+    bool pop(T& item, double timeout)
+    {
+        bool ok = dequeue(item);
+        if (!ok)
+        {
+            m_consumerWaiting = true;
+            ok = dequeue(item); // an item pushed before the flag was seen would not signal
+            if (!ok)
+            {
+                m_notEmpty.wait(timeout);
+                ok = dequeue(item);
+            }
+            m_consumerWaiting = false;
+        }
+        if (ok)
+        {
+            ++m_popped;
+            if (m_producerWaiting)
+            {
+                m_notFull.signal();
+            }
+        }
+        return ok;
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.capacity = capacity();
+        s.occupancy = occupancy();
+        s.high_water = m_highWater;
+        s.pushed = m_pushed;
+        s.popped = m_popped;
+        s.dropped = m_dropped;
+        s.blocked = m_blocked;
+        return s;
+    }
+
+    /// counters are only approximately reset if items are being passed at the time
+    void resetStats()
+    {
+        m_highWater = occupancy();
+        m_pushed = m_popped = m_dropped = m_blocked = 0;
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    struct Cell
+    {
+        std::atomic<size_t> seq; // == position when free for the producer, position + 1 when it holds an item
+        T data;
+    };
+
+    // never called concurrently with itself, the producer is the only writer
+    bool enqueue(T& item)
+    {
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        Cell& cell = m_cells[pos & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != pos)
+        {
+            return false; // full, or the consumer is still taking the item from this cell
+        }
+        cell.data = std::move(item);
+        cell.seq.store(pos + 1, std::memory_order_release);
+        m_enqueuePos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // called by the consumer, and by the producer to drop the oldest item
+    bool dequeue(T& item)
+    {
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        cell->data = T(); // release the reference held by the ring
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    std::atomic<Policy> m_policy;
+    char m_pad0[CACHE_LINE];
+    std::atomic<size_t> m_enqueuePos; // producer position and counters
+    std::atomic<size_t> m_highWater;
+    std::atomic<uint64_t> m_pushed;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_blocked;
+    char m_pad1[CACHE_LINE];
+    std::atomic<size_t> m_dequeuePos; // consumer position and counters
+    std::atomic<uint64_t> m_popped;
+    char m_pad2[CACHE_LINE];
+    std::atomic<bool> m_producerWaiting;
+    std::atomic<bool> m_consumerWaiting;
+    epicsEvent m_notFull;
+    epicsEvent m_notEmpty;
+
+    SPSCRing(const SPSCRing&);
+    SPSCRing& operator=(const SPSCRing&);
+};
+
+#endif /* SPSCRING_H */
@@ -0,0 +1,282 @@
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include <epicsGuard.h>
+
+#include "TraceAverager.h"
+
+static const int maxFrames = 65536; // 65536 frames of 65535 still fit in 32 bits
+
+// acc[i] += x[i]
+static void accumulate(uint32_t* acc, const uint16_t* x, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i* a = reinterpret_cast<__m256i*>(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v))));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1))));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i* a = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(v, zero)));
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        acc[i] += x[i];
+    }
+}
+
+// acc[i] += ((x[i] << 16) - acc[i]) >> shift, written so that nothing goes negative
+static void accumulateExponential(uint32_t* acc, const uint16_t* x, size_t n, int shift)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m128i s = _mm_cvtsi32_si128(shift), xs = _mm_cvtsi32_si128(16 - shift);
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i* a = reinterpret_cast<__m256i*>(acc + i);
+        __m256i lo = _mm256_loadu_si256(a), hi = _mm256_loadu_si256(a + 1);
+        lo = _mm256_add_epi32(_mm256_sub_epi32(lo, _mm256_srl_epi32(lo, s)), _mm256_sll_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), xs));
+        hi = _mm256_add_epi32(_mm256_sub_epi32(hi, _mm256_srl_epi32(hi, s)), _mm256_sll_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), xs));
+        _mm256_storeu_si256(a, lo);
+        _mm256_storeu_si256(a + 1, hi);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128(), s = _mm_cvtsi32_si128(shift), xs = _mm_cvtsi32_si128(16 - shift);
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i* a = reinterpret_cast<__m128i*>(acc + i);
+        __m128i lo = _mm_loadu_si128(a), hi = _mm_loadu_si128(a + 1);
+        lo = _mm_add_epi32(_mm_sub_epi32(lo, _mm_srl_epi32(lo, s)), _mm_sll_epi32(_mm_unpacklo_epi16(v, zero), xs));
+        hi = _mm_add_epi32(_mm_sub_epi32(hi, _mm_srl_epi32(hi, s)), _mm_sll_epi32(_mm_unpackhi_epi16(v, zero), xs));
+        _mm_storeu_si128(a, lo);
+        _mm_storeu_si128(a + 1, hi);
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        acc[i] = acc[i] - (acc[i] >> shift) + (static_cast<uint32_t>(x[i]) << (16 - shift));
+    }
+}
+
+TraceAverager::TraceAverager() : m_mode(ModeOff), m_nframes(1), m_shift(0), m_count(0), m_published(0)
+{
+}
+
+void TraceAverager::setMode(int mode, int nframes)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_nframes = std::min(std::max(nframes, 1), maxFrames);
+    m_shift = 0;
+    while((2 << m_shift) <= m_nframes)
+    {
+        ++m_shift;
+    }
+    m_mode = (mode == ModeBlock || mode == ModeExponential ? mode : static_cast<int>(ModeOff));
+    clear();
+}
+
+void TraceAverager::reset()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    clear();
+}
+
+void TraceAverager::clear()
+{
+    m_channels.clear();
+    m_count = 0;
+}
+
+void TraceAverager::add(size_t chan, const uint16_t* samples, size_t n)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    int mode = m_mode;
+    if (mode == ModeOff || chan >= MaxChannels)
+    {
+        return;
+    }
+    if (chan >= m_channels.size())
+    {
+        m_channels.resize(chan + 1);
+    }
+    Channel& c = m_channels[chan];
+    if (c.acc.size() != n)
+    {
+        c.acc.assign(n, 0);
+        c.result.clear();
+        c.nacc = c.nresult = 0;
+    }
+    if (mode == ModeBlock)
+    {
+        accumulate(c.acc.data(), samples, n);
+    }
+    else if (c.nacc == 0)
+    {
+        for(size_t k=0; k<n; ++k)
+        {
+            c.acc[k] = static_cast<uint32_t>(samples[k]) << 16;
+        }
+    }
+    else
+    {
+        accumulateExponential(c.acc.data(), samples, n, m_shift);
+    }
+    ++c.nacc;
+}
+
+bool TraceAverager::endFrame()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    int mode = m_mode;
+    if (mode == ModeOff)
+    {
+        return false;
+    }
+    if (m_count < std::numeric_limits<int>::max())
+    {
+        ++m_count;
+    }
+    if (mode == ModeBlock)
+    {
+        if (m_count < m_nframes)
+        {
+            return false;
+        }
+        for(size_t i=0; i<m_channels.size(); ++i)
+        {
+            Channel& c = m_channels[i];
+            if (c.nacc > 0) // a channel missing from the whole block keeps its previous average
+            {
+                c.result.swap(c.acc);
+                c.nresult = c.nacc;
+                c.acc.assign(c.result.size(), 0);
+                c.nacc = 0;
+            }
+        }
+        m_count = 0;
+    }
+    ++m_published;
+    return true;
+}
+
+int TraceAverager::count()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    return m_count;
+}
+
+void TraceAverager::value(const Channel& c, size_t k, double& v) const
+{
+    if (m_mode == ModeBlock)
+    {
+        v = static_cast<double>(c.result[k]) / c.nresult;
+    }
+    else
+    {
+        v = c.acc[k] / 65536.0;
+    }
+}
+
+bool TraceAverager::average(size_t chan, size_t nbuckets, std::vector<double>& x, std::vector<double>& y)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (m_mode == ModeOff || chan >= m_channels.size())
+    {
+        return false;
+    }
+    const Channel& c = m_channels[chan];
+    if ((m_mode == ModeBlock ? c.nresult : c.nacc) == 0)
+    {
+        return false;
+    }
+    size_t n = c.acc.size();
+    if (nbuckets == 0 || n <= nbuckets)
+    {
+        x.resize(n);
+        y.resize(n);
+        for(size_t k=0; k<n; ++k)
+        {
+            x[k] = k;
+            value(c, k, y[k]);
+        }
+        return true;
+    }
+    size_t width = (n + nbuckets - 1) / nbuckets;
+    size_t nb = (n + width - 1) / width;
+    x.resize(2 * nb);
+    y.resize(2 * nb);
+    for(size_t b=0; b<nb; ++b)
+    {
+        size_t first = b * width, last = std::min(first + width, n);
+        double v, vmin, vmax;
+        value(c, first, vmin);
+        vmax = vmin;
+        for(size_t k=first+1; k<last; ++k)
+        {
+            value(c, k, v);
+            vmin = std::min(vmin, v);
+            vmax = std::max(vmax, v);
+        }
+        x[2 * b] = x[2 * b + 1] = first;
+        y[2 * b] = vmin;
+        y[2 * b + 1] = vmax;
+    }
+    return true;
+}
+
+void TraceAverager::averages(std::vector<epicsUInt16>& data, size_t nspec, size_t& npts)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    npts = 0;
+    for(size_t i=0; i<std::min(nspec, m_channels.size()); ++i)
+    {
+        npts = std::max(npts, m_channels[i].acc.size());
+    }
+    data.assign(nspec * npts, 0);
+    for(size_t i=0; i<std::min(nspec, m_channels.size()); ++i)
+    {
+        const Channel& c = m_channels[i];
+        epicsUInt16* out = data.data() + i * npts;
+        if (m_mode == ModeBlock && c.nresult > 0)
+        {
+            uint32_t half = c.nresult / 2;
+            for(size_t k=0; k<c.result.size(); ++k)
+            {
+                out[k] = static_cast<epicsUInt16>((c.result[k] + static_cast<uint64_t>(half)) / c.nresult);
+            }
+        }
+        else if (m_mode == ModeExponential && c.nacc > 0)
+        {
+            for(size_t k=0; k<c.acc.size(); ++k)
+            {
+                out[k] = static_cast<epicsUInt16>(std::min<uint64_t>((c.acc[k] + UINT64_C(0x8000)) >> 16, UINT16_MAX));
+            }
+        }
+    }
+}
+
+void TraceAverager::report(FILE* fp)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    static const char* modes[] = { "off", "block", "exponential" };
+    fprintf(fp, "  Trace averaging: %s over %d frames, %d channels, %d frames in current average, %llu averages published\n",
+            modes[m_mode], (m_mode == ModeExponential ? (1 << m_shift) : m_nframes), static_cast<int>(m_channels.size()),
+            m_count, static_cast<unsigned long long>(m_published));
+}
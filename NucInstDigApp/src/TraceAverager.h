@@ -0,0 +1,69 @@
+#ifndef TRACEAVERAGER_H
+#define TRACEAVERAGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+/// Per channel signal averaging of traces over frames, to see small or slow features under the
+/// noise of single shot traces. Samples are summed into 32 bit accumulators, 16 samples at a
+/// time with AVX2 or 8 with SSE2 when the compiler targets it, so adding a frame costs about
+/// as much as copying it and the averager keeps up with the full trace stream.
+///
+/// ModeBlock sums nframes frames (at most 65536, so a sum cannot overflow) and then publishes
+/// their mean and starts the next block. ModeExponential keeps a moving average in 16.16 fixed
+/// point, each new frame has weight 1/nframes with nframes rounded down to a power of 2 so the
+/// update is a shift and an add, and it is published after every frame.
+class TraceAverager
+{
+public:
+    enum Mode { ModeOff = 0, ModeBlock = 1, ModeExponential = 2 };
+    /// channels at or above this are not averaged, the channel number comes from the stream
+    static const size_t MaxChannels = 1024;
+
+    TraceAverager();
+    /// restarts the average
+    void setMode(int mode, int nframes);
+    bool enabled() const { return m_mode != ModeOff; }
+    /// forget all frames
+    void reset();
+    /// add a channel of the current frame, a change in the number of samples restarts the channel
+    void add(size_t chan, const uint16_t* samples, size_t n);
+    /// the current frame is complete, returns true if there is a new average
+    bool endFrame();
+    /// frames in the current block, or in the moving average
+    int count();
+    /// latest average of chan as a line plot of at most nbuckets min/max pairs as for traceEnvelope(),
+    /// false if chan has no average yet
+    bool average(size_t chan, size_t nbuckets, std::vector<double>& x, std::vector<double>& y);
+    /// latest averages of channels 0 to nspec - 1 rounded to ADC counts, channels without an average are 0
+    void averages(std::vector<epicsUInt16>& data, size_t nspec, size_t& npts);
+    void report(FILE* fp);
+
+private:
+    struct Channel
+    {
+        std::vector<uint32_t> acc; // block sums, or the moving average << 16
+        std::vector<uint32_t> result; // last complete block sum
+        uint32_t nacc; // frames in acc
+        uint32_t nresult; // frames in result
+        Channel() : nacc(0), nresult(0) { }
+    };
+    epicsMutex m_lock; // protects all members except m_mode
+    std::atomic<int> m_mode;
+    int m_nframes;
+    int m_shift; // log2(m_nframes) for ModeExponential
+    int m_count; // frames ended since the start of the block or of the moving average
+    std::vector<Channel> m_channels;
+    uint64_t m_published; // averages published
+
+    void value(const Channel& c, size_t k, double& v) const;
+    void clear();
+};
+
+#endif /* TRACEAVERAGER_H */
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "TraceEnvelope.h"
+
+void traceMinMax(const uint16_t* samples, size_t n, uint16_t& vmin, uint16_t& vmax)
+{
+    size_t i = 0;
+    uint16_t lo = UINT16_MAX, hi = 0;
+#if defined(__AVX2__)
+    if (n >= 16)
+    {
+        __m256i mn = _mm256_set1_epi16(-1), mx = _mm256_setzero_si256();
+        for(; i + 16 <= n; i += 16)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i));
+            mn = _mm256_min_epu16(mn, v);
+            mx = _mm256_max_epu16(mx, v);
+        }
+        uint16_t lanes[32];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), mn);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 16), mx);
+        lo = *std::min_element(lanes, lanes + 16);
+        hi = *std::max_element(lanes + 16, lanes + 32);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    if (n >= 8)
+    {
+        // SSE2 only has signed 16 bit min/max, flipping the top bit maps unsigned order onto signed order
+        const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i mn = _mm_set1_epi16(0x7fff), mx = _mm_set1_epi16(static_cast<short>(0x8000));
+        for(; i + 8 <= n; i += 8)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i)), flip);
+            mn = _mm_min_epi16(mn, v);
+            mx = _mm_max_epi16(mx, v);
+        }
+        uint16_t lanes[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_xor_si128(mn, flip));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 8), _mm_xor_si128(mx, flip));
+        lo = *std::min_element(lanes, lanes + 8);
+        hi = *std::max_element(lanes + 8, lanes + 16);
+    }
+#endif
+    for(; i < n; ++i)
+    {
+        lo = std::min(lo, samples[i]);
+        hi = std::max(hi, samples[i]);
+    }
+    vmin = lo;
+    vmax = hi;
+}
+
+void traceEnvelope(const uint16_t* samples, size_t n, size_t nbuckets, std::vector<double>& x, std::vector<double>& y)
+{
+    if (nbuckets == 0 || n <= nbuckets)
+    {
+        x.resize(n);
+        y.resize(n);
+        for(size_t k=0; k<n; ++k)
+        {
+            x[k] = k;
+            y[k] = samples[k];
+        }
+        return;
+    }
+    size_t width = (n + nbuckets - 1) / nbuckets;
+    size_t nb = (n + width - 1) / width;
+    x.resize(2 * nb);
+    y.resize(2 * nb);
+    for(size_t b=0; b<nb; ++b)
+    {
+        size_t first = b * width;
+        uint16_t vmin, vmax;
+        traceMinMax(samples + first, std::min(width, n - first), vmin, vmax);
+        x[2 * b] = x[2 * b + 1] = first;
+        y[2 * b] = vmin;
+        y[2 * b + 1] = vmax;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef TRACEENVELOPE_H
+#define TRACEENVELOPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/// Decimate a trace for display as a min/max envelope. The samples are split into at most
+/// nbuckets buckets of equal length and each bucket becomes two points, its minimum then
+/// its maximum, both at the x of the first sample of the bucket, so a line plot of x, y
+/// draws the envelope and no spike is lost however far the trace is decimated. A trace
+/// of nbuckets samples or fewer is returned as it is.
+/// The minimum and maximum of a bucket are found 16 samples at a time with AVX2, or 8 with
+/// SSE2, when the compiler targets it.
+void traceEnvelope(const uint16_t* samples, size_t n, size_t nbuckets, std::vector<double>& x, std::vector<double>& y);
+
+/// minimum and maximum of n > 0 samples
+void traceMinMax(const uint16_t* samples, size_t n, uint16_t& vmin, uint16_t& vmax);
+
+#endif /* TRACEENVELOPE_H */
@@ -0,0 +1,219 @@
+#include <string.h>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <epicsGuard.h>
+
+#include "TraceEnvelope.h"
+#include "TraceHistory.h"
+
+TraceHistory::TraceHistory() : m_enabled(false), m_nframes(0), m_nchan(0), m_npts(0), m_npre(0), m_npost(0), m_current(0),
+                               m_captureFrames(0), m_state(StateIdle), m_trigger(TriggerNone), m_triggerChan(-1), m_triggerLevel(0),
+                               m_triggerPending(false), m_triggerSlot(0), m_postRemaining(0), m_ncaptures(0), m_triggerFrame(0)
+{
+}
+
+void TraceHistory::checkSize(size_t nframes, size_t nchan, size_t npts, size_t npre, size_t npost)
+{
+    nframes = std::max(nframes, npre + 1 + npost);
+    if (nframes == 0 || nchan == 0 || npts == 0 || nframes > MaxSamples || nchan > MaxSamples / nframes ||
+        npts > MaxSamples / (nframes * nchan))
+    {
+        throw std::runtime_error("TraceHistory: " + std::to_string(nframes) + " frames x " + std::to_string(nchan) + " channels x " +
+                                 std::to_string(npts) + " samples must be 1 to " + std::to_string(MaxSamples));
+    }
+}
+
+void TraceHistory::configure(size_t nframes, size_t nchan, size_t npts, size_t npre, size_t npost)
+{
+    checkSize(nframes, nchan, npts, npre, npost);
+    nframes = std::max(nframes, npre + 1 + npost);
+    // allocate before changing anything so a failure leaves the old ring in use
+    std::vector<epicsUInt16> ring(nframes * nchan * npts, 0);
+    std::vector<epicsUInt16> capture((npre + 1 + npost) * nchan * npts, 0);
+    std::vector<int64_t> ring_frame(nframes, -1);
+    std::vector<char> written(nchan, 0);
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_nframes = nframes;
+    m_nchan = nchan;
+    m_npts = npts;
+    m_npre = npre;
+    m_npost = npost;
+    m_ring.swap(ring);
+    m_ringFrame.swap(ring_frame);
+    m_written.swap(written);
+    m_current = 0;
+    m_capture.swap(capture);
+    m_captureFrames = 0;
+    m_triggerPending = false;
+    if (m_state == StateCapturing)
+    {
+        m_state = StateArmed;
+    }
+}
+
+void TraceHistory::setAmplitudeTrigger(int trigger, int chan, int level)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    m_trigger = trigger;
+    m_triggerChan = chan;
+    m_triggerLevel = level;
+}
+
+void TraceHistory::arm(bool armed)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (m_state != StateCapturing)
+    {
+        m_state = (armed ? StateArmed : StateIdle);
+    }
+}
+
+void TraceHistory::trigger()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (m_state != StateCapturing)
+    {
+        m_triggerPending = true;
+    }
+}
+
+void TraceHistory::beginFrame(uint32_t frame_number)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (m_nframes == 0)
+    {
+        return;
+    }
+    m_current = (m_current + 1) % m_nframes;
+    m_ringFrame[m_current] = frame_number;
+    std::fill(m_written.begin(), m_written.end(), 0);
+}
+
+void TraceHistory::add(size_t chan, const uint16_t* samples, size_t n)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (chan >= m_nchan)
+    {
+        return;
+    }
+    epicsUInt16* slot = m_ring.data() + (m_current * m_nchan + chan) * m_npts;
+    size_t ncopy = std::min(n, m_npts);
+    memcpy(slot, samples, ncopy * sizeof(epicsUInt16));
+    memset(slot + ncopy, 0, (m_npts - ncopy) * sizeof(epicsUInt16));
+    m_written[chan] = 1;
+    if (m_state == StateArmed && !m_triggerPending && m_trigger != TriggerNone && n > 0 &&
+        (m_triggerChan < 0 || static_cast<size_t>(m_triggerChan) == chan))
+    {
+        uint16_t vmin, vmax;
+        traceMinMax(samples, n, vmin, vmax);
+        if ((m_trigger == TriggerAbove && vmax >= m_triggerLevel) || (m_trigger == TriggerBelow && vmin <= m_triggerLevel))
+        {
+            m_triggerPending = true;
+        }
+    }
+}
+
+bool TraceHistory::endFrame()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    if (m_nframes == 0)
+    {
+        return false;
+    }
+    for(size_t i=0; i<m_nchan; ++i)
+    {
+        if (!m_written[i])
+        {
+            memset(m_ring.data() + (m_current * m_nchan + i) * m_npts, 0, m_npts * sizeof(epicsUInt16));
+        }
+    }
+    if (m_state == StateCapturing)
+    {
+        if (--m_postRemaining == 0)
+        {
+            freeze();
+            return true;
+        }
+        return false;
+    }
+    if (m_triggerPending)
+    {
+        m_triggerPending = false;
+        m_triggerSlot = m_current;
+        m_triggerFrame = static_cast<uint32_t>(m_ringFrame[m_current]);
+        m_postRemaining = m_npost;
+        if (m_postRemaining == 0)
+        {
+            freeze();
+            return true;
+        }
+        m_state = StateCapturing;
+    }
+    return false;
+}
+
+// copy the frames around m_triggerSlot to m_capture, frames not yet filled are 0
+void TraceHistory::freeze()
+{
+    size_t frame_size = m_nchan * m_npts;
+    size_t n = m_npre + 1 + m_npost;
+    size_t slot = (m_triggerSlot + m_nframes - m_npre) % m_nframes;
+    for(size_t i=0; i<n; ++i)
+    {
+        epicsUInt16* out = m_capture.data() + i * frame_size;
+        if (m_ringFrame[slot] >= 0)
+        {
+            memcpy(out, m_ring.data() + slot * frame_size, frame_size * sizeof(epicsUInt16));
+        }
+        else
+        {
+            memset(out, 0, frame_size * sizeof(epicsUInt16));
+        }
+        slot = (slot + 1) % m_nframes;
+    }
+    m_captureFrames = n;
+    ++m_ncaptures;
+    m_state = StateIdle; // re-armed by arm()
+}
+
+int TraceHistory::state()
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    return m_state;
+}
+
+void TraceHistory::captureStats(uint64_t& ncaptures, uint32_t& trigger_frame)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    ncaptures = m_ncaptures;
+    trigger_frame = m_triggerFrame;
+}
+
+void TraceHistory::captureSize(size_t& npts, size_t& nchan, size_t& nframes)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    npts = m_npts;
+    nchan = m_nchan;
+    nframes = m_captureFrames;
+}
+
+void TraceHistory::copyCapture(epicsUInt16* out, size_t nsamples)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    size_t n = std::min(nsamples, m_captureFrames * m_nchan * m_npts);
+    memcpy(out, m_capture.data(), n * sizeof(epicsUInt16));
+    memset(out + n, 0, (nsamples - n) * sizeof(epicsUInt16));
+}
+
+void TraceHistory::report(FILE* fp)
+{
+    epicsGuard<epicsMutex> _lock(m_lock);
+    static const char* states[] = { "idle", "armed", "capturing" };
+    fprintf(fp, "  Trace history: %s, %s, %d frames of %d channels x %d samples (%.1f MB), capture %d before %d after, "
+            "%llu captures, last trigger frame %u\n", (m_enabled ? "enabled" : "disabled"), states[m_state],
+            static_cast<int>(m_nframes), static_cast<int>(m_nchan), static_cast<int>(m_npts),
+            (m_ring.size() + m_capture.size()) * sizeof(epicsUInt16) / 1.0e6, static_cast<int>(m_npre), static_cast<int>(m_npost),
+            static_cast<unsigned long long>(m_ncaptures), m_triggerFrame);
+}
@@ -0,0 +1,86 @@
+#ifndef TRACEHISTORY_H
+#define TRACEHISTORY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+
+/// Ring of the last nframes streamed trace frames, so that when something goes wrong, such as an
+/// HV trip or a noise burst, the frames around it can be looked at rather than just the next one.
+///
+/// A trigger, from trigger() or a sample of a trace crossing the amplitude level while armed,
+/// freezes a capture of the npre frames before the triggering frame, the frame itself and the
+/// npost frames after it, which stays until the next capture completes. Every capture, amplitude
+/// or manual, disarms, so it is not overwritten by the next burst before it has been looked at.
+///
+/// All memory is allocated by configure(), each channel of a frame is stored as npts samples,
+/// truncated or padded with 0, and the frame handling methods only copy into it.
+class TraceHistory
+{
+public:
+    enum State { StateIdle = 0, StateArmed = 1, StateCapturing = 2 };
+    enum Trigger { TriggerNone = 0, TriggerAbove = 1, TriggerBelow = 2 };
+    /// largest ring of nframes * nchan * npts samples
+    static const size_t MaxSamples = 1 << 27;
+
+    TraceHistory();
+    /// throws if the ring configure() would allocate is larger than MaxSamples
+    static void checkSize(size_t nframes, size_t nchan, size_t npts, size_t npre, size_t npost);
+    /// allocates the ring and capture and forgets everything, nframes is raised to at least npre + 1 + npost.
+    /// If checkSize() or the allocation throws the previous configuration is kept
+    void configure(size_t nframes, size_t nchan, size_t npts, size_t npre, size_t npost);
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    /// trigger when a sample of chan, or any channel if chan < 0, is >= level (TriggerAbove) or <= level (TriggerBelow)
+    void setAmplitudeTrigger(int trigger, int chan, int level);
+    void arm(bool armed);
+    /// capture around the next frame
+    void trigger();
+    /// start storing a frame, the oldest frame in the ring is replaced
+    void beginFrame(uint32_t frame_number);
+    void add(size_t chan, const uint16_t* samples, size_t n);
+    /// returns true if this frame completed a capture
+    bool endFrame();
+    int state();
+    /// captures completed so far and the frame_number of the last trigger
+    void captureStats(uint64_t& ncaptures, uint32_t& trigger_frame);
+    /// dimensions of the last capture, nframes is 0 if there is none
+    void captureSize(size_t& npts, size_t& nchan, size_t& nframes);
+    /// copy the last capture, frame by frame then channel by channel, into out of npts * nchan * nframes samples
+    /// as given by captureSize() with no other capture completing in between
+    void copyCapture(epicsUInt16* out, size_t nsamples);
+    void report(FILE* fp);
+
+private:
+    epicsMutex m_lock; // protects all members except m_enabled
+    std::atomic<bool> m_enabled;
+    size_t m_nframes; // ring depth
+    size_t m_nchan;
+    size_t m_npts;
+    size_t m_npre;
+    size_t m_npost;
+    std::vector<epicsUInt16> m_ring; // m_nframes frames of m_nchan * m_npts
+    std::vector<int64_t> m_ringFrame; // frame_number of each slot, -1 if never filled
+    std::vector<char> m_written; // channels of the current frame seen by add()
+    size_t m_current; // slot of the current frame
+    std::vector<epicsUInt16> m_capture; // (m_npre + 1 + m_npost) frames
+    size_t m_captureFrames; // frames in m_capture, 0 for none
+    int m_state;
+    int m_trigger;
+    int m_triggerChan;
+    int m_triggerLevel;
+    bool m_triggerPending; // trigger at the end of the current frame
+    size_t m_triggerSlot;
+    size_t m_postRemaining; // frames still to come for the current capture
+    uint64_t m_ncaptures;
+    uint32_t m_triggerFrame;
+
+    void freeze();
+};
+
+#endif /* TRACEHISTORY_H */
@@ -0,0 +1,127 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsGuard.h>
+
+/// A bounded queue of work items shared by a set of worker threads. Each worker owns a Partial
+/// for its results so items can be processed without a common lock, the owner of the pool adds
+/// up the partials (taking Partial::lock) when it wants totals. Items are passed to the process
+/// function on a worker thread with that worker's Partial, an exception drops the item and is
+/// printed. Submitting to a full queue drops the item and counts it.
+template <typename Item, typename Partial>
+class WorkerPool
+{
+public:
+    typedef void (*ProcessFunc)(void* owner, const Item& item, Partial* partial);
+
+    /// label is used for error messages, nothing is processed until start()
+    WorkerPool(const std::string& label, size_t max_queued, ProcessFunc process, void* owner) :
+        m_nDropped(0), m_label(label), m_max_queued(max_queued), m_process(process), m_owner(owner) { }
+
+    /// create nthreads (at least one) workers named prefix0, prefix1, ... call once the owner is fully constructed
+    void start(const std::string& prefix, int nthreads)
+    {
+        for(int i=0; i<std::max(nthreads, 1); ++i)
+        {
+            Partial* partial = new Partial;
+            m_partials.push_back(partial);
+            WorkerArg* arg = new WorkerArg;
+            arg->pool = this;
+            arg->partial = partial;
+            std::string thread_name = prefix + std::to_string(i);
+            if (epicsThreadCreate(thread_name.c_str(), epicsThreadPriorityMedium,
+                                  epicsThreadGetStackSize(epicsThreadStackMedium),
+                                  (EPICSTHREADFUNC)workerC, arg) == 0)
+            {
+                throw std::runtime_error(m_label + ": epicsThreadCreate failure");
+            }
+        }
+    }
+
+    /// false if the queue was full and the item dropped
+    bool submit(const Item& item)
+    {
+        {
+            epicsGuard<epicsMutex> _lock(m_queueLock);
+            if (m_queue.size() >= m_max_queued)
+            {
+                ++m_nDropped;
+                return false;
+            }
+            m_queue.push_back(item);
+        }
+        m_queueEvent.signal();
+        return true;
+    }
+
+    /// one per worker, fixed once start() has returned
+    const std::vector<Partial*>& partials() const { return m_partials; }
+    uint64_t nDropped() const { return m_nDropped; } ///< items not processed as the queue was full
+    void resetDropped() { m_nDropped = 0; }
+
+private:
+    struct WorkerArg { WorkerPool* pool; Partial* partial; };
+
+    std::vector<Partial*> m_partials;
+    std::atomic<uint64_t> m_nDropped;
+    std::string m_label;
+    size_t m_max_queued;
+    ProcessFunc m_process;
+    void* m_owner;
+    epicsMutex m_queueLock; // protects m_queue
+    epicsEvent m_queueEvent;
+    std::deque<Item> m_queue;
+
+    static void workerC(void* arg)
+    {
+        WorkerArg* warg = static_cast<WorkerArg*>(arg);
+        warg->pool->worker(warg->partial);
+    }
+
+    void worker(Partial* partial)
+    {
+        while(true)
+        {
+            m_queueEvent.wait();
+            while(true)
+            {
+                Item item;
+                {
+                    epicsGuard<epicsMutex> _lock(m_queueLock);
+                    if (m_queue.empty())
+                    {
+                        break;
+                    }
+                    item = m_queue.front();
+                    m_queue.pop_front();
+                    if (!m_queue.empty())
+                    {
+                        m_queueEvent.signal(); // wake another worker to share the backlog
+                    }
+                }
+                try
+                {
+                    m_process(m_owner, item, partial);
+                }
+                catch(const std::exception& ex)
+                {
+                    std::cerr << m_label << ": " << ex.what() << std::endl;
+                }
+            }
+        }
+    }
+};
+
+#endif /* WORKERPOOL_H */
@@ -7,6 +7,8 @@
 
 #include <zmq.hpp>
 
+#include "NucInstDigBinary.h"
+
 int main(int argc, char* argv[])
 {
     try {
@@ -56,6 +58,10 @@ int main(int argc, char* argv[])
         doc_send.AddMember("name", arg3, doc_send.GetAllocator());
         arg4.SetString((argc > 4 ? argv[4] : ""), doc_send.GetAllocator());
         doc_send.AddMember("args", arg4, doc_send.GetAllocator());
+        if (argc > 5)
+        {
+            doc_send.AddMember("format", arg5, doc_send.GetAllocator());
+        }
     }
     else
     {
@@ -70,6 +76,14 @@ int main(int argc, char* argv[])
     socket.send(zmq::buffer(sendstr), zmq::send_flags::none);
     zmq::message_t reply{};
     socket.recv(reply, zmq::recv_flags::none);
+    if (nidgIsBinaryReply(reply.data(), reply.size()))
+    {
+        const char* buffer = static_cast<const char*>(reply.data());
+        std::cout << "Received binary reply of " << reply.size() << " bytes: dtype=" << static_cast<int>(buffer[offsetof(NIDGBinaryHeader, dtype)])
+                  << " nspec=" << nidgReadLE<uint32_t>(buffer + offsetof(NIDGBinaryHeader, nspec))
+                  << " npts=" << nidgReadLE<uint32_t>(buffer + offsetof(NIDGBinaryHeader, npts)) << std::endl;
+        return 0;
+    }
     std::cout << "Received " << reply.to_string() << std::endl;
     rapidjson::Document doc_recv;
     doc_recv.Parse(reply.to_string().c_str());
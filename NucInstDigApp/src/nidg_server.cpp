@@ -0,0 +1,194 @@
+// Stand-in for the digitiser command server on port 5557, for testing the IOC and nidg_send without hardware.
+//
+// usage: nidg_server [port] [json]
+//
+// Parameters can be set and read back, commands are acknowledged and execute_read_command returns
+// synthetic dark count / TOF spectra and waveforms. Bulk reads are sent in the binary format of
+// NucInstDigBinary.h when requested, unless "json" is given in which case a request for binary
+// format is rejected with an error in the same way as older digitiser firmware.
+
+#include <string>
+#include <iostream>
+#include <exception>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <stdlib.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+
+#include <zmq.hpp>
+
+#include "NucInstDigBinary.h"
+
+static const uint32_t NSPEC = 8;
+static const uint32_t NPTS_SPECTRA = 4096;
+static const uint32_t NPTS_TRACE = 2048;
+
+// synthetic data, a peak on a flat background that moves with spectrum number
+static uint32_t makeValue(const std::string& name, uint32_t spec, uint32_t pt, uint32_t npts)
+{
+    uint32_t centre = (spec + 1) * npts / (NSPEC + 1);
+    uint32_t dist = (pt > centre ? pt - centre : centre - pt);
+    if (name == "get_waveforms")
+    {
+        return 8000 + (dist < 20 ? 4000 - 200 * dist : 0) + (rand() % 16);
+    }
+    return 10 + (dist < 100 ? 10000 / (dist + 1) : 0) + (rand() % 4);
+}
+
+static zmq::message_t readDataBinary(const std::string& name, uint32_t nspec, uint32_t npts)
+{
+    NIDGBinaryType dtype = (name == "get_waveforms" ? NIDGBinaryUInt16 : NIDGBinaryUInt32);
+    size_t dsize = nidgBinaryTypeSize(dtype);
+    zmq::message_t msg(sizeof(NIDGBinaryHeader) + nspec * npts * dsize);
+    char* p = static_cast<char*>(msg.data());
+    nidgMakeBinaryHeader(p, dtype, nspec, npts);
+    p += sizeof(NIDGBinaryHeader);
+    for(uint32_t i = 0; i < nspec; ++i)
+    {
+        for(uint32_t j = 0; j < npts; ++j, p += dsize)
+        {
+            uint32_t v = makeValue(name, i, j, npts);
+            if (dtype == NIDGBinaryUInt16)
+            {
+                nidgWriteLE<uint16_t>(p, static_cast<uint16_t>(v));
+            }
+            else
+            {
+                nidgWriteLE<uint32_t>(p, v);
+            }
+        }
+    }
+    return msg;
+}
+
+static void readDataJSON(const std::string& name, uint32_t nspec, uint32_t npts, rapidjson::Document& doc_reply)
+{
+    rapidjson::Value data(rapidjson::kArrayType);
+    for(uint32_t i = 0; i < nspec; ++i)
+    {
+        rapidjson::Value spec(rapidjson::kArrayType);
+        spec.Reserve(npts, doc_reply.GetAllocator());
+        for(uint32_t j = 0; j < npts; ++j)
+        {
+            spec.PushBack(makeValue(name, i, j, npts), doc_reply.GetAllocator());
+        }
+        data.PushBack(spec, doc_reply.GetAllocator());
+    }
+    doc_reply.AddMember("data", data, doc_reply.GetAllocator());
+}
+
+static void setError(rapidjson::Document& doc_reply, int code, const std::string& message)
+{
+    rapidjson::Value messagev(message.c_str(), doc_reply.GetAllocator());
+    doc_reply["response"].SetString("error");
+    doc_reply.AddMember("error_code", code, doc_reply.GetAllocator());
+    doc_reply.AddMember("message", messagev, doc_reply.GetAllocator());
+}
+
+static std::string paramKey(const rapidjson::Value& v)
+{
+    std::ostringstream oss;
+    oss << (v.HasMember("name") && v["name"].IsString() ? v["name"].GetString() : "") << "[" << (v.HasMember("idx") && v["idx"].IsInt() ? v["idx"].GetInt() : 0) << "]";
+    return oss.str();
+}
+
+int main(int argc, char* argv[])
+{
+    std::map<std::string, std::string> params;
+    std::string port = (argc > 1 ? argv[1] : "5557");
+    bool json_only = (argc > 2 && std::string(argv[2]) == "json");
+    try {
+    zmq::context_t ctx{1};
+    zmq::socket_t socket(ctx, zmq::socket_type::rep);
+    std::string addr = std::string("tcp://*:") + port;
+    socket.bind(addr.c_str());
+    std::cerr << "Listening on " << addr << (json_only ? " (JSON replies only)" : "") << std::endl;
+    while(true) {
+        zmq::message_t request{};
+        if (!socket.recv(request, zmq::recv_flags::none)) {
+            continue;
+        }
+        rapidjson::Document doc_recv, doc_reply;
+        doc_reply.SetObject();
+        doc_reply.AddMember("response", "ok", doc_reply.GetAllocator());
+        zmq::message_t reply{};
+        bool binary_reply = false;
+        doc_recv.Parse(request.to_string().c_str());
+        if (doc_recv.HasParseError() || !doc_recv.IsObject() || !doc_recv.HasMember("command") || !doc_recv["command"].IsString())
+        {
+            setError(doc_reply, 1, "invalid request");
+        }
+        else
+        {
+            std::string command = doc_recv["command"].GetString();
+            std::string name = (doc_recv.HasMember("name") && doc_recv["name"].IsString() ? doc_recv["name"].GetString() : "");
+            if (command == "execute_cmd")
+            {
+                std::cout << "execute_cmd " << name << std::endl;
+            }
+            else if (command == "set_parameter")
+            {
+                const rapidjson::Value& value = doc_recv["value"];
+                params[paramKey(doc_recv)] = (value.IsString() ? value.GetString() : "0");
+            }
+            else if (command == "get_parameter")
+            {
+                rapidjson::Value value(params[paramKey(doc_recv)].c_str(), doc_reply.GetAllocator());
+                doc_reply.AddMember("value", value, doc_reply.GetAllocator());
+            }
+            else if (command == "get_parameters" && doc_recv.HasMember("params") && doc_recv["params"].IsArray())
+            {
+                rapidjson::Value values(rapidjson::kArrayType);
+                for(rapidjson::SizeType i = 0; i < doc_recv["params"].Size(); ++i)
+                {
+                    rapidjson::Value value(params[paramKey(doc_recv["params"][i])].c_str(), doc_reply.GetAllocator());
+                    values.PushBack(value, doc_reply.GetAllocator());
+                }
+                doc_reply.AddMember("values", values, doc_reply.GetAllocator());
+            }
+            else if (command == "execute_read_command" &&
+                     (name == "get_darkcount_spectra" || name == "get_tof_spectra" || name == "get_waveforms"))
+            {
+                uint32_t npts = (name == "get_waveforms" ? NPTS_TRACE : NPTS_SPECTRA);
+                bool binary = (doc_recv.HasMember("format") && doc_recv["format"].IsString() &&
+                               std::string(doc_recv["format"].GetString()) == "binary");
+                if (binary && json_only)
+                {
+                    setError(doc_reply, 2, "unknown argument: format");
+                }
+                else if (binary)
+                {
+                    reply = readDataBinary(name, NSPEC, npts);
+                    binary_reply = true;
+                }
+                else
+                {
+                    readDataJSON(name, NSPEC, npts, doc_reply);
+                }
+            }
+            else
+            {
+                setError(doc_reply, 3, std::string("unknown command: ") + command + " " + name);
+            }
+        }
+        if (!binary_reply)
+        {
+            rapidjson::StringBuffer sb;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+            doc_reply.Accept(writer);
+            reply.rebuild(sb.GetString(), sb.GetSize());
+        }
+        std::cout << "Received " << request.to_string() << " replying with " << reply.size() << " bytes" << (binary_reply ? " binary" : "") << std::endl;
+        socket.send(reply, zmq::send_flags::none);
+    }
+    }
+    catch(const std::exception& ex)
+    {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+REM test against a local nidg_server, run "nidg_server.bat" or "nidg_server.bat 5557 json" first
+call nidg_send.bat "set_parameter" "localhost" "mp.gain" 0 "2"
+call nidg_send.bat "get_parameter" "localhost" "mp.gain" 0
+call nidg_send.bat "read_data" "localhost" "get_darkcount_spectra" "" "binary"
+call nidg_send.bat "read_data" "localhost" "get_waveforms" "" "binary"
+call nidg_send.bat "read_data" "localhost" "get_tof_spectra"